@@ -1,20 +1,63 @@
 #include "GPUDependencyGraph.h"
 
+#include <algorithm>
+#include <cassert>
+
 #include "GPUEngine.h"
 
+/**
+ * @brief Returns the access flags with which a resource may be used in the given pipeline stages.
+ * 
+ * Used to form the destination access mask of a barrier, given the stages in which
+ * a dependent process uses a resource.
+ */
+inline VkAccessFlags getAccessFlagsForStages(VkPipelineStageFlags stages)
+{
+	VkAccessFlags access = 0;
+	if (stages & VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT)
+		access |= VK_ACCESS_INDIRECT_COMMAND_READ_BIT;
+	if (stages & VK_PIPELINE_STAGE_VERTEX_INPUT_BIT)
+		access |= VK_ACCESS_INDEX_READ_BIT | VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT;
+	if (stages & (VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_TESSELLATION_CONTROL_SHADER_BIT
+		| VK_PIPELINE_STAGE_TESSELLATION_EVALUATION_SHADER_BIT | VK_PIPELINE_STAGE_GEOMETRY_SHADER_BIT
+		| VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT))
+		access |= VK_ACCESS_UNIFORM_READ_BIT | VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+	if (stages & VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT)
+		access |= VK_ACCESS_INPUT_ATTACHMENT_READ_BIT;
+	if (stages & (VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT))
+		access |= VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+	if (stages & VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT)
+		access |= VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+	if (stages & VK_PIPELINE_STAGE_TRANSFER_BIT)
+		access |= VK_ACCESS_TRANSFER_READ_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
+	if (stages & VK_PIPELINE_STAGE_HOST_BIT)
+		access |= VK_ACCESS_HOST_READ_BIT | VK_ACCESS_HOST_WRITE_BIT;
+	if (stages & (VK_PIPELINE_STAGE_ALL_GRAPHICS_BIT | VK_PIPELINE_STAGE_ALL_COMMANDS_BIT))
+		access |= VK_ACCESS_MEMORY_READ_BIT | VK_ACCESS_MEMORY_WRITE_BIT;
+	return access;
+}
+
 GPUDependencyGraph::GPUDependencyGraph(GPUEngine* engine)
 {
 	mEngine = engine;
+
+	// the calling thread records too, so it gets the first command pool of each frame
+	mRecordingThreadCount = mEngine->getWorkerPool()->getThreadCount();
 }
 
 GPUDependencyGraph::~GPUDependencyGraph()
 {
+	waitIdle();
 	cleanupEdges();
+	cleanupFrames();
+	vkDestroyCommandPool(mEngine->getDevice(), mBarrierCommandPool, nullptr);
+	vkDestroySemaphore(mEngine->getDevice(), mTimelineSemaphore, nullptr);
 
 	for (auto& entry : mProcessNodeIndices)
 	{
 		delete entry.first;
 	}
+	freeTransientMemory();
 }
 
 /**
@@ -44,6 +87,17 @@ void GPUDependencyGraph::addProcess(GPUProcess* process)
  */
 void GPUDependencyGraph::build()
 {
+	// create per-frame resources
+	if (mFrames.size() != mFramesInFlight)
+	{
+		cleanupFrames();
+		createFrames();
+	}
+
+	// use a timeline semaphore for command dependencies if the device supports it
+	if (mTimelineSemaphore == VK_NULL_HANDLE && mEngine->supportsTimelineSemaphores())
+		mTimelineSemaphore = mEngine->createTimelineSemaphore(mTimelineValue);
+
 	// first, create all necessary edges
 	cleanupEdges();
 	for (size_t i=0; i<mNodes.size(); i++)
@@ -56,16 +110,48 @@ void GPUDependencyGraph::build()
 		{
 			GPUProcess* parentPTR = dependency.resource->getSourceProcess();
 			size_t parentIndex = mProcessNodeIndices.find(parentPTR)->second;
-			VkSemaphore semaphore = VK_NULL_HANDLE;
-			if (parentPTR->getOperationType() != GPUProcess::OP_TYPE_NOOP)
-				semaphore = mEngine->createSemaphore();
+			auto parentOperationType = parentPTR->getOperationType();
+			bool commandEdge = parentOperationType == GPUProcess::OP_TYPE_COMMAND
+				&& node.process->getOperationType() == GPUProcess::OP_TYPE_COMMAND;
+
+			// all command buffers are currently submitted to the graphics queue, so a dependency between
+			// two command processes on that queue only needs a pipeline barrier; the timeline semaphore
+			// is for command processes on different queues
+			bool barrier = commandEdge && parentPTR->getNeededQueueType() == node.process->getNeededQueueType();
+			bool timeline = commandEdge && !barrier && (mTimelineSemaphore != VK_NULL_HANDLE);
+			std::vector<VkSemaphore> semaphores;
+			if (parentOperationType != GPUProcess::OP_TYPE_NOOP && !timeline && !barrier)
+				for (uint32_t frame = 0; frame < mFramesInFlight; frame++)
+					semaphores.push_back(mEngine->createSemaphore());
+
+			// derive the tightest barrier scopes from the resource's state and the dependency;
+			// if the parent does not describe its use of the resource, wait for all of its commands
+			VkPipelineStageFlags srcStage = dependency.resource->getStage();
+			VkAccessFlags srcAccess = dependency.resource->getAccess();
+			if (srcStage == 0)
+			{
+				srcStage = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+				srcAccess = VK_ACCESS_MEMORY_WRITE_BIT;
+			}
+			VkAccessFlags dstAccess = 0;
+			if (srcAccess != 0)		// after reads, an execution dependency is enough
+				dstAccess = (dependency.access != 0) ? dependency.access : getAccessFlagsForStages(dependency.pipelineStage);
+
+			// layout transitions are performed by the processes themselves, so layouts must already agree
+			assert(dependency.layout == VK_IMAGE_LAYOUT_UNDEFINED || dependency.resource->getLayout() == dependency.layout);
+
 			// TODO: validate parent index
 			size_t edgeIndex = mEdges.size();
 			mEdges.push_back({
 				parentIndex,
 				i,
 				dependency.pipelineStage,
-				semaphore	// each edge owns one VkSemaphore
+				srcStage,
+				srcAccess,
+				dstAccess,
+				semaphores,	// each binary edge owns one VkSemaphore per frame in flight
+				timeline,
+				barrier
 				});
 			node.backEdgeIndices.push_back(edgeIndex);
 			mNodes[parentIndex].forwardEdgeIndices.push_back(edgeIndex);
@@ -76,23 +162,42 @@ void GPUDependencyGraph::build()
 	// as well as waitSemaphores and waitStages
 	for (auto& node : mNodes)
 	{
-		node.waitSemaphores.clear();
+		node.waitSemaphores.assign(mFramesInFlight, {});
 		node.waitStages.clear();
-		node.signalSemaphores.clear();
+		node.signalSemaphores.assign(mFramesInFlight, {});
 
 		for (auto& edgeIndex : node.forwardEdgeIndices)
 		{
 			auto& edge = mEdges[edgeIndex];
-			if (edge.signalSemaphore != VK_NULL_HANDLE)
-				node.signalSemaphores.push_back(edge.signalSemaphore);
+			for (uint32_t frame = 0; frame < edge.signalSemaphores.size(); frame++)
+				node.signalSemaphores[frame].push_back(edge.signalSemaphores[frame]);
 		}
 
+		node.timelineParentIndices.clear();
+		node.timelineWaitStage = 0;
+		node.barrierSrcStage = 0;
+		node.barrierDstStage = 0;
+		node.barrierSrcAccess = 0;
+		node.barrierDstAccess = 0;
 		for (auto& edgeIndex : node.backEdgeIndices)
 		{
 			auto& edge = mEdges[edgeIndex];
-			if (edge.signalSemaphore != VK_NULL_HANDLE)
+			if (edge.barrier)
 			{
-				node.waitSemaphores.push_back(edge.signalSemaphore);
+				node.barrierSrcStage |= edge.srcStage;
+				node.barrierDstStage |= edge.pipelineStage;
+				node.barrierSrcAccess |= edge.srcAccess;
+				node.barrierDstAccess |= edge.dstAccess;
+			}
+			else if (edge.timeline)
+			{
+				node.timelineParentIndices.push_back(edge.parentIndex);
+				node.timelineWaitStage |= edge.pipelineStage;
+			}
+			else if (!edge.signalSemaphores.empty())
+			{
+				for (uint32_t frame = 0; frame < mFramesInFlight; frame++)
+					node.waitSemaphores[frame].push_back(edge.signalSemaphores[frame]);
 				node.waitStages.push_back(edge.pipelineStage);
 			}
 		}
@@ -128,11 +233,32 @@ void GPUDependencyGraph::build()
 		mSubmitSequence[node.level].nodeIndices.push_back(i);
 	}
 
-	// finally, acquire longterm resources for each process
+	// record the barriers which replace semaphores between command processes,
+	// then group command buffers into submissions
+	recordBarriers();
+	planSubmits();
+
+	// decide which transient resources can share memory
+	planAliasing();
+
+	// finally, acquire longterm resources for each process; transient processes
+	// come first, so that their memory is bound before anything uses them
+	for (auto& node : mNodes)
+	{
+		if (node.process->isTransient())
+		{
+			node.process->acquireLongtermResources();
+			node.process->acquireFrameResources();
+		}
+	}
+	bindTransientMemory();
+
 	for (auto& group : mSubmitSequence)
 	{
 		for (auto i : group.nodeIndices)
 		{
+			if (mNodes[i].process->isTransient())
+				continue;
 			mNodes[i].process->acquireLongtermResources();
 			mNodes[i].process->acquireFrameResources();
 		}
@@ -158,109 +284,637 @@ void GPUDependencyGraph::invalidateFrameResources()
 			mNodes[j].process->cleanupFrameResources();
 		}
 	}
+
+	freeTransientMemory();
 }
 
 /**
  * @brief Acquires and/or validates all resources which depend on the VkSurface.
  * 
  * After acquireFrameResources() is called, this GPUDependencyGraph() can be executed again.
+ * 
+ * @return true All resources were acquired.
+ * @return false A transient resource could not be bound to memory.
  */
-void GPUDependencyGraph::acquireFrameResources()
+bool GPUDependencyGraph::acquireFrameResources()
 {
+	for (auto& node : mNodes)
+		if (node.process->isTransient())
+			node.process->acquireFrameResources();
+	bool bound = bindTransientMemory();
+
 	for (auto& group : mSubmitSequence)
 	{
 		for (auto j : group.nodeIndices)
 		{
-			mNodes[j].process->acquireFrameResources();
+			if (!mNodes[j].process->isTransient())
+				mNodes[j].process->acquireFrameResources();
 		}
 	}
+
+	return bound;
 }
 
-// TODO: batch multiple command buffers into one VkSubmitInfo where appropriate
-// (won't make a difference until more complex rendering is implemented)
 // TODO: support batching into non-graphics command queues
 /**
  * @brief Executes the sequence of processes in this GPUDependencyGraph.
+ * 
+ * Follows the plan made by planSubmits(). The command processes of each level are recorded
+ * together, in parallel, before any other operation in that level is performed; command
+ * buffers are only submitted when an operation depends on them, or at the end of the frame.
+ * If an operation fails, batches which have not been submitted yet are discarded.
+ * 
+ * Does not wait for the GPU to finish executing the frame. Before returning, moves on to
+ * the next frame in flight, waiting for the GPU to finish with that frame's resources if
+ * necessary, so that the caller is free to prepare data for the next frame.
  */
 void GPUDependencyGraph::executeSequence()
 {
-	std::vector<VkCommandBuffer> createdCommandBuffers;
+	Frame& frame = mFrames[mFrameIndex];
+	vkResetFences(mEngine->getDevice(), 1, &frame.fence);
 
-	for (auto& group : mSubmitSequence)
+	size_t nextBatch = 0;
+	bool fenceSubmitted = false;
+	bool aborted = false;
+
+	for (auto& step : mSubmitPlan)
 	{
-		// figure out number of submits
-		size_t numSubmits = 0;
-		for (size_t i : group.nodeIndices)
+		if (step.type == SubmitStep::STEP_RECORD_LEVEL)
 		{
-			auto& node = mNodes[i];
-			if (node.process->getOperationType() == GPUProcess::OP_TYPE_COMMAND)
-				numSubmits++;
+			recordLevel(step.index);
+			continue;
 		}
 
-		// perform tasks for each process
-		std::vector<VkSubmitInfo> submitInfos(numSubmits);
-		std::vector<VkCommandBuffer> commandBuffers(numSubmits);
-		size_t currentSubmit = 0;
+		auto& node = mNodes[step.index];
 
-		bool opFailed = false;
+		// submit any command buffers this operation depends on
+		if (step.flushBefore)
+		{
+			VkFence fence = step.signalFence ? frame.fence : VK_NULL_HANDLE;
+			aborted = !submitBatches(nextBatch, step.batchEnd, fence);
+			if (aborted)
+				break;	// abort dependency graph execution
+			fenceSubmitted = step.signalFence;
+		}
 
-		for (size_t i : group.nodeIndices)
+		VkSemaphore signalSemaphore = VK_NULL_HANDLE;
+		if (node.signalSemaphores[mFrameIndex].size() > 0)
+			signalSemaphore = node.signalSemaphores[mFrameIndex][0];
+
+		aborted = !node.process->performOperation(node.waitSemaphores[mFrameIndex], VK_NULL_HANDLE, signalSemaphore);
+		if (aborted)
+			break;	// abort dependency graph execution
+	}
+
+	// signal the frame's fence once everything submitted so far has completed;
+	// this is done even if execution was aborted, so that the fence can always be waited on
+	if (!fenceSubmitted)
+	{
+		size_t batchEnd = aborted ? nextBatch : mSubmitBatches.size();
+		submitBatches(nextBatch, batchEnd, frame.fence);
+	}
+	frame.frameNumber = mFrameNumber++;
+
+	// move on to the next frame
+	mFrameIndex = (mFrameIndex + 1) % mFramesInFlight;
+	beginFrame();
+}
+
+/**
+ * @brief Records the command buffers of every command process in a level.
+ * 
+ * Processes are split across the recording threads' command pools by their position in the
+ * level, so each pool is only used by one thread at a time, and a process always records into
+ * the same pool. Processes in the same level never depend on each other, so they may record at
+ * the same time.
+ * 
+ * @param level Index of the level in mSubmitSequence.
+ */
+void GPUDependencyGraph::recordLevel(size_t level)
+{
+	auto& commandNodeIndices = mSubmitSequence[level].commandNodeIndices;
+	auto& commandPools = mFrames[mFrameIndex].commandPools;
+	uint32_t jobCount = std::min<size_t>(commandNodeIndices.size(), commandPools.size());
+
+	auto job = [&](uint32_t jobIndex) {
+		VkCommandPool commandPool = commandPools[jobIndex].pool;
+		for (size_t i = jobIndex; i < commandNodeIndices.size(); i += jobCount)
 		{
-			if(opFailed)
-				break;
+			auto& node = mNodes[commandNodeIndices[i]];
+			node.commandBuffer = node.process->performOperation(commandPool);
+		}
+	};
+
+	if (jobCount > 1)
+		mEngine->getWorkerPool()->run(jobCount, job);
+	else if (jobCount > 0)
+		job(0);
+}
+
+/**
+ * @brief Sets the maximum number of frames which may be in flight at once.
+ * 
+ * Must be called before build(), since every per-frame resource is sized when the graph is
+ * built; the value is clamped to the range [1, maxFramesInFlight].
+ * 
+ * @param framesInFlight The maximum number of frames the GPU may be executing, or the CPU
+ * may be preparing, at once.
+ * @return true The number of frames in flight was changed.
+ * @return false The graph has already been built, so the number is left unchanged.
+ */
+bool GPUDependencyGraph::setFramesInFlight(uint32_t framesInFlight)
+{
+	if (!mFrames.empty())
+		return false;
+
+	if (framesInFlight < 1)
+		framesInFlight = 1;
+	if (framesInFlight > maxFramesInFlight)
+		framesInFlight = maxFramesInFlight;
 
+	mFramesInFlight = framesInFlight;
+	return true;
+}
+
+/**
+ * @brief Blocks until the GPU has finished every frame in flight.
+ */
+void GPUDependencyGraph::waitIdle()
+{
+	VkDevice device = mEngine->getDevice();
+
+	for (auto& frame : mFrames)
+		vkWaitForFences(device, 1, &frame.fence, VK_TRUE, UINT64_MAX);
+
+	// presentation is not covered by the frame fences
+	vkQueueWaitIdle(mEngine->getPresentQueue());
+}
+
+/**
+ * @brief Returns a value that can be passed to waitForValue() to wait for a process's most recent operation.
+ * 
+ * Only processes which record command buffers are tracked. If the timeline semaphore is in use,
+ * the value is the one the process signaled on it; otherwise, it identifies the frame in which the
+ * process was last executed.
+ * 
+ * @param process A process which has been added to this GPUDependencyGraph.
+ * @return uint64_t The value; 0 if the process has not been executed yet, or is not tracked.
+ */
+uint64_t GPUDependencyGraph::getProcessSignalValue(GPUProcess* process)
+{
+	auto entry = mProcessNodeIndices.find(process);
+	if (entry == mProcessNodeIndices.end())
+		return 0;
+
+	return mNodes[entry->second].lastSignalValue;
+}
+
+/**
+ * @brief Blocks until the GPU has reached a value returned by getProcessSignalValue().
+ * 
+ * @param value The value to wait for.
+ * @param timeout Timeout, in nanoseconds.
+ * @return true The value has been reached.
+ * @return false The timeout expired, or value does not correspond to any submitted work.
+ */
+bool GPUDependencyGraph::waitForValue(uint64_t value, uint64_t timeout)
+{
+	if (value == 0)
+		return false;
+
+	if (mTimelineSemaphore != VK_NULL_HANDLE)
+	{
+		if (value > mTimelineValue)
+			return false;
+
+		return mEngine->waitTimelineSemaphore(mTimelineSemaphore, value, timeout);
+	}
+
+	if (value >= mFrameNumber)
+		return false;
+
+	// if the frame's resources have since been reused, the frame has already completed
+	for (auto& candidate : mFrames)
+		if (candidate.frameNumber == value)
+			return (vkWaitForFences(mEngine->getDevice(), 1, &candidate.fence, VK_TRUE, timeout) == VK_SUCCESS);
+
+	return true;
+}
+
+/**
+ * @brief Plans how the command buffers of each frame are grouped into submissions.
+ * 
+ * Command processes are visited in level order. Each one joins the most recent submit batch
+ * unless it must wait on a semaphore signaled by a process already in that batch, since a
+ * VkSubmitInfo performs all of its waits before any of its command buffers. Dependencies
+ * between command processes on the same queue use barriers, so they never split a batch.
+ * A batch waits on the union of its processes' semaphores and signals the union of their
+ * semaphores.
+ * 
+ * Each level with command processes starts with a step which records all of them, so no process
+ * is recorded before the other operations of earlier levels have been performed, and batches
+ * may span those operations. Batches are not submitted as they are recorded. Pending batches
+ * are submitted together, in a single vkQueueSubmit() call, right before an operation that
+ * depends on one of them (such as presentation) and at the end of the frame. The frame's fence
+ * is attached to the last submission.
+ */
+void GPUDependencyGraph::planSubmits()
+{
+	mSubmitBatches.clear();
+	mSubmitPlan.clear();
+
+	const size_t noBatch = SIZE_MAX;
+	std::vector<size_t> nodeBatches(mNodes.size(), noBatch);
+	size_t openBatch = noBatch;
+	size_t firstPendingBatch = 0;
+
+	for (size_t level = 0; level < mSubmitSequence.size(); level++)
+	{
+		auto& group = mSubmitSequence[level];
+		group.commandNodeIndices.clear();
+		for (size_t i : group.nodeIndices)
+			if (mNodes[i].process->getOperationType() == GPUProcess::OP_TYPE_COMMAND)
+				group.commandNodeIndices.push_back(i);
+
+		if (!group.commandNodeIndices.empty())
+			mSubmitPlan.push_back({ SubmitStep::STEP_RECORD_LEVEL, level });
+
+		for (size_t i : group.nodeIndices)
+		{
 			auto& node = mNodes[i];
-			switch(node.process->getOperationType())
+			switch (node.process->getOperationType())
 			{
 			case GPUProcess::OP_TYPE_COMMAND:
 				{
-					commandBuffers[currentSubmit] = node.process->performOperation(mEngine->getGraphicsPool());
-					createdCommandBuffers.push_back(commandBuffers[currentSubmit]);
-
-					auto& submitInfo = submitInfos[currentSubmit];
-					submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-					submitInfo.pNext = nullptr;
-					submitInfo.waitSemaphoreCount = node.waitSemaphores.size();
-					submitInfo.pWaitSemaphores = node.waitSemaphores.data();
-					submitInfo.pWaitDstStageMask = node.waitStages.data();
-					submitInfo.commandBufferCount = 1;
-					submitInfo.pCommandBuffers = &commandBuffers[currentSubmit];
-					submitInfo.signalSemaphoreCount = node.signalSemaphores.size();
-					submitInfo.pSignalSemaphores = node.signalSemaphores.data();
-
-					currentSubmit++;
+					bool canJoin = (openBatch != noBatch);
+					for (size_t edgeIndex : node.backEdgeIndices)
+					{
+						auto& edge = mEdges[edgeIndex];
+						bool hasSemaphore = edge.timeline || !edge.signalSemaphores.empty();
+						if (hasSemaphore && nodeBatches[edge.parentIndex] == openBatch)
+							canJoin = false;
+					}
+
+					if (!canJoin)
+					{
+						openBatch = mSubmitBatches.size();
+						mSubmitBatches.emplace_back();
+					}
+
+					mSubmitBatches[openBatch].nodeIndices.push_back(i);
+					nodeBatches[i] = openBatch;
 					break;
 				}
 			case GPUProcess::OP_TYPE_OTHER:
 				{
-					VkSemaphore signalSemaphore = VK_NULL_HANDLE;
-					if (node.signalSemaphores.size() > 0)
-						signalSemaphore = node.signalSemaphores[0];
+					SubmitStep step = { SubmitStep::STEP_OTHER, i };
+					for (size_t edgeIndex : node.backEdgeIndices)
+					{
+						size_t parentBatch = nodeBatches[mEdges[edgeIndex].parentIndex];
+						if (parentBatch != noBatch && parentBatch >= firstPendingBatch)
+							step.flushBefore = true;
+					}
 
-					if(!node.process->performOperation(node.waitSemaphores, VK_NULL_HANDLE, signalSemaphore))
-						opFailed = true;	// abort dependency graph execution
+					if (step.flushBefore)
+					{
+						firstPendingBatch = mSubmitBatches.size();
+						step.batchEnd = firstPendingBatch;
+						openBatch = noBatch;
+					}
+					mSubmitPlan.push_back(step);
 					break;
 				}
+			default:
+				break;
 			}
 		}
+	}
 
-		if(opFailed)
+	// if no batches follow the last flush, the frame's fence can be attached to it
+	for (size_t i = mSubmitPlan.size(); i > 0;)
+	{
+		i--;
+		auto& step = mSubmitPlan[i];
+		if (step.flushBefore)
+		{
+			step.signalFence = (step.batchEnd == mSubmitBatches.size());
 			break;
+		}
+	}
 
-		// submit command buffers
-		VkResult result = vkQueueSubmit(mEngine->getGraphicsQueue(), submitInfos.size(), submitInfos.data(), VK_NULL_HANDLE);
-		if(result != VK_SUCCESS)
-			break;	// abort dependency graph execution
+	// merge the synchronization of each batch's processes
+	for (auto& batch : mSubmitBatches)
+	{
+		batch.commandBuffers.reserve(batch.nodeIndices.size() * 2);
+		batch.waitSemaphores.assign(mFramesInFlight, {});
+		batch.signalSemaphores.assign(mFramesInFlight, {});
+		VkPipelineStageFlags timelineWaitStage = 0;
+
+		for (size_t i : batch.nodeIndices)
+		{
+			auto& node = mNodes[i];
+			for (uint32_t frame = 0; frame < mFramesInFlight; frame++)
+			{
+				batch.waitSemaphores[frame].insert(batch.waitSemaphores[frame].end(),
+					node.waitSemaphores[frame].begin(), node.waitSemaphores[frame].end());
+				batch.signalSemaphores[frame].insert(batch.signalSemaphores[frame].end(),
+					node.signalSemaphores[frame].begin(), node.signalSemaphores[frame].end());
+			}
+			batch.waitStages.insert(batch.waitStages.end(), node.waitStages.begin(), node.waitStages.end());
+			batch.timelineParentIndices.insert(batch.timelineParentIndices.end(),
+				node.timelineParentIndices.begin(), node.timelineParentIndices.end());
+			timelineWaitStage |= node.timelineWaitStage;
+		}
+
+		if (mTimelineSemaphore != VK_NULL_HANDLE)
+		{
+			// a single wait on the latest value signaled by any parent covers all of
+			// them, since a timeline signal completes only after all prior work on the queue
+			if (!batch.timelineParentIndices.empty())
+			{
+				for (uint32_t frame = 0; frame < mFramesInFlight; frame++)
+					batch.waitSemaphores[frame].push_back(mTimelineSemaphore);
+				batch.waitStages.push_back(timelineWaitStage);
+			}
+
+			// every batch signals the timeline, so that its processes can be waited on from the CPU
+			for (uint32_t frame = 0; frame < mFramesInFlight; frame++)
+				batch.signalSemaphores[frame].push_back(mTimelineSemaphore);
+		}
+
+		// values for binary semaphores are ignored
+		batch.waitValues.assign(batch.waitStages.size(), 0);
+		batch.signalValues.assign(batch.signalSemaphores[0].size(), 0);
 	}
 
-	// TODO: implement better syncronization
-	vkQueueWaitIdle(mEngine->getGraphicsQueue());
-	vkQueueWaitIdle(mEngine->getPresentQueue());
+	// submit infos are reused across frames
+	mSubmitInfos.resize(mSubmitBatches.size());
+	mTimelineSubmitInfos.resize(mSubmitBatches.size());
+}
 
-	// TODO: implement better collection of command buffers to avoid unnecessary vector reallocation
-	vkFreeCommandBuffers(mEngine->getDevice(), mEngine->getGraphicsPool(), createdCommandBuffers.size(), createdCommandBuffers.data());
+/**
+ * @brief Submits a range of recorded batches to the graphics queue in a single call.
+ * 
+ * Fills in the submit info of each batch, including the values of the timeline semaphore,
+ * which are assigned in submission order. An empty submission is made if a fence is given
+ * but the range is empty.
+ * 
+ * @param nextBatch Index of the first batch to submit; set to batchEnd.
+ * @param batchEnd Index one past the last batch to submit.
+ * @param fence Fence to signal once the submitted work has completed; may be VK_NULL_HANDLE.
+ * @return true The submission succeeded.
+ * @return false The submission failed.
+ */
+bool GPUDependencyGraph::submitBatches(size_t& nextBatch, size_t batchEnd, VkFence fence)
+{
+	uint32_t submitCount = 0;
+	for (; nextBatch < batchEnd; nextBatch++)
+	{
+		auto& batch = mSubmitBatches[nextBatch];
+		batch.commandBuffers.clear();
+		for (size_t i : batch.nodeIndices)
+		{
+			// dependencies on command processes are satisfied by a barrier recorded ahead of time
+			if (mNodes[i].barrierCommandBuffer != VK_NULL_HANDLE)
+				batch.commandBuffers.push_back(mNodes[i].barrierCommandBuffer);
+
+			// a process with nothing to do this frame returns no command buffer
+			if (mNodes[i].commandBuffer != VK_NULL_HANDLE)
+				batch.commandBuffers.push_back(mNodes[i].commandBuffer);
+		}
+
+		auto& waitSemaphores = batch.waitSemaphores[mFrameIndex];
+		auto& signalSemaphores = batch.signalSemaphores[mFrameIndex];
+
+		auto& submitInfo = mSubmitInfos[submitCount];
+		submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+		submitInfo.pNext = nullptr;
+		submitInfo.waitSemaphoreCount = waitSemaphores.size();
+		submitInfo.pWaitSemaphores = waitSemaphores.data();
+		submitInfo.pWaitDstStageMask = batch.waitStages.data();
+		submitInfo.commandBufferCount = batch.commandBuffers.size();
+		submitInfo.pCommandBuffers = batch.commandBuffers.data();
+		submitInfo.signalSemaphoreCount = signalSemaphores.size();
+		submitInfo.pSignalSemaphores = signalSemaphores.data();
+
+		uint64_t signalValue = mFrameNumber;
+		if (mTimelineSemaphore != VK_NULL_HANDLE)
+		{
+			// wait for the latest value signaled by a parent, and signal a new value
+			if (!batch.timelineParentIndices.empty())
+			{
+				uint64_t waitValue = 0;
+				for (size_t parentIndex : batch.timelineParentIndices)
+					waitValue = std::max(waitValue, mNodes[parentIndex].lastSignalValue);
+				batch.waitValues.back() = waitValue;
+			}
+			signalValue = ++mTimelineValue;
+			batch.signalValues.back() = signalValue;
+
+			auto& timelineSubmitInfo = mTimelineSubmitInfos[submitCount];
+			timelineSubmitInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+			timelineSubmitInfo.pNext = nullptr;
+			timelineSubmitInfo.waitSemaphoreValueCount = batch.waitValues.size();
+			timelineSubmitInfo.pWaitSemaphoreValues = batch.waitValues.data();
+			timelineSubmitInfo.signalSemaphoreValueCount = batch.signalValues.size();
+			timelineSubmitInfo.pSignalSemaphoreValues = batch.signalValues.data();
+			submitInfo.pNext = &timelineSubmitInfo;
+		}
+
+		// without a timeline, the frame's fence is the finest thing the CPU can wait on
+		for (size_t i : batch.nodeIndices)
+			mNodes[i].lastSignalValue = signalValue;
+
+		submitCount++;
+	}
+
+	if (submitCount == 0 && fence == VK_NULL_HANDLE)
+		return true;
+
+	return vkQueueSubmit(mEngine->getGraphicsQueue(), submitCount, mSubmitInfos.data(), fence) == VK_SUCCESS;
+}
+
+/**
+ * @brief Records a pipeline barrier for each command process which depends on another command process on the same queue.
+ * 
+ * Since every command process which the barrier must wait on is submitted earlier to the same
+ * queue, a barrier command buffer submitted right before the dependent process's command buffer
+ * is enough to make the resources it uses available. The source scope comes from the state of
+ * each passed resource, and the destination scope from the process's PRDependencies; all of a
+ * process's dependencies on command processes are merged into a single memory barrier.
+ * 
+ * Barriers do not depend on the frame, so each one is recorded once, for simultaneous use.
+ */
+void GPUDependencyGraph::recordBarriers()
+{
+	VkDevice device = mEngine->getDevice();
+
+	if (mBarrierCommandPool == VK_NULL_HANDLE)
+	{
+		VkCommandPoolCreateInfo poolCreateInfo = {};
+		poolCreateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+		poolCreateInfo.pNext = nullptr;
+		poolCreateInfo.flags = 0;
+		poolCreateInfo.queueFamilyIndex = mEngine->getGraphicsQueueFamily();
+		vkCreateCommandPool(device, &poolCreateInfo, nullptr, &mBarrierCommandPool);
+	}
+
+	for (auto& node : mNodes)
+	{
+		if (node.barrierDstStage == 0)
+			continue;
+
+		VkCommandBufferAllocateInfo allocateInfo = {};
+		allocateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+		allocateInfo.pNext = nullptr;
+		allocateInfo.commandPool = mBarrierCommandPool;
+		allocateInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+		allocateInfo.commandBufferCount = 1;
+		vkAllocateCommandBuffers(device, &allocateInfo, &node.barrierCommandBuffer);
+
+		VkCommandBufferBeginInfo beginInfo = {};
+		beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+		beginInfo.pNext = nullptr;
+		beginInfo.flags = VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT;
+		beginInfo.pInheritanceInfo = nullptr;
+		vkBeginCommandBuffer(node.barrierCommandBuffer, &beginInfo);
+
+		VkMemoryBarrier memoryBarrier = {};
+		memoryBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+		memoryBarrier.pNext = nullptr;
+		memoryBarrier.srcAccessMask = node.barrierSrcAccess;
+		memoryBarrier.dstAccessMask = node.barrierDstAccess;
+
+		// if no parent wrote anything, only an execution dependency is needed
+		uint32_t memoryBarrierCount = (node.barrierSrcAccess != 0) ? 1 : 0;
+		vkCmdPipelineBarrier(node.barrierCommandBuffer, node.barrierSrcStage, node.barrierDstStage,
+			0, memoryBarrierCount, &memoryBarrier, 0, nullptr, 0, nullptr);
+
+		vkEndCommandBuffer(node.barrierCommandBuffer);
+	}
+}
+
+/**
+ * @brief Groups transient processes whose resources are never in use at the same time.
+ * 
+ * A transient resource is in use from the level of its first user to the level of its last
+ * user. Processes are sorted by the level of their first user, and each one joins the first
+ * group whose members are all out of use by then; this greedy interval partitioning needs
+ * the fewest groups possible. A transient process without users gets a group of its own.
+ */
+void GPUDependencyGraph::planAliasing()
+{
+	freeTransientMemory();
+	mAliasGroups.clear();
+
+	struct Lifetime
+	{
+		size_t nodeIndex;
+		uint32_t firstLevel;
+		uint32_t lastLevel;
+	};
+
+	std::vector<Lifetime> lifetimes;
+	for (size_t i = 0; i < mNodes.size(); i++)
+	{
+		auto& node = mNodes[i];
+		if (!node.process->isTransient())
+			continue;
+
+		Lifetime lifetime = { i, UINT32_MAX, 0 };
+		for (size_t edgeIndex : node.forwardEdgeIndices)
+		{
+			uint32_t level = mNodes[mEdges[edgeIndex].childIndex].level;
+			lifetime.firstLevel = std::min(lifetime.firstLevel, level);
+			lifetime.lastLevel = std::max(lifetime.lastLevel, level);
+		}
+
+		if (node.forwardEdgeIndices.empty())
+			mAliasGroups.push_back({ {i} });
+		else
+			lifetimes.push_back(lifetime);
+	}
+
+	std::sort(lifetimes.begin(), lifetimes.end(), [](const Lifetime& a, const Lifetime& b) {
+		return a.firstLevel < b.firstLevel;
+	});
+
+	size_t firstSharedGroup = mAliasGroups.size();
+	for (auto& lifetime : lifetimes)
+	{
+		AliasGroup* group = nullptr;
+		for (size_t i = firstSharedGroup; i < mAliasGroups.size() && group == nullptr; i++)
+			if (mAliasGroups[i].lastLevel < lifetime.firstLevel)
+				group = &mAliasGroups[i];
+
+		if (group == nullptr)
+		{
+			mAliasGroups.emplace_back();
+			group = &mAliasGroups.back();
+		}
+
+		group->nodeIndices.push_back(lifetime.nodeIndex);
+		group->lastLevel = lifetime.lastLevel;
+	}
+}
+
+/**
+ * @brief Allocates memory for each group of transient processes, and binds it to their resources.
+ * 
+ * Each group gets a single allocation which is large enough, and aligned enough, for any of its
+ * members. If the members have no memory type in common, or the allocation fails, each member
+ * allocates its own memory instead; so does a member which cannot be bound to the shared memory.
+ * 
+ * @return true Every transient resource was bound to memory.
+ * @return false A transient resource could not be bound to any memory.
+ */
+bool GPUDependencyGraph::bindTransientMemory()
+{
+	bool bound = true;
+	for (auto& group : mAliasGroups)
+	{
+		VkMemoryRequirements groupRequirements = { 0, 1, UINT32_MAX };
+		size_t count = 0;
+		for (size_t i : group.nodeIndices)
+		{
+			VkMemoryRequirements requirements;
+			if (!mNodes[i].process->getTransientMemoryRequirements(requirements))
+				continue;
+
+			groupRequirements.size = std::max(groupRequirements.size, requirements.size);
+			groupRequirements.alignment = std::max(groupRequirements.alignment, requirements.alignment);
+			groupRequirements.memoryTypeBits &= requirements.memoryTypeBits;
+			count++;
+		}
+
+		bool shared = (count > 1) && (groupRequirements.memoryTypeBits != 0)
+			&& mEngine->getMemoryAllocator()->allocate(groupRequirements, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, false, group.memory);
 
-	vkResetCommandPool(mEngine->getDevice(), mEngine->getGraphicsPool(), 0);
+		for (size_t i : group.nodeIndices)
+		{
+			auto process = mNodes[i].process;
+			if (shared && process->bindTransientMemory(group.memory.memory, group.memory.offset))
+				continue;
+			if (!process->bindTransientMemory(VK_NULL_HANDLE, 0))
+				bound = false;
+		}
+	}
+
+	return bound;
+}
+
+/**
+ * @brief Frees the memory shared by each group of transient processes.
+ * 
+ * The processes' resources must have been freed already.
+ */
+void GPUDependencyGraph::freeTransientMemory()
+{
+	for (auto& group : mAliasGroups)
+	{
+		mEngine->getMemoryAllocator()->free(group.memory);
+		group.memory = {};
+	}
 }
 
 /**
@@ -269,6 +923,120 @@ void GPUDependencyGraph::executeSequence()
 void GPUDependencyGraph::cleanupEdges()
 {
 	for (auto& edge : mEdges)
-		vkDestroySemaphore(mEngine->getDevice(), edge.signalSemaphore, nullptr);
+		for (auto semaphore : edge.signalSemaphores)
+			vkDestroySemaphore(mEngine->getDevice(), semaphore, nullptr);
 	mEdges.clear();
+
+	// barriers replace edges between command processes
+	for (auto& node : mNodes)
+	{
+		if (node.barrierCommandBuffer != VK_NULL_HANDLE)
+			vkFreeCommandBuffers(mEngine->getDevice(), mBarrierCommandPool, 1, &node.barrierCommandBuffer);
+		node.barrierCommandBuffer = VK_NULL_HANDLE;
+	}
+}
+
+/**
+ * @brief Hands out the next recycled command buffer from one of the current frame's command pools.
+ * 
+ * Called by GPUEngine::allocateCommandBuffer(), so that processes recording into a pool given to
+ * them by this GPUDependencyGraph get the same command buffer every time the frame comes around,
+ * as long as they record in the same order. A new command buffer is only allocated the first time.
+ * 
+ * @param commandPool The command pool passed to GPUProcess::performOperation().
+ * @param commandBuffer Reference to which the command buffer is written.
+ * @return true commandPool belongs to the current frame, and commandBuffer was written.
+ * @return false commandPool does not belong to this GPUDependencyGraph.
+ */
+bool GPUDependencyGraph::recycleCommandBuffer(VkCommandPool commandPool, VkCommandBuffer& commandBuffer)
+{
+	if (mFrames.empty())
+		return false;
+
+	for (auto& pool : mFrames[mFrameIndex].commandPools)
+	{
+		if (pool.pool != commandPool)
+			continue;
+
+		if (pool.nextCommandBuffer == pool.commandBuffers.size())
+		{
+			VkCommandBufferAllocateInfo allocateInfo = {};
+			allocateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+			allocateInfo.pNext = nullptr;
+			allocateInfo.commandPool = pool.pool;
+			allocateInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+			allocateInfo.commandBufferCount = 1;
+
+			VkCommandBuffer newCommandBuffer = VK_NULL_HANDLE;
+			vkAllocateCommandBuffers(mEngine->getDevice(), &allocateInfo, &newCommandBuffer);
+			pool.commandBuffers.push_back(newCommandBuffer);
+		}
+
+		commandBuffer = pool.commandBuffers[pool.nextCommandBuffer++];
+		return true;
+	}
+
+	return false;
+}
+
+/**
+ * @brief Creates the command pools and fence for each frame in flight.
+ * 
+ * Fences are created signaled, so that the first use of each frame does not wait.
+ */
+void GPUDependencyGraph::createFrames()
+{
+	// command buffers are reset along with their pool and reused, so the pool is not transient
+	VkCommandPoolCreateInfo createInfo = {};
+	createInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+	createInfo.pNext = nullptr;
+	createInfo.flags = 0;
+	createInfo.queueFamilyIndex = mEngine->getGraphicsQueueFamily();
+
+	mFrames.resize(mFramesInFlight);
+	for (auto& frame : mFrames)
+	{
+		frame.commandPools.resize(mRecordingThreadCount);
+		for (auto& pool : frame.commandPools)
+			vkCreateCommandPool(mEngine->getDevice(), &createInfo, nullptr, &pool.pool);
+		frame.fence = mEngine->createFence(VK_FENCE_CREATE_SIGNALED_BIT);
+	}
+
+	mFrameIndex = 0;
+}
+
+/**
+ * @brief Frees the command pools and fence of each frame in flight.
+ * 
+ * The frames must not be in use by the GPU.
+ */
+void GPUDependencyGraph::cleanupFrames()
+{
+	VkDevice device = mEngine->getDevice();
+
+	for (auto& frame : mFrames)
+	{
+		for (auto& pool : frame.commandPools)
+			vkDestroyCommandPool(device, pool.pool, nullptr);
+		vkDestroyFence(device, frame.fence, nullptr);
+	}
+	mFrames.clear();
+}
+
+/**
+ * @brief Waits until the GPU has finished with the current frame's resources, then recycles them.
+ */
+void GPUDependencyGraph::beginFrame()
+{
+	Frame& frame = mFrames[mFrameIndex];
+	VkDevice device = mEngine->getDevice();
+
+	vkWaitForFences(device, 1, &frame.fence, VK_TRUE, UINT64_MAX);
+
+	// resetting a pool returns all of its command buffers to the initial state, ready to be handed out again
+	for (auto& pool : frame.commandPools)
+	{
+		vkResetCommandPool(device, pool.pool, 0);
+		pool.nextCommandBuffer = 0;
+	}
 }
\ No newline at end of file
@@ -1,10 +1,12 @@
 #ifndef GPUDEPENDENCYGRAPH_H
 #define GPUDEPENDENCYGRAPH_H
 
+#include <memory>
 #include <vector>
 #include <unordered_map>
 #include <vulkan/vulkan.h>
 
+#include "GPUMemoryAllocator.h"
 #include "GPUProcess.h"
 
 class GPUEngine;
@@ -15,11 +17,42 @@ class GPUEngine;
  * Owns all GPUProcess instances which it manages, and is responsible for
  * signaling them to acquire and free resources when appropriate.
  * 
+ * Up to a configurable number of frames may be in flight at once. Each frame in flight has
+ * its own command pools, its own semaphore for every edge, and a fence which is signaled once
+ * the GPU has finished the frame; the CPU only waits on that fence when it is about to reuse
+ * the frame's resources, so it can record one frame while the GPU executes another. Command
+ * buffers are never freed between frames; each frame's pools are reset and the same command
+ * buffers are handed out again, so a process gets back the same handle every time the frame
+ * comes around.
+ * 
+ * The command processes of a level do not depend on each other, so they are recorded in
+ * parallel by the engine's worker pool, each thread using its own command pool. Their command
+ * buffers are still submitted in the order in which the processes appear in the level, so
+ * GPUProcess::performOperation() must be safe to call for several processes at once, but
+ * the submissions stay the same no matter how the recording is scheduled.
+ * 
+ * Dependencies between processes which both record command buffers for the same queue are
+ * expressed through pipeline barriers, and such processes share a submission. If the device
+ * supports timeline semaphores, each submission signals a new, increasing value of a single
+ * timeline semaphore, so that processes can be waited on from the CPU; dependencies between
+ * command processes on different queues would also use it. Edges to or from other processes,
+ * such as swapchain image acquisition and presentation, use binary semaphores.
+ * 
+ * Transient processes (see GPUProcess::isTransient()) whose users never execute in the same
+ * level are placed in the same memory, which the GPUDependencyGraph owns. Transient processes
+ * acquire their resources before all other processes, so they must not depend on any other
+ * process. Since aliased resources are only in use between their first and last user within a
+ * frame, users must not rely on their previous contents and must order their first write after
+ * prior work on the queue, as GPUProcessRenderPass does through its external subpass dependency.
+ * 
  * Intended to be used and owned directly by a GPUEngine instance.
  */
 class GPUDependencyGraph
 {
 public:
+	static constexpr uint32_t defaultFramesInFlight = 2;
+	static constexpr uint32_t maxFramesInFlight = 3;
+
 	// constructors and destructor
 	GPUDependencyGraph(GPUEngine* engine);
 	GPUDependencyGraph(GPUDependencyGraph& other) = delete;
@@ -31,8 +64,18 @@ public:
 	void addProcess(GPUProcess* process);
 	void build();
 	void invalidateFrameResources();
-	void acquireFrameResources();
+	bool acquireFrameResources();
 	void executeSequence();
+	bool setFramesInFlight(uint32_t framesInFlight);
+	void waitIdle();
+	uint64_t getProcessSignalValue(GPUProcess* process);
+	bool waitForValue(uint64_t value, uint64_t timeout = UINT64_MAX);
+	bool recycleCommandBuffer(VkCommandPool commandPool, VkCommandBuffer& commandBuffer);
+
+	// public getters
+	bool usesTimelineSemaphore() { return mTimelineSemaphore != VK_NULL_HANDLE; }
+	uint32_t getFramesInFlight() { return mFramesInFlight; }
+	uint32_t getFrameIndex() { return mFrameIndex; }
 
 private:
 	// structs scoped to GPUDependencyGraph
@@ -43,7 +86,12 @@ private:
 		size_t parentIndex;
 		size_t childIndex;
 		VkPipelineStageFlags pipelineStage;
-		VkSemaphore signalSemaphore = VK_NULL_HANDLE;
+		VkPipelineStageFlags srcStage;				// stages in which the parent last uses the resource
+		VkAccessFlags srcAccess;					// writes made by the parent
+		VkAccessFlags dstAccess;					// accesses made by the child
+		std::vector<VkSemaphore> signalSemaphores;	// one per frame in flight; empty if the parent has no operation
+		bool timeline = false;						// true if the edge is expressed through the timeline semaphore
+		bool barrier = false;						// true if the edge is expressed through a pipeline barrier
 	};
 
 	struct Node
@@ -52,18 +100,96 @@ private:
 		uint32_t level;
 		std::vector<size_t> backEdgeIndices;
 		std::vector<size_t> forwardEdgeIndices;
-		std::vector<VkSemaphore> waitSemaphores;
+		std::vector<std::vector<VkSemaphore>> waitSemaphores;	// indexed by frame in flight
 		std::vector<VkPipelineStageFlags> waitStages;
-		std::vector<VkSemaphore> signalSemaphores;
+		std::vector<std::vector<VkSemaphore>> signalSemaphores;	// indexed by frame in flight
+
+		std::vector<size_t> timelineParentIndices;
+		VkPipelineStageFlags timelineWaitStage = 0;
+		uint64_t lastSignalValue = 0;
+
+		VkPipelineStageFlags barrierSrcStage = 0;
+		VkPipelineStageFlags barrierDstStage = 0;
+		VkAccessFlags barrierSrcAccess = 0;
+		VkAccessFlags barrierDstAccess = 0;
+		VkCommandBuffer barrierCommandBuffer = VK_NULL_HANDLE;	// submitted before this node's command buffer
+		VkCommandBuffer commandBuffer = VK_NULL_HANDLE;			// recorded for the current frame
 	};
 
 	struct SubmitGroup
 	{
 		std::vector<size_t> nodeIndices;
+		std::vector<size_t> commandNodeIndices;
+	};
+
+	// a group of command processes whose command buffers share a single VkSubmitInfo
+	struct SubmitBatch
+	{
+		std::vector<size_t> nodeIndices;
+		std::vector<VkCommandBuffer> commandBuffers;
+		std::vector<std::vector<VkSemaphore>> waitSemaphores;	// indexed by frame in flight
+		std::vector<VkPipelineStageFlags> waitStages;
+		std::vector<std::vector<VkSemaphore>> signalSemaphores;	// indexed by frame in flight
+
+		// timeline semaphore state; the timeline semaphore, if waited on
+		// or signaled, is always last in the corresponding vectors
+		std::vector<size_t> timelineParentIndices;
+		std::vector<uint64_t> waitValues;
+		std::vector<uint64_t> signalValues;
+	};
+
+	// one step of the per-frame submit plan; either records the command processes of a level, or
+	// performs a non-command operation after optionally submitting pending batches
+	struct SubmitStep
+	{
+		enum Type
+		{
+			STEP_RECORD_LEVEL,
+			STEP_OTHER
+		};
+
+		Type type;
+		size_t index;				// index of the level, or of the node
+		bool flushBefore = false;	// submit pending batches before performing the operation
+		size_t batchEnd = 0;		// index one past the last batch to submit
+		bool signalFence = false;	// attach the frame's fence to that submission
+	};
+
+	// a set of transient processes whose resources share a single memory allocation
+	struct AliasGroup
+	{
+		std::vector<size_t> nodeIndices;
+		uint32_t lastLevel = 0;						// last level in which any member is in use
+		GPUMemoryAllocator::Allocation memory;
+	};
+
+	// a command pool whose command buffers are handed out again, in the same order, every frame
+	struct CommandPool
+	{
+		VkCommandPool pool = VK_NULL_HANDLE;
+		std::vector<VkCommandBuffer> commandBuffers;
+		size_t nextCommandBuffer = 0;
+	};
+
+	struct Frame
+	{
+		std::vector<CommandPool> commandPools;	// one per recording thread
+		VkFence fence = VK_NULL_HANDLE;	// signaled once the GPU has finished this frame
+		uint64_t frameNumber = 0;		// number of the frame most recently submitted with these resources
 	};
 
 	// private member functions
 	void cleanupEdges();
+	void recordBarriers();
+	void planAliasing();
+	bool bindTransientMemory();
+	void freeTransientMemory();
+	void planSubmits();
+	void recordLevel(size_t level);
+	bool submitBatches(size_t& nextBatch, size_t batchEnd, VkFence fence);
+	void createFrames();
+	void cleanupFrames();
+	void beginFrame();
 
 	// private member variables
 	GPUEngine* mEngine;
@@ -71,6 +197,19 @@ private:
 	std::unordered_map<GPUProcess*, size_t> mProcessNodeIndices;
 	std::vector<Edge> mEdges;
 	std::vector<SubmitGroup> mSubmitSequence;
+	std::vector<AliasGroup> mAliasGroups;
+	std::vector<SubmitBatch> mSubmitBatches;
+	std::vector<SubmitStep> mSubmitPlan;
+	std::vector<VkSubmitInfo> mSubmitInfos;
+	std::vector<VkTimelineSemaphoreSubmitInfo> mTimelineSubmitInfos;
+	std::vector<Frame> mFrames;
+	uint32_t mFramesInFlight = defaultFramesInFlight;
+	uint32_t mFrameIndex = 0;
+	uint64_t mFrameNumber = 1;
+	uint32_t mRecordingThreadCount = 1;
+	VkSemaphore mTimelineSemaphore = VK_NULL_HANDLE;
+	VkCommandPool mBarrierCommandPool = VK_NULL_HANDLE;
+	uint64_t mTimelineValue = 0;
 };
 
 #endif
\ No newline at end of file
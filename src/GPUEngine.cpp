@@ -83,10 +83,24 @@ GPUEngine::GPUEngine(const std::vector<GPUProcess*>& processes, GPUWindowSystem*
 	else
 		std::cout << "Could not create descriptor set layout!!" << std::endl;
 
+	if (createNearestSampler())
+		std::cout << "Sampler created successfully!!" << std::endl;
+	else
+		std::cout << "Could not create sampler!!" << std::endl;
+
 	createDebugMessenger();
 
-	// create transfer fence
-	mTransferFence = createFence(0);
+	// create device memory allocator
+	mMemoryAllocator = std::make_unique<GPUMemoryAllocator>(this);
+
+	// create staging ring used by transferToBuffer()
+	mStagingRing = std::make_unique<GPUStagingRing>(this);
+
+	// create geometry pool shared by all meshes
+	mGeometryPool = std::make_unique<GPUGeometryPool>(this);
+
+	// create worker pool; the calling thread runs jobs too
+	mWorkerPool = std::make_unique<GPUWorkerPool>(GPUWorkerPool::getHardwareThreadCount() - 1);
 
 	// create dependency graph
 	mDependencyGraph = std::make_unique<GPUDependencyGraph>(this);
@@ -103,9 +117,15 @@ GPUEngine::GPUEngine(const std::vector<GPUProcess*>& processes, GPUWindowSystem*
 
 GPUEngine::~GPUEngine()
 {
+	waitIdle();
+
 	// explicitly delete unique pointers owning vulkan handles
 	// (destructor must be called while instance exists)
 	mDependencyGraph.reset();
+	mWorkerPool.reset();
+	mGeometryPool.reset();
+	mStagingRing.reset();
+	mMemoryAllocator.reset();
 
 	// destroy command pools
 	vkDestroyCommandPool(mDevice, mGraphicsCommandPool, nullptr);
@@ -116,9 +136,9 @@ GPUEngine::~GPUEngine()
 		auto vkDestroyDebugUtilsMessengerEXT = (PFN_vkDestroyDebugUtilsMessengerEXT) vkGetInstanceProcAddr(mInstance, "vkDestroyDebugUtilsMessengerEXT");
 		vkDestroyDebugUtilsMessengerEXT(mInstance, mDebugMessenger, nullptr);
 	}
-	vkDestroyFence(mDevice, mTransferFence, nullptr);
 	vkDestroySurfaceKHR(mInstance, mSurface, nullptr);
 	vkDestroyDescriptorSetLayout(mDevice, mDescriptorLayoutModel, nullptr);
+	vkDestroySampler(mDevice, mNearestSampler, nullptr);
 
 	// finally, destroy device and instance
 	vkDestroyDevice(mDevice, nullptr);
@@ -135,16 +155,20 @@ bool GPUEngine::createSurface()
 	return true;
 }
 
-// TODO: make this more versatile and/or move this functionality
 /**
  * @brief Allocates a primary command buffer from commandPool.
  * 
+ * If commandPool was passed to a GPUProcess by the dependency graph, a command buffer recycled
+ * from a previous use of the same frame is returned instead, and must not be freed.
+ * 
  * @param commandPool 
  * @return VkCommandBuffer 
  */
 VkCommandBuffer GPUEngine::allocateCommandBuffer(VkCommandPool commandPool)
 {
 	VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
+	if (mDependencyGraph && mDependencyGraph->recycleCommandBuffer(commandPool, commandBuffer))
+		return commandBuffer;
 
 	VkCommandBufferAllocateInfo allocateInfo = {};
 	allocateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
@@ -193,17 +217,67 @@ VkFence GPUEngine::createFence(VkFenceCreateFlags flags)
 }
 
 /**
- * @brief Creates a buffer and allocates memory for it.
+ * @brief Creates a timeline semaphore with a given initial value.
+ * 
+ * Must only be called if supportsTimelineSemaphores() returns true.
+ * 
+ * @param initialValue The semaphore's initial counter value.
+ * @return VkSemaphore The created semaphore; VK_NULL_HANDLE on failure.
+ */
+VkSemaphore GPUEngine::createTimelineSemaphore(uint64_t initialValue)
+{
+	VkSemaphore semaphore = VK_NULL_HANDLE;
+
+	VkSemaphoreTypeCreateInfo typeCreateInfo = {};
+	typeCreateInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO;
+	typeCreateInfo.pNext = nullptr;
+	typeCreateInfo.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+	typeCreateInfo.initialValue = initialValue;
+
+	VkSemaphoreCreateInfo createInfo = {};
+	createInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+	createInfo.pNext = &typeCreateInfo;
+	createInfo.flags = 0;
+
+	vkCreateSemaphore(mDevice, &createInfo, nullptr, &semaphore);
+	return semaphore;
+}
+
+/**
+ * @brief Blocks until a timeline semaphore reaches a given value.
+ * 
+ * Must only be called if supportsTimelineSemaphores() returns true.
+ * 
+ * @param semaphore A timeline semaphore created by createTimelineSemaphore().
+ * @param value The counter value to wait for.
+ * @param timeout Timeout, in nanoseconds.
+ * @return true The semaphore has reached value.
+ * @return false The timeout expired, or the wait failed.
+ */
+bool GPUEngine::waitTimelineSemaphore(VkSemaphore semaphore, uint64_t value, uint64_t timeout)
+{
+	VkSemaphoreWaitInfo waitInfo = {};
+	waitInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO;
+	waitInfo.pNext = nullptr;
+	waitInfo.flags = 0;
+	waitInfo.semaphoreCount = 1;
+	waitInfo.pSemaphores = &semaphore;
+	waitInfo.pValues = &value;
+	return (mWaitSemaphores(mDevice, &waitInfo, timeout) == VK_SUCCESS);
+}
+
+/**
+ * @brief Creates a buffer and sub-allocates memory for it from the GPUEngine's GPUMemoryAllocator.
  * 
  * @param size Size of the buffer to be created.
  * @param usageFlags Flags describing how the buffer will be used.
  * @param memoryFlags Flags describing the required properties for the memory allocated.
  * @param buffer Reference in which the buffer handle will be placed.
- * @param memory Reference in which the memory handle will be placed.
+ * @param allocation Reference in which the memory allocation will be placed.
  * @return true Buffer was created successfully.
  * @return false Buffer could not be created.
  */
-bool GPUEngine::createBuffer(VkDeviceSize size, VkBufferUsageFlags usageFlags, VkMemoryPropertyFlags memoryFlags, VkBuffer& buffer, VkDeviceMemory& memory)
+bool GPUEngine::createBuffer(VkDeviceSize size, VkBufferUsageFlags usageFlags, VkMemoryPropertyFlags memoryFlags, VkBuffer& buffer, GPUMemoryAllocator::Allocation& allocation)
 {
 	// create the buffer
 	VkBufferCreateInfo createInfo = {};
@@ -218,38 +292,50 @@ bool GPUEngine::createBuffer(VkDeviceSize size, VkBufferUsageFlags usageFlags, V
 	if (vkCreateBuffer(mDevice, &createInfo, nullptr, &buffer) != VK_SUCCESS)
 		return false;
 
-	// find a suitable memory type
+	// allocate memory
 	VkMemoryRequirements memoryRequirements;
 	vkGetBufferMemoryRequirements(mDevice, buffer, &memoryRequirements);
-	uint32_t memoryType = findMemoryType(memoryRequirements.memoryTypeBits, memoryFlags);
-	if (memoryType == UINT32_MAX)
-		return false;
-
-	// allocate memory
-	VkMemoryAllocateInfo allocateInfo = {};
-	allocateInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-	allocateInfo.pNext = nullptr;
-	allocateInfo.allocationSize = memoryRequirements.size;
-	allocateInfo.memoryTypeIndex = memoryType;
-
-	if (vkAllocateMemory(mDevice, &allocateInfo, nullptr, &memory) != VK_SUCCESS)
+	if (!mMemoryAllocator->allocate(memoryRequirements, memoryFlags, true, allocation))
+	{
+		vkDestroyBuffer(mDevice, buffer, nullptr);
+		buffer = VK_NULL_HANDLE;
 		return false;
+	}
 
 	// bind memory
-	if (vkBindBufferMemory(mDevice, buffer, memory, 0) != VK_SUCCESS)
+	if (vkBindBufferMemory(mDevice, buffer, allocation.memory, allocation.offset) != VK_SUCCESS)
+	{
+		destroyBuffer(buffer, allocation);
 		return false;
+	}
 
 	return true;
 }
 
-// TODO: optimize this to avoid unnecessary memory allocation and play nice
-// with multiple threads
+/**
+ * @brief Destroys a buffer created by createBuffer() and frees its memory.
+ * 
+ * Both handles are reset, so calling destroyBuffer() again on the same buffer does nothing.
+ * 
+ * @param buffer The buffer to destroy.
+ * @param allocation The memory allocation that was returned along with the buffer.
+ */
+void GPUEngine::destroyBuffer(VkBuffer& buffer, GPUMemoryAllocator::Allocation& allocation)
+{
+	vkDestroyBuffer(mDevice, buffer, nullptr);
+	mMemoryAllocator->free(allocation);
+	buffer = VK_NULL_HANDLE;
+}
+
 /**
  * @brief Transfers data from memory to a VkBuffer.
  * 
- * transferToBuffer() does not return until the transfer operation
- * is completed. This may change in the future, with some more sophisticated
- * syncronization scheme.
+ * The data is copied into the engine's staging ring before transferToBuffer()
+ * returns, so the caller may reuse it immediately. The transfer itself is submitted
+ * to the transfer queue (which is the graphics queue, if the device has no dedicated
+ * transfer queue family) without waiting for it to complete; any work submitted
+ * to the graphics queue afterwards will see the transferred data. Inside an upload
+ * batch, the transfer is only recorded, and is submitted by endUploadBatch().
  * 
  * @param destination The VkBuffer to which data will be transferred.
  * @param data Pointer to the data to transfer.
@@ -258,50 +344,60 @@ bool GPUEngine::createBuffer(VkDeviceSize size, VkBufferUsageFlags usageFlags, V
  */
 void GPUEngine::transferToBuffer(VkBuffer destination, void* data, VkDeviceSize size, VkDeviceSize offset)
 {
-	// create staging buffer
-	VkBuffer stagingBuffer;
-	VkDeviceMemory stagingMemory;
-	createBuffer(size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-		VK_MEMORY_PROPERTY_HOST_COHERENT_BIT | VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT, stagingBuffer, stagingMemory);
+	mStagingRing->upload(destination, data, size, offset);
+	if (mUploadBatchDepth == 0)
+		mStagingRing->flush();
+}
+
+/**
+ * @brief Begins an upload batch.
+ * 
+ * Until the matching call to endUploadBatch(), transfers made through transferToBuffer()
+ * are recorded into the staging ring's current command buffer rather than submitted one
+ * at a time. Batches may be nested; only the outermost endUploadBatch() submits.
+ */
+void GPUEngine::beginUploadBatch()
+{
+	mUploadBatchDepth++;
+}
+
+/**
+ * @brief Ends an upload batch, submitting its transfers if it is the outermost batch.
+ * 
+ * @return uint64_t Ticket which can be passed to isUploadComplete() or waitForUpload()
+ * to check for completion of every transfer made so far.
+ */
+uint64_t GPUEngine::endUploadBatch()
+{
+	if (mUploadBatchDepth > 0)
+		mUploadBatchDepth--;
 
-	// stage & transfer data
-	// TODO: optimize staging & transfer to avoid unnecessary memory allocation
-	void* dataPtr;
-	vkMapMemory(mDevice, stagingMemory, 0, size, 0, &dataPtr);
-		memcpy(dataPtr, data, (size_t)size);
-	vkUnmapMemory(mDevice, stagingMemory);
+	if (mUploadBatchDepth == 0)
+		return mStagingRing->flush();
+	return mStagingRing->getPendingSerial();
+}
 
-	{
-		VkCommandBuffer commandBuffer = allocateCommandBuffer(mGraphicsCommandPool);
-		VkCommandBufferBeginInfo beginInfo = {};
-		beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-		beginInfo.pNext = nullptr;
-		beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
-		vkBeginCommandBuffer(commandBuffer, &beginInfo);
-
-		VkBufferCopy copyRegion = {};
-		copyRegion.srcOffset = 0;
-		copyRegion.dstOffset = 0;
-		copyRegion.size = size;
-		vkCmdCopyBuffer(commandBuffer, stagingBuffer, destination, 1, &copyRegion);
-
-		vkEndCommandBuffer(commandBuffer);
-
-		VkSubmitInfo submitInfo = {};
-		submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-		submitInfo.pNext = nullptr;
-		submitInfo.commandBufferCount = 1;
-		submitInfo.pCommandBuffers = &commandBuffer;
-
-		vkQueueSubmit(mGraphicsQueue, 1, &submitInfo, mTransferFence);
-		vkWaitForFences(mDevice, 1, &mTransferFence, VK_TRUE, UINT64_MAX);
-		vkResetFences(mDevice, 1, &mTransferFence);
-
-		vkFreeCommandBuffers(mDevice, mGraphicsCommandPool, 1, &commandBuffer);
-	}
+/**
+ * @brief Returns true if every transfer covered by a ticket has completed on the GPU.
+ * 
+ * @param ticket A ticket returned by endUploadBatch().
+ */
+bool GPUEngine::isUploadComplete(uint64_t ticket)
+{
+	return mStagingRing->isComplete(ticket);
+}
 
-	vkFreeMemory(mDevice, stagingMemory, nullptr);
-	vkDestroyBuffer(mDevice, stagingBuffer, nullptr);
+/**
+ * @brief Blocks until every transfer covered by a ticket has completed on the GPU.
+ * 
+ * If the ticket belongs to a batch that is nested in one which has not yet ended,
+ * the transfers recorded so far are submitted early.
+ * 
+ * @param ticket A ticket returned by endUploadBatch().
+ */
+void GPUEngine::waitForUpload(uint64_t ticket)
+{
+	mStagingRing->wait(ticket);
 }
 
 /**
@@ -317,7 +413,7 @@ uint32_t GPUEngine::findMemoryType(uint32_t memoryTypeBits, VkMemoryPropertyFlag
 	vkGetPhysicalDeviceMemoryProperties(mPhysicalDevice, &memoryProperties);
 
 	for (uint32_t i = 0; i < memoryProperties.memoryTypeCount; i++)
-		if ((memoryTypeBits & (1 << i)) && (memoryProperties.memoryTypes[i].propertyFlags & properties))
+		if ((memoryTypeBits & (1 << i)) && (memoryProperties.memoryTypes[i].propertyFlags & properties) == properties)
 		{
 			return i;
 		}
@@ -325,6 +421,31 @@ uint32_t GPUEngine::findMemoryType(uint32_t memoryTypeBits, VkMemoryPropertyFlag
 	return UINT32_MAX;
 }
 
+/**
+ * @brief Checks whether the device has a memory type which is device-local as well as host-visible and host-coherent.
+ * 
+ * Such memory is common on integrated GPUs and on discrete GPUs with resizable BAR; data which
+ * changes every frame can be written into it directly, rather than copied from a staging buffer.
+ * 
+ * @return true A suitable memory type exists.
+ * @return false No suitable memory type exists.
+ */
+bool GPUEngine::hasHostVisibleDeviceLocalMemory()
+{
+	VkMemoryPropertyFlags properties = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+	return findMemoryType(UINT32_MAX, properties) != UINT32_MAX;
+}
+
+/**
+ * @brief Returns usage statistics for all device memory allocated through this GPUEngine.
+ * 
+ * @return GPUMemoryAllocator::Stats 
+ */
+GPUMemoryAllocator::Stats GPUEngine::getMemoryStats()
+{
+	return mMemoryAllocator->getStats();
+}
+
 /**
  * @brief Adds a process to the dependency graph and sets that process to use this GPUEngine.
  * 
@@ -344,9 +465,69 @@ void GPUEngine::validateProcesses()
 	mDependencyGraph->build();
 }
 
+/**
+ * @brief Sets the maximum number of frames which may be in flight at once.
+ * 
+ * Must be called before validateProcesses(). Defaults to GPUDependencyGraph::defaultFramesInFlight.
+ * 
+ * @param framesInFlight Number of frames, between 1 and GPUDependencyGraph::maxFramesInFlight.
+ * @return true The number of frames in flight was changed.
+ * @return false The processes have already been validated, so the number is left unchanged.
+ */
+bool GPUEngine::setFramesInFlight(uint32_t framesInFlight)
+{
+	return mDependencyGraph->setFramesInFlight(framesInFlight);
+}
+
+/**
+ * @brief Returns the number of frames which may be in flight at once.
+ * 
+ * Processes which write per-frame data from the CPU should keep this many copies of it.
+ */
+uint32_t GPUEngine::getFramesInFlight()
+{
+	return mDependencyGraph->getFramesInFlight();
+}
+
+/**
+ * @brief Returns the index, in [0, getFramesInFlight()), of the frame that will be rendered next.
+ * 
+ * Resources belonging to this frame index are no longer in use by the GPU, and may be written.
+ */
+uint32_t GPUEngine::getFrameIndex()
+{
+	return mDependencyGraph->getFrameIndex();
+}
+
+/**
+ * @brief Blocks until the most recently submitted operation of a process has completed on the GPU.
+ * 
+ * Only processes which record command buffers are tracked. When timeline semaphores are
+ * supported, this waits for the process itself; otherwise, it waits for the whole frame
+ * in which the process was last executed.
+ * 
+ * @param process A process which has been added to this GPUEngine.
+ * @param timeout Timeout, in nanoseconds.
+ * @return true The operation has completed.
+ * @return false The timeout expired, or the process has not been executed yet.
+ */
+bool GPUEngine::waitForProcess(GPUProcess* process, uint64_t timeout)
+{
+	return mDependencyGraph->waitForValue(mDependencyGraph->getProcessSignalValue(process), timeout);
+}
+
+/**
+ * @brief Blocks until the GPU has finished all rendering, presentation and transfer work.
+ */
+void GPUEngine::waitIdle()
+{
+	vkDeviceWaitIdle(mDevice);
+}
+
 /**
  * @brief Renders an image and presents it to the surface.
  * 
+ * Does not wait for the frame to finish rendering, but may wait for an earlier frame.
  * If there is a problem with presenting to the surface,
  * all surface-related resources are freed and rebuilt.
  */
@@ -354,14 +535,20 @@ void GPUEngine::renderFrame()
 {
 	mDependencyGraph->executeSequence();
 
+	// meshes freed before this frame may have been drawn by the frames still in flight
+	mGeometryPool->releaseRetiredRanges(false);
+
 	if (((GPUProcessSwapchain*)mSwapchainProcess)->shouldRebuild())
 	{
+		// frames in flight may still be using surface-related resources
+		mDependencyGraph->waitIdle();
 		mDependencyGraph->invalidateFrameResources();
 		vkDestroySurfaceKHR(mInstance, mSurface, nullptr);
 		createSurface();
 		// TODO: query this in a better way
 		findDevicePresentQueueFamily(mPhysicalDevice, mSurface);
-		mDependencyGraph->acquireFrameResources();
+		if (!mDependencyGraph->acquireFrameResources())
+			std::cout << "Could not bind transient image memory!!" << std::endl;
 	}
 }
 
@@ -433,11 +620,13 @@ bool GPUEngine::choosePhysicalDevice(const std::vector<const char*>& extensions)
 		{
 			bestDevice = physicalDevice;
 			mPhysicalDeviceLimits.reset(new VkPhysicalDeviceLimits(properties.limits));
+			mDeviceApiVersion = properties.apiVersion;
 		}
 		if (properties.deviceType == VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU)
 		{
 			bestDevice = physicalDevice;
 			mPhysicalDeviceLimits.reset(new VkPhysicalDeviceLimits(properties.limits));
+			mDeviceApiVersion = properties.apiVersion;
 			discreteGPUFound = true;
 		}
 	}
@@ -463,43 +652,90 @@ bool GPUEngine::createLogicalDevice(const std::vector<const char*>& extensions)
 	mGraphicsQueueFamily = queues[0];
 	mPresentQueueFamily = findDevicePresentQueueFamily(mPhysicalDevice, mSurface);
 
-	// TODO: make this more robust
-	// Create a graphics queue and, if needed, a present queue
-	VkDeviceQueueCreateInfo queueCreateInfos[2];
+	// use a transfer-only queue family for uploads if the device has one,
+	// otherwise uploads share the graphics queue
+	mTransferQueueFamily = findDeviceDedicatedTransferQueueFamily(mPhysicalDevice);
+	if (mTransferQueueFamily == INVALID_QUEUE_FAMILY)
+		mTransferQueueFamily = mGraphicsQueueFamily;
+
+	// Create one queue for each distinct family among the graphics, present and transfer families
+	std::vector<VkDeviceQueueCreateInfo> queueCreateInfos;
 	float queuePriority = 1.0f;
 
-	queueCreateInfos[0].sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
-	queueCreateInfos[0].pNext = nullptr;
-	queueCreateInfos[0].flags = 0;
-	queueCreateInfos[0].pQueuePriorities = &queuePriority;
-	queueCreateInfos[0].queueCount = 1;
-	queueCreateInfos[0].queueFamilyIndex = mGraphicsQueueFamily;
+	for (uint32_t family : { mGraphicsQueueFamily, mPresentQueueFamily, mTransferQueueFamily })
+	{
+		bool alreadyCreated = false;
+		for (auto& queueCreateInfo : queueCreateInfos)
+			if (queueCreateInfo.queueFamilyIndex == family)
+				alreadyCreated = true;
+		if (alreadyCreated)
+			continue;
+
+		VkDeviceQueueCreateInfo queueCreateInfo = {};
+		queueCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
+		queueCreateInfo.pNext = nullptr;
+		queueCreateInfo.flags = 0;
+		queueCreateInfo.pQueuePriorities = &queuePriority;
+		queueCreateInfo.queueCount = 1;
+		queueCreateInfo.queueFamilyIndex = family;
+		queueCreateInfos.push_back(queueCreateInfo);
+	}
+
+	// enable timeline semaphores if both the instance and the device are Vulkan 1.2 or newer;
+	// newer entry points are loaded at runtime, so that Vulkan 1.0 loaders can still be used
+	VkPhysicalDeviceTimelineSemaphoreFeatures timelineFeatures = {};
+	timelineFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES;
+	timelineFeatures.pNext = nullptr;
+	if (mInstanceApiVersion >= VK_API_VERSION_1_2 && mDeviceApiVersion >= VK_API_VERSION_1_2)
+	{
+		auto getPhysicalDeviceFeatures2 = (PFN_vkGetPhysicalDeviceFeatures2) vkGetInstanceProcAddr(mInstance, "vkGetPhysicalDeviceFeatures2");
+		if (getPhysicalDeviceFeatures2 != nullptr)
+		{
+			VkPhysicalDeviceFeatures2 features = {};
+			features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+			features.pNext = &timelineFeatures;
+			getPhysicalDeviceFeatures2(mPhysicalDevice, &features);
+		}
+	}
+	mTimelineSemaphores = (timelineFeatures.timelineSemaphore == VK_TRUE);
+
+	// enable multi-draw indirect if supported, so that draws of meshes sharing
+	// geometry pool buffers can be issued with a single indirect command
+	VkPhysicalDeviceFeatures supportedFeatures;
+	vkGetPhysicalDeviceFeatures(mPhysicalDevice, &supportedFeatures);
+	VkPhysicalDeviceFeatures enabledFeatures = {};
+	enabledFeatures.multiDrawIndirect = supportedFeatures.multiDrawIndirect;
+	mMultiDrawIndirect = (enabledFeatures.multiDrawIndirect == VK_TRUE);
 
-	queueCreateInfos[1].sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
-	queueCreateInfos[1].pNext = nullptr;
-	queueCreateInfos[1].flags = 0;
-	queueCreateInfos[1].pQueuePriorities = &queuePriority;
-	queueCreateInfos[1].queueCount = 1;
-	queueCreateInfos[1].queueFamilyIndex = mPresentQueueFamily;
+	// indirect draws may only start past instance zero with drawIndirectFirstInstance
+	enabledFeatures.drawIndirectFirstInstance = supportedFeatures.drawIndirectFirstInstance;
+	mDrawIndirectFirstInstance = (enabledFeatures.drawIndirectFirstInstance == VK_TRUE);
 
 	VkDeviceCreateInfo createInfo = {};
 	createInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
-	createInfo.pNext = nullptr;
+	createInfo.pNext = mTimelineSemaphores ? &timelineFeatures : nullptr;
 	createInfo.flags = 0;
-	createInfo.queueCreateInfoCount = (mGraphicsQueueFamily == mPresentQueueFamily) ? 1 : 2;
-	createInfo.pQueueCreateInfos = queueCreateInfos;
+	createInfo.queueCreateInfoCount = queueCreateInfos.size();
+	createInfo.pQueueCreateInfos = queueCreateInfos.data();
 	createInfo.enabledLayerCount = 0;
 	createInfo.ppEnabledLayerNames = nullptr;
 	fillExtensionsInStruct(createInfo, extensions);
-	createInfo.pEnabledFeatures = nullptr;
+	createInfo.pEnabledFeatures = &enabledFeatures;
 
 	VkResult result = vkCreateDevice(mPhysicalDevice, &createInfo, nullptr, &mDevice);
 	if (result != VK_SUCCESS)
 		return false;
 
+	if (mTimelineSemaphores)
+	{
+		mWaitSemaphores = (PFN_vkWaitSemaphores) vkGetDeviceProcAddr(mDevice, "vkWaitSemaphores");
+		mTimelineSemaphores = (mWaitSemaphores != nullptr);
+	}
+
 	// Now obtain and remember the queue(s)
 	vkGetDeviceQueue(mDevice, mGraphicsQueueFamily, 0, &mGraphicsQueue);
 	vkGetDeviceQueue(mDevice, mPresentQueueFamily, 0, &mPresentQueue);
+	vkGetDeviceQueue(mDevice, mTransferQueueFamily, 0, &mTransferQueue);
 
 	return true;
 }
@@ -516,25 +752,57 @@ bool GPUEngine::createCommandPools()
 	return (result == VK_SUCCESS);
 }
 
+/**
+ * @brief Creates the descriptor set layout used for per-instance data in vertex shaders.
+ * 
+ * Binding 0 is the transform storage buffer. Binding 1 is a list of instance indices into it,
+ * which is only used by shaders that draw the output of a GPUProcessCull; descriptor sets
+ * used with other shaders may leave it unwritten.
+ */
 bool GPUEngine::createDescriptorSetLayout()
 {
-	VkDescriptorSetLayoutBinding binding = {};
-	binding.binding = 0;
-	binding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
-	binding.descriptorCount = 1;
-	binding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
-	binding.pImmutableSamplers = nullptr;
+	VkDescriptorSetLayoutBinding bindings[2] = {};
+	for (uint32_t i = 0; i < 2; i++)
+	{
+		bindings[i].binding = i;
+		bindings[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		bindings[i].descriptorCount = 1;
+		bindings[i].stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+		bindings[i].pImmutableSamplers = nullptr;
+	}
 
 	VkDescriptorSetLayoutCreateInfo createInfo = {};
 	createInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
 	createInfo.pNext = nullptr;
 	createInfo.flags = 0;
-	createInfo.bindingCount = 1;
-	createInfo.pBindings = &binding;
+	createInfo.bindingCount = 2;
+	createInfo.pBindings = bindings;
 
 	return (vkCreateDescriptorSetLayout(mDevice, &createInfo, nullptr, &mDescriptorLayoutModel) == VK_SUCCESS);
 }
 
+/**
+ * @brief Creates a sampler with nearest filtering and clamped addressing, shared by every process which reads images with texelFetch().
+ * 
+ * texelFetch() ignores the sampler's filtering, but a combined image sampler descriptor still needs one.
+ */
+bool GPUEngine::createNearestSampler()
+{
+	VkSamplerCreateInfo createInfo = {};
+	createInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+	createInfo.pNext = nullptr;
+	createInfo.flags = 0;
+	createInfo.magFilter = VK_FILTER_NEAREST;
+	createInfo.minFilter = VK_FILTER_NEAREST;
+	createInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+	createInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	createInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	createInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	createInfo.maxLod = VK_LOD_CLAMP_NONE;
+
+	return (vkCreateSampler(mDevice, &createInfo, nullptr, &mNearestSampler) == VK_SUCCESS);
+}
+
 bool GPUEngine::createDebugMessenger()
 {
 	#ifdef NDEBUG
@@ -574,6 +842,16 @@ bool GPUEngine::createInstance(const std::vector<const char*>& extensions, std::
 	applicationInfo.engineVersion = engineVersion;
 	applicationInfo.apiVersion = VK_MAKE_VERSION(1, 0, 0);
 
+	// request Vulkan 1.2 if the loader supports it; vkEnumerateInstanceVersion
+	// does not exist on Vulkan 1.0 loaders, so it must be queried at runtime
+	auto enumerateInstanceVersion = (PFN_vkEnumerateInstanceVersion) vkGetInstanceProcAddr(nullptr, "vkEnumerateInstanceVersion");
+	uint32_t loaderVersion = VK_MAKE_VERSION(1, 0, 0);
+	if (enumerateInstanceVersion != nullptr)
+		enumerateInstanceVersion(&loaderVersion);
+	if (loaderVersion >= VK_API_VERSION_1_2)
+		applicationInfo.apiVersion = VK_API_VERSION_1_2;
+	mInstanceApiVersion = applicationInfo.apiVersion;
+
 	VkInstanceCreateInfo createInfo = {};
 	createInfo.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
 	createInfo.pNext = nullptr;
@@ -706,3 +984,31 @@ uint32_t GPUEngine::findDevicePresentQueueFamily(VkPhysicalDevice device, VkSurf
 
 	return INVALID_QUEUE_FAMILY;
 }
+
+/**
+* Attempts to find a queue family which supports transfer operations, but not graphics operations.
+* Families which also lack compute support are preferred, as they usually map to dedicated copy
+* engines. Returns INVALID_QUEUE_FAMILY if every transfer-capable family supports graphics.
+*/
+uint32_t GPUEngine::findDeviceDedicatedTransferQueueFamily(VkPhysicalDevice device)
+{
+	uint32_t familyCount = 0;
+	vkGetPhysicalDeviceQueueFamilyProperties(device, &familyCount, nullptr);
+	std::vector<VkQueueFamilyProperties> propertiesVector(familyCount);
+	vkGetPhysicalDeviceQueueFamilyProperties(device, &familyCount, propertiesVector.data());
+
+	uint32_t bestFamily = INVALID_QUEUE_FAMILY;
+	for (uint32_t i = 0; i < familyCount; i++)
+	{
+		VkQueueFlags flags = propertiesVector[i].queueFlags;
+		if (!(flags & VK_QUEUE_TRANSFER_BIT) || (flags & VK_QUEUE_GRAPHICS_BIT))
+			continue;
+
+		if (!(flags & VK_QUEUE_COMPUTE_BIT))
+			return i;
+		if (bestFamily == INVALID_QUEUE_FAMILY)
+			bestFamily = i;
+	}
+
+	return bestFamily;
+}
@@ -12,6 +12,10 @@
 #include "GPUProcessSwapchain.h"
 #include "GPUDependencyGraph.h"
 #include "GPUMeshWrangler.h"
+#include "GPUMemoryAllocator.h"
+#include "GPUStagingRing.h"
+#include "GPUGeometryPool.h"
+#include "GPUWorkerPool.h"
 
 /**
  * @brief Creates and manages the Vulkan device and instance, as well as the processes used to render a frame.
@@ -32,12 +36,26 @@ public:
 
 	// Public functionality
 	void renderFrame();
+	bool setFramesInFlight(uint32_t framesInFlight);
+	uint32_t getFramesInFlight();
+	uint32_t getFrameIndex();
+	bool waitForProcess(GPUProcess* process, uint64_t timeout = UINT64_MAX);
+	void waitIdle();
 	VkCommandBuffer allocateCommandBuffer(VkCommandPool commandPool);
 	VkSemaphore createSemaphore();
 	VkFence createFence(VkFenceCreateFlags flags);
-	bool createBuffer(VkDeviceSize size, VkBufferUsageFlags usageFlags, VkMemoryPropertyFlags memoryFlags, VkBuffer& buffer, VkDeviceMemory& memory);
+	VkSemaphore createTimelineSemaphore(uint64_t initialValue);
+	bool waitTimelineSemaphore(VkSemaphore semaphore, uint64_t value, uint64_t timeout);
+	bool createBuffer(VkDeviceSize size, VkBufferUsageFlags usageFlags, VkMemoryPropertyFlags memoryFlags, VkBuffer& buffer, GPUMemoryAllocator::Allocation& allocation);
+	void destroyBuffer(VkBuffer& buffer, GPUMemoryAllocator::Allocation& allocation);
 	void transferToBuffer(VkBuffer destination, void* data, VkDeviceSize size, VkDeviceSize offset);
+	void beginUploadBatch();
+	uint64_t endUploadBatch();
+	bool isUploadComplete(uint64_t ticket);
+	void waitForUpload(uint64_t ticket);
 	uint32_t findMemoryType(uint32_t memoryTypeBits, VkMemoryPropertyFlags properties);
+	bool hasHostVisibleDeviceLocalMemory();
+	GPUMemoryAllocator::Stats getMemoryStats();
 	void addProcess(GPUProcess* process);
 	void validateProcesses();
 	VkBool32 vulkanDebugCallback( VkDebugUtilsMessageSeverityFlagBitsEXT messageSeverity, VkDebugUtilsMessageTypeFlagsEXT messageType,
@@ -49,13 +67,22 @@ public:
 	VkPhysicalDevice getPhysicalDevice() { return mPhysicalDevice; }
 	uint32_t getGraphicsQueueFamily() { return mGraphicsQueueFamily; }
 	uint32_t getPresentQueueFamily() { return mPresentQueueFamily; }
+	uint32_t getTransferQueueFamily() { return mTransferQueueFamily; }
+	VkQueue getTransferQueue() { return mTransferQueue; }
 	VkQueue getPresentQueue() { return mPresentQueue; }
 	VkCommandPool getGraphicsPool() { return mGraphicsCommandPool; }
 	VkQueue getGraphicsQueue() { return mGraphicsQueue; }
 	VkSurfaceKHR getSurface() { return mSurface; }
 	VkExtent2D getSurfaceExtent() { return mSurfaceExtent; }
 	VkDescriptorSetLayout getModelDescriptorLayout() { return mDescriptorLayoutModel; }
+	VkSampler getNearestSampler() { return mNearestSampler; }
 	GPUMeshWrangler* getMeshWrangler() { return mMeshWrangler; }
+	bool supportsTimelineSemaphores() { return mTimelineSemaphores; }
+	bool supportsMultiDrawIndirect() { return mMultiDrawIndirect; }
+	bool supportsDrawIndirectFirstInstance() { return mDrawIndirectFirstInstance; }
+	GPUMemoryAllocator* getMemoryAllocator() { return mMemoryAllocator.get(); }
+	GPUGeometryPool* getGeometryPool() { return mGeometryPool.get(); }
+	GPUWorkerPool* getWorkerPool() { return mWorkerPool.get(); }
 	const VkPhysicalDeviceLimits* getPhysicalDeviceLimits() { return mPhysicalDeviceLimits.get(); }
 	GPUProcessSwapchain* getSwapchainProcess() { return mSwapchainProcess; }
 	GPUProcessPresent* getPresentProcess() { return mSwapchainProcess->getPresentProcess(); }
@@ -67,11 +94,13 @@ private:
 	bool createSurface();
 	bool createCommandPools();
 	bool createDescriptorSetLayout();
+	bool createNearestSampler();
 	bool createDebugMessenger();
 	static std::vector<const char*> createInstanceExtensionsVector(const std::vector<GPUProcess*>& processes);
 	static std::vector<const char*> createDeviceExtensionsVector(const std::vector<GPUProcess*>& processes);
 	static std::vector<uint32_t> findDeviceQueueFamilies(VkPhysicalDevice device, std::vector<VkQueueFlags>& flags);
 	static uint32_t findDevicePresentQueueFamily(VkPhysicalDevice device, VkSurfaceKHR surface);
+	static uint32_t findDeviceDedicatedTransferQueueFamily(VkPhysicalDevice device);
 
 	template<typename T> static inline void fillExtensionsInStruct(T& structure, const std::vector<const char*>& extensions)
 	{
@@ -86,6 +115,12 @@ private:
 
 	static std::vector<const char*> validationLayers;
 	std::unique_ptr<VkPhysicalDeviceLimits> mPhysicalDeviceLimits;
+	uint32_t mInstanceApiVersion = VK_MAKE_VERSION(1, 0, 0);
+	uint32_t mDeviceApiVersion = VK_MAKE_VERSION(1, 0, 0);
+	bool mTimelineSemaphores = false;
+	PFN_vkWaitSemaphores mWaitSemaphores = nullptr;
+	bool mMultiDrawIndirect = false;
+	bool mDrawIndirectFirstInstance = false;
 
 	// GPUProcess objects; all GPUProcess objects are owned
 	// by the GPUDependencyGraph, but the GPUEngine is responsible
@@ -94,19 +129,30 @@ private:
 	GPUMeshWrangler* mMeshWrangler;
 	std::unique_ptr<GPUDependencyGraph> mDependencyGraph;
 
+	// device memory allocator; must outlive everything that allocates from it
+	std::unique_ptr<GPUMemoryAllocator> mMemoryAllocator;
+	std::unique_ptr<GPUStagingRing> mStagingRing;
+	std::unique_ptr<GPUGeometryPool> mGeometryPool;
+
+	// threads shared by everything which records or rasterizes in parallel
+	std::unique_ptr<GPUWorkerPool> mWorkerPool;
+	uint32_t mUploadBatchDepth = 0;
+
 	// Vulkan objects owned by GPUEngine
 	VkInstance mInstance = VK_NULL_HANDLE;
 	uint32_t mGraphicsQueueFamily = INVALID_QUEUE_FAMILY;
 	uint32_t mPresentQueueFamily = INVALID_QUEUE_FAMILY;
+	uint32_t mTransferQueueFamily = INVALID_QUEUE_FAMILY;
 	VkQueue mGraphicsQueue = VK_NULL_HANDLE;
 	VkQueue mPresentQueue = VK_NULL_HANDLE;
+	VkQueue mTransferQueue = VK_NULL_HANDLE;
 	VkCommandPool mGraphicsCommandPool = VK_NULL_HANDLE;
 	VkDevice mDevice = VK_NULL_HANDLE;
 	VkPhysicalDevice mPhysicalDevice = VK_NULL_HANDLE;
 	VkSurfaceKHR mSurface = VK_NULL_HANDLE;
 	VkExtent2D mSurfaceExtent;
-	VkFence mTransferFence = VK_NULL_HANDLE;
 	VkDescriptorSetLayout mDescriptorLayoutModel = VK_NULL_HANDLE;
+	VkSampler mNearestSampler = VK_NULL_HANDLE;
 	VkDebugUtilsMessengerEXT mDebugMessenger = VK_NULL_HANDLE;
 };
 
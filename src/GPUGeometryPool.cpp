@@ -0,0 +1,232 @@
+#include "GPUGeometryPool.h"
+
+#include <algorithm>
+
+#include "GPUEngine.h"
+
+GPUGeometryPool::GPUGeometryPool(GPUEngine* engine)
+{
+	mEngine = engine;
+}
+
+GPUGeometryPool::~GPUGeometryPool()
+{
+	for (auto& block : mBlocks)
+		destroyBlock(block.get());
+	mBlocks.clear();
+}
+
+/**
+ * @brief Allocates a range of vertices and a range of indices within a single block.
+ *
+ * Existing blocks are searched in creation order, and a new block is only created if none of
+ * them has room for both ranges.
+ *
+ * @param vertexCount Number of vertices to allocate.
+ * @param indexCount Number of indices to allocate.
+ * @param range Reference in which the resulting range will be placed.
+ * @return true The ranges were allocated successfully.
+ * @return false One of the counts is zero, or a new block could not be created.
+ */
+bool GPUGeometryPool::allocate(uint32_t vertexCount, uint32_t indexCount, Range& range)
+{
+	if (vertexCount == 0 || indexCount == 0)
+		return false;
+
+	range.vertexCount = vertexCount;
+	range.indexCount = indexCount;
+
+	for (uint32_t i = 0; i < mBlocks.size(); i++)
+	{
+		Block* block = mBlocks[i].get();
+		if (!allocateRange(block->freeVertexRanges, vertexCount, range.vertexOffset))
+			continue;
+		if (!allocateRange(block->freeIndexRanges, indexCount, range.firstIndex))
+		{
+			freeRange(block->freeVertexRanges, range.vertexOffset, vertexCount);
+			continue;
+		}
+
+		range.block = i;
+		return true;
+	}
+
+	Block* block = createBlock(std::max(vertexCount, defaultBlockVertexCount), std::max(indexCount, defaultBlockIndexCount));
+	if (block == nullptr)
+		return false;
+
+	allocateRange(block->freeVertexRanges, vertexCount, range.vertexOffset);
+	allocateRange(block->freeIndexRanges, indexCount, range.firstIndex);
+	range.block = mBlocks.size() - 1;
+	return true;
+}
+
+/**
+ * @brief Gives a range back to the pool.
+ *
+ * Frames in flight may still draw from the range, so it is retired, and only becomes free once
+ * as many frames as there are frames in flight have been rendered. range is reset, so freeing
+ * it again does nothing.
+ */
+void GPUGeometryPool::free(Range& range)
+{
+	if (range.block == invalidBlock)
+		return;
+
+	RetiredRange retired = {};
+	retired.range = range;
+	retired.framesRemaining = mEngine->getFramesInFlight();
+	mRetiredRanges.push_back(retired);
+	range = Range();
+}
+
+/**
+ * @brief Frees retired ranges which are no longer in use by any frame in flight.
+ *
+ * Called once per frame, after it has been rendered; a retired range is freed after as many
+ * frames as there are frames in flight, at which point the frames which could have drawn from
+ * it have completed.
+ *
+ * @param all Whether to free all retired ranges regardless, I.E. because the device is idle.
+ */
+void GPUGeometryPool::releaseRetiredRanges(bool all)
+{
+	size_t kept = 0;
+	for (auto& retired : mRetiredRanges)
+	{
+		if (!all && --retired.framesRemaining > 0)
+		{
+			mRetiredRanges[kept++] = retired;
+			continue;
+		}
+
+		Block* block = mBlocks[retired.range.block].get();
+		freeRange(block->freeVertexRanges, retired.range.vertexOffset, retired.range.vertexCount);
+		freeRange(block->freeIndexRanges, retired.range.firstIndex, retired.range.indexCount);
+	}
+	mRetiredRanges.resize(kept);
+}
+
+/**
+ * @brief Uploads one position for every vertex of a range.
+ */
+void GPUGeometryPool::uploadPositions(const Range& range, const glm::vec3* positions)
+{
+	mEngine->transferToBuffer(mBlocks[range.block]->positionBuffer, (void*) positions,
+		sizeof(glm::vec3) * range.vertexCount, sizeof(glm::vec3) * range.vertexOffset);
+}
+
+/**
+ * @brief Uploads one normal for every vertex of a range.
+ *
+ * Normals of a range which are never uploaded are left undefined.
+ */
+void GPUGeometryPool::uploadNormals(const Range& range, const glm::vec3* normals)
+{
+	mEngine->transferToBuffer(mBlocks[range.block]->normalBuffer, (void*) normals,
+		sizeof(glm::vec3) * range.vertexCount, sizeof(glm::vec3) * range.vertexOffset);
+}
+
+/**
+ * @brief Uploads every index of a range.
+ *
+ * Indices are relative to the range's first vertex, since draws add its vertex offset to them.
+ */
+void GPUGeometryPool::uploadIndices(const Range& range, const uint32_t* indices)
+{
+	mEngine->transferToBuffer(mBlocks[range.block]->indexBuffer, (void*) indices,
+		sizeof(uint32_t) * range.indexCount, sizeof(uint32_t) * range.firstIndex);
+}
+
+/**
+ * @brief Creates a block with buffers for the given numbers of vertices and indices, and adds it to the pool.
+ *
+ * @return A pointer to the new block, or nullptr if one of its buffers could not be created.
+ */
+GPUGeometryPool::Block* GPUGeometryPool::createBlock(uint32_t vertexCapacity, uint32_t indexCapacity)
+{
+	auto block = std::make_unique<Block>();
+	block->vertexCapacity = vertexCapacity;
+	block->indexCapacity = indexCapacity;
+
+	VkBufferUsageFlags vertexUsage = VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT;
+	VkBufferUsageFlags indexUsage = VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT;
+	VkDeviceSize vertexBufferSize = sizeof(glm::vec3) * (VkDeviceSize) vertexCapacity;
+	VkDeviceSize indexBufferSize = sizeof(uint32_t) * (VkDeviceSize) indexCapacity;
+
+	bool created = mEngine->createBuffer(vertexBufferSize, vertexUsage, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+		block->positionBuffer, block->positionMemory);
+	created = created && mEngine->createBuffer(vertexBufferSize, vertexUsage, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+		block->normalBuffer, block->normalMemory);
+	created = created && mEngine->createBuffer(indexBufferSize, indexUsage, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+		block->indexBuffer, block->indexMemory);
+
+	if (!created)
+	{
+		destroyBlock(block.get());
+		return nullptr;
+	}
+
+	block->freeVertexRanges[0] = vertexCapacity;
+	block->freeIndexRanges[0] = indexCapacity;
+	mBlocks.push_back(std::move(block));
+	return mBlocks.back().get();
+}
+
+void GPUGeometryPool::destroyBlock(Block* block)
+{
+	if (block->positionBuffer != VK_NULL_HANDLE)
+		mEngine->destroyBuffer(block->positionBuffer, block->positionMemory);
+	if (block->normalBuffer != VK_NULL_HANDLE)
+		mEngine->destroyBuffer(block->normalBuffer, block->normalMemory);
+	if (block->indexBuffer != VK_NULL_HANDLE)
+		mEngine->destroyBuffer(block->indexBuffer, block->indexMemory);
+}
+
+/**
+ * @brief Takes count elements from the first free range large enough to hold them.
+ *
+ * @return true offset holds the start of the allocated elements.
+ * @return false No free range is large enough.
+ */
+bool GPUGeometryPool::allocateRange(std::map<uint32_t, uint32_t>& freeRanges, uint32_t count, uint32_t& offset)
+{
+	auto range = freeRanges.begin();
+	for (; range != freeRanges.end(); range++)
+		if (range->second >= count)
+			break;
+	if (range == freeRanges.end())
+		return false;
+
+	offset = range->first;
+	uint32_t remaining = range->second - count;
+	freeRanges.erase(range);
+	if (remaining > 0)
+		freeRanges[offset + count] = remaining;
+
+	return true;
+}
+
+/**
+ * @brief Gives count elements starting at offset back to a free list, merging them with adjacent free ranges.
+ */
+void GPUGeometryPool::freeRange(std::map<uint32_t, uint32_t>& freeRanges, uint32_t offset, uint32_t count)
+{
+	auto next = freeRanges.lower_bound(offset);
+	if (next != freeRanges.begin())
+	{
+		auto previous = std::prev(next);
+		if (previous->first + previous->second == offset)
+		{
+			offset = previous->first;
+			count += previous->second;
+			freeRanges.erase(previous);
+		}
+	}
+	if (next != freeRanges.end() && offset + count == next->first)
+	{
+		count += next->second;
+		freeRanges.erase(next);
+	}
+	freeRanges[offset] = count;
+}
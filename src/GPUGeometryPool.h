@@ -0,0 +1,115 @@
+#ifndef GPUGEOMETRYPOOL_H
+#define GPUGEOMETRYPOOL_H
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <vector>
+#include <vulkan/vulkan.h>
+
+#include "glm_includes.h"
+#include "GPUMemoryAllocator.h"
+
+class GPUEngine;
+
+/**
+ * @brief Sub-allocates the vertex and index data of every GPUMesh out of a few large buffers.
+ *
+ * Each block of the pool holds one device-local buffer per vertex attribute and one index buffer.
+ * A mesh is given a Range of vertices and a range of indices within a single block, which are
+ * placed with first-fit free lists, and is drawn using the range's first index and vertex offset
+ * instead of buffers of its own. All meshes in a block can therefore be drawn after binding its
+ * buffers once, and their indirect draw commands can be issued together with a single
+ * vkCmdDrawIndexedIndirect() call.
+ *
+ * New blocks are only created when no existing block has room for a mesh; meshes too large for a
+ * block of the default size get a block sized to fit them. Blocks are kept until the pool is
+ * destroyed. Data is uploaded through GPUEngine::transferToBuffer(), so uploads join any open
+ * upload batch. Freed ranges are only reused once every frame in flight which may draw from them
+ * has completed; the GPUEngine calls releaseRetiredRanges() after each frame.
+ *
+ * Not thread-safe; meshes should not be loaded or destroyed while draws are being recorded.
+ *
+ * Intended to be created and owned by a GPUEngine instance.
+ */
+class GPUGeometryPool
+{
+public:
+	static constexpr uint32_t defaultBlockVertexCount = 1024 * 1024;
+	static constexpr uint32_t defaultBlockIndexCount = 4 * 1024 * 1024;
+	static constexpr uint32_t invalidBlock = UINT32_MAX;
+
+	/**
+	 * @brief A range of vertices and a range of indices within one block of a GPUGeometryPool.
+	 *
+	 * A Range must be given back to the GPUGeometryPool that created it through free().
+	 */
+	struct Range
+	{
+		uint32_t block = invalidBlock;
+		uint32_t vertexOffset = 0;
+		uint32_t vertexCount = 0;
+		uint32_t firstIndex = 0;
+		uint32_t indexCount = 0;
+	};
+
+	// constructors and destructor
+	GPUGeometryPool(GPUEngine* engine);
+	GPUGeometryPool(GPUGeometryPool& other) = delete;
+	GPUGeometryPool(GPUGeometryPool&& other) = delete;
+	GPUGeometryPool& operator=(GPUGeometryPool& other) = delete;
+	~GPUGeometryPool();
+
+	// public functionality
+	bool allocate(uint32_t vertexCount, uint32_t indexCount, Range& range);
+	void free(Range& range);
+	void releaseRetiredRanges(bool all);
+	void uploadPositions(const Range& range, const glm::vec3* positions);
+	void uploadNormals(const Range& range, const glm::vec3* normals);
+	void uploadIndices(const Range& range, const uint32_t* indices);
+
+	// public getters
+	VkBuffer getPositionBuffer(uint32_t block) { return mBlocks[block]->positionBuffer; }
+	VkBuffer getNormalBuffer(uint32_t block) { return mBlocks[block]->normalBuffer; }
+	VkBuffer getIndexBuffer(uint32_t block) { return mBlocks[block]->indexBuffer; }
+	size_t getBlockCount() { return mBlocks.size(); }
+
+private:
+	struct Block
+	{
+		uint32_t vertexCapacity = 0;
+		uint32_t indexCapacity = 0;
+
+		// maps offset to count of each free range, in vertices and in indices
+		std::map<uint32_t, uint32_t> freeVertexRanges;
+		std::map<uint32_t, uint32_t> freeIndexRanges;
+
+		// Vulkan handles owned by the block
+		VkBuffer positionBuffer = VK_NULL_HANDLE;
+		GPUMemoryAllocator::Allocation positionMemory;
+		VkBuffer normalBuffer = VK_NULL_HANDLE;
+		GPUMemoryAllocator::Allocation normalMemory;
+		VkBuffer indexBuffer = VK_NULL_HANDLE;
+		GPUMemoryAllocator::Allocation indexMemory;
+	};
+
+	// a freed range, which may still be drawn from by frames in flight
+	struct RetiredRange
+	{
+		Range range;
+		uint32_t framesRemaining;
+	};
+
+	// private helper functions
+	Block* createBlock(uint32_t vertexCapacity, uint32_t indexCapacity);
+	void destroyBlock(Block* block);
+	static bool allocateRange(std::map<uint32_t, uint32_t>& freeRanges, uint32_t count, uint32_t& offset);
+	static void freeRange(std::map<uint32_t, uint32_t>& freeRanges, uint32_t offset, uint32_t count);
+
+	// private member variables
+	GPUEngine* mEngine;
+	std::vector<std::unique_ptr<Block>> mBlocks;
+	std::vector<RetiredRange> mRetiredRanges;
+};
+
+#endif
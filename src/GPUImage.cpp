@@ -74,7 +74,64 @@ GPUProcess::OperationType GPUImage::getOperationType()
 	return OP_TYPE_NOOP;
 }
 
-void GPUImage::allocateImage()
+/**
+ * @brief Returns true if this GPUImage may share memory with other transient images.
+ * 
+ * Only screen-sized, optimally tiled images which are not lazily allocated are aliased,
+ * since their memory is acquired and freed along with the rest of the frame resources.
+ */
+bool GPUImage::isTransient()
+{
+	return mTransient && mUseScreenSize && !mLazilyAllocated && mImageTiling == VK_IMAGE_TILING_OPTIMAL;
+}
+
+bool GPUImage::getTransientMemoryRequirements(VkMemoryRequirements& requirements)
+{
+	if (!mAwaitingMemory)
+		return false;
+
+	vkGetImageMemoryRequirements(mEngine->getDevice(), mImage, &requirements);
+	return true;
+}
+
+bool GPUImage::bindTransientMemory(VkDeviceMemory memory, VkDeviceSize offset)
+{
+	if (!mAwaitingMemory)
+		return true;
+
+	if (memory == VK_NULL_HANDLE)
+	{
+		// no memory to share; allocate memory for this image alone
+		VkMemoryRequirements memoryRequirements;
+		vkGetImageMemoryRequirements(mEngine->getDevice(), mImage, &memoryRequirements);
+		if (!mEngine->getMemoryAllocator()->allocate(memoryRequirements, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, false, mImageMemory))
+			return false;
+		mOwnsMemory = true;
+		memory = mImageMemory.memory;
+		offset = mImageMemory.offset;
+	}
+
+	if (vkBindImageMemory(mEngine->getDevice(), mImage, memory, offset) != VK_SUCCESS)
+	{
+		// give back memory of its own, so that the image can still be bound to other memory
+		if (mOwnsMemory)
+			mEngine->getMemoryAllocator()->free(mImageMemory);
+		mOwnsMemory = false;
+		return false;
+	}
+	mAwaitingMemory = false;
+
+	createImageView();
+	return true;
+}
+
+/**
+ * @brief Creates the image, and unless it is transient, allocates and binds its memory and creates its view.
+ * 
+ * @return true The image was created, and is either ready for use or awaiting transient memory.
+ * @return false No memory could be allocated or bound; the image has been destroyed again.
+ */
+bool GPUImage::allocateImage()
 {
 	if (mUseScreenSize)
 	{
@@ -83,52 +140,85 @@ void GPUImage::allocateImage()
 		mHeight = extent.height * mScreenSizeMultiplier;
 	}
 
-	VkDevice device = mEngine->getDevice();
-
-	// choose aspect flags
-	VkImageAspectFlags aspectMask = 0;
-	if (mUsage & VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT)
-		aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT;
-	if (mUsage & VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT)
-		aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	createImage();
 
-	// create image
+	// transient images are bound to memory by the dependency graph
+	if (isTransient())
 	{
-		VkImageCreateInfo createInfo = {};
-		createInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
-		createInfo.pNext = nullptr;
-		createInfo.flags = 0;
-		createInfo.imageType = VK_IMAGE_TYPE_2D;
-		createInfo.format = mFormat;
-		createInfo.extent.width = mWidth;
-		createInfo.extent.height = mHeight;
-		createInfo.extent.depth = 1;
-		createInfo.mipLevels = 1;
-		createInfo.arrayLayers = 1;
-		createInfo.samples = VK_SAMPLE_COUNT_1_BIT;
-		createInfo.tiling = mImageTiling;
-		createInfo.usage = mUsage;
-		createInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
-		createInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-
-		vkCreateImage(device, &createInfo, nullptr, &mImage);
+		mAwaitingMemory = true;
+		return true;
 	}
 
 	// allocate memory
 	{
+		VkDevice device = mEngine->getDevice();
 		VkMemoryRequirements memoryRequirements;
 		vkGetImageMemoryRequirements(device, mImage, &memoryRequirements);
 
-		VkMemoryAllocateInfo allocateInfo = {};
-		allocateInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-		allocateInfo.pNext = nullptr;
-		allocateInfo.memoryTypeIndex = mEngine->findMemoryType(memoryRequirements.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
-		allocateInfo.allocationSize = memoryRequirements.size;
-		vkAllocateMemory(device, &allocateInfo, nullptr, &mImageMemory);
+		bool linearResource = (mImageTiling == VK_IMAGE_TILING_LINEAR);
+		auto allocator = mEngine->getMemoryAllocator();
 
-		vkBindImageMemory(device, mImage, mImageMemory, 0);
+		// fall back to regular device-local memory if there is no lazily allocated memory type
+		bool allocated = mLazilyAllocated && allocator->allocate(memoryRequirements,
+			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT, linearResource, mImageMemory);
+		if (!allocated)
+			allocated = allocator->allocate(memoryRequirements, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, linearResource, mImageMemory);
+		if (!allocated)
+		{
+			freeImage();
+			return false;
+		}
+		mOwnsMemory = true;
+
+		if (vkBindImageMemory(device, mImage, mImageMemory.memory, mImageMemory.offset) != VK_SUCCESS)
+		{
+			freeImage();
+			return false;
+		}
 	}
 
+	createImageView();
+	return true;
+}
+
+void GPUImage::createImage()
+{
+	VkImageCreateInfo createInfo = {};
+	createInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+	createInfo.pNext = nullptr;
+	createInfo.flags = 0;
+	createInfo.imageType = VK_IMAGE_TYPE_2D;
+	createInfo.format = mFormat;
+	createInfo.extent.width = mWidth;
+	createInfo.extent.height = mHeight;
+	createInfo.extent.depth = 1;
+	createInfo.mipLevels = 1;
+	createInfo.arrayLayers = 1;
+	createInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+	createInfo.tiling = mImageTiling;
+	createInfo.usage = mUsage;
+	if (mLazilyAllocated)
+		createInfo.usage |= VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT;
+	createInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+	createInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+	vkCreateImage(mEngine->getDevice(), &createInfo, nullptr, &mImage);
+
+	// the format and extent are known before memory is bound
+	VkExtent2D extent = { mWidth, mHeight };
+	mPRImageView->setExtent(extent);
+	mPRImageView->setFormat(mFormat);
+}
+
+void GPUImage::createImageView()
+{
+	// choose aspect flags
+	VkImageAspectFlags aspectMask = 0;
+	if (mUsage & VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT)
+		aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT;
+	if (mUsage & VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT)
+		aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+
 	// create image view
 	{
 		VkImageViewCreateInfo createInfo = {};
@@ -148,14 +238,11 @@ void GPUImage::allocateImage()
 		createInfo.subresourceRange.layerCount = 1;
 		createInfo.subresourceRange.levelCount = 1;
 
-		vkCreateImageView(device, &createInfo, nullptr, &mImageView);
+		vkCreateImageView(mEngine->getDevice(), &createInfo, nullptr, &mImageView);
 	}
 
 	// set passable resource values
-	VkExtent2D extent = { mWidth, mHeight };
 	mPRImageView->setPossibleValues({mImageView});
-	mPRImageView->setExtent(extent);
-	mPRImageView->setFormat(mFormat);
 }
 
 void GPUImage::chooseImageFormat()
@@ -206,5 +293,11 @@ void GPUImage::freeImage()
 
 	vkDestroyImageView(device, mImageView, nullptr);
 	vkDestroyImage(device, mImage, nullptr);
-	vkFreeMemory(device, mImageMemory, nullptr);
+	if (mOwnsMemory)
+		mEngine->getMemoryAllocator()->free(mImageMemory);
+
+	mImageView = VK_NULL_HANDLE;
+	mImage = VK_NULL_HANDLE;
+	mAwaitingMemory = false;
+	mOwnsMemory = false;
 }
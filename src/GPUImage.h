@@ -2,6 +2,7 @@
 #define GPUIMAGE_H
 
 #include "GPUProcess.h"
+#include "GPUMemoryAllocator.h"
 #include <memory>
 
 /**
@@ -12,6 +13,12 @@
  * to do so. A GPUImage can be configured to scale with the GPUEngine's surface;
  * in this case, its Vulkan resources are freed upon cleanupFrameResources()
  * and acquired upon acquireFrameResources().
+ * 
+ * A screen-sized GPUImage can be marked as transient if its contents are only needed while
+ * it is in use within a frame; the GPUDependencyGraph may then place it in the same memory
+ * as other transient images which are never in use at the same time. An image which is only
+ * used as an attachment within a single render pass, and neither loaded nor stored, can instead
+ * be lazily allocated, so that its memory need not be backed at all on tiled GPUs.
  */
 class GPUImage : public GPUProcess
 {
@@ -31,15 +38,24 @@ public:
 	 */
 	const PassableImageView* getImageViewPR() { return mPRImageView.get(); }
 
+	// configuration; must be set before the GPUDependencyGraph is built
+	void setTransient(bool transient) { mTransient = transient; }
+	void setLazilyAllocated(bool lazilyAllocated) { mLazilyAllocated = lazilyAllocated; }
+
 	// virtual functions inherited from GPUProcess
 	virtual void acquireLongtermResources();
 	virtual void acquireFrameResources();
 	virtual void cleanupFrameResources();
 	virtual OperationType getOperationType();
+	virtual bool isTransient();
+	virtual bool getTransientMemoryRequirements(VkMemoryRequirements& requirements);
+	virtual bool bindTransientMemory(VkDeviceMemory memory, VkDeviceSize offset);
 
 private:
 	// private member functions
-	void allocateImage();
+	bool allocateImage();
+	void createImage();
+	void createImageView();
 	void chooseImageFormat();
 	void freeImage();
 	std::vector<VkFormat> getFormatCandidates(VkFormatFeatureFlags requiredFeatures);
@@ -52,11 +68,15 @@ private:
 	uint32_t mWidth = 1;
 	uint32_t mHeight = 1;
 	bool mUseScreenSize = false;
+	bool mTransient = false;
+	bool mLazilyAllocated = false;
+	bool mAwaitingMemory = false;
+	bool mOwnsMemory = false;
 
 	// owned vulkan handles
 	VkImage mImage = VK_NULL_HANDLE;
 	VkImageView mImageView = VK_NULL_HANDLE;
-	VkDeviceMemory mImageMemory = VK_NULL_HANDLE;
+	GPUMemoryAllocator::Allocation mImageMemory;
 	VkFormat mFormat = VK_FORMAT_MAX_ENUM;
 	VkImageUsageFlags mUsage;
 	VkFormatFeatureFlags mRequiredFeatures = 0;
@@ -0,0 +1,350 @@
+#include "GPUMemoryAllocator.h"
+
+#include <algorithm>
+
+#include "GPUEngine.h"
+
+GPUMemoryAllocator::GPUMemoryAllocator(GPUEngine* engine)
+{
+	mEngine = engine;
+	mDevice = engine->getDevice();
+	vkGetPhysicalDeviceMemoryProperties(engine->getPhysicalDevice(), &mMemoryProperties);
+	mNonCoherentAtomSize = std::max<VkDeviceSize>(engine->getPhysicalDeviceLimits()->nonCoherentAtomSize, 1);
+
+	// one pool for every combination of memory type, resource tiling and strategy
+	mPools.resize(getPoolIndex(mMemoryProperties.memoryTypeCount, false, STRATEGY_FREE_LIST));
+	for (uint32_t type = 0; type < mMemoryProperties.memoryTypeCount; type++)
+		for (uint32_t strategy = 0; strategy < STRATEGY_ENUM_LENGTH; strategy++)
+			for (bool linear : { false, true })
+			{
+				auto& pool = mPools[getPoolIndex(type, linear, (Strategy)strategy)];
+				pool.memoryType = type;
+				pool.strategy = (Strategy)strategy;
+			}
+}
+
+GPUMemoryAllocator::~GPUMemoryAllocator()
+{
+	for (auto& pool : mPools)
+	{
+		for (auto& block : pool.blocks)
+			destroyBlock(block.get());
+		pool.blocks.clear();
+	}
+}
+
+/**
+ * @brief Sub-allocates memory that satisfies the given requirements and properties.
+ *
+ * Allocations larger than half of the preferred block size for their memory type get a block
+ * of their own, so that they do not leave large unusable holes in shared blocks.
+ *
+ * @param requirements Memory requirements, as returned by vkGetBufferMemoryRequirements() or vkGetImageMemoryRequirements().
+ * @param properties Flags describing the required properties for the memory allocated.
+ * @param linearResource True for buffers and linearly tiled images; false for optimally tiled images.
+ * @param allocation Reference in which the resulting allocation will be placed.
+ * @param strategy How the allocation is to be placed within a block.
+ * @return true Memory was allocated successfully.
+ * @return false No suitable memory type exists, or the device is out of memory.
+ */
+bool GPUMemoryAllocator::allocate(const VkMemoryRequirements& requirements, VkMemoryPropertyFlags properties, bool linearResource,
+								Allocation& allocation, Strategy strategy)
+{
+	uint32_t memoryType = mEngine->findMemoryType(requirements.memoryTypeBits, properties);
+	if (memoryType == UINT32_MAX)
+		return false;
+
+	// non-coherent mapped ranges must be flushed in multiples of nonCoherentAtomSize,
+	// so keep such allocations from sharing an atom
+	VkDeviceSize alignment = std::max<VkDeviceSize>(requirements.alignment, 1);
+	VkDeviceSize size = requirements.size;
+	VkMemoryPropertyFlags typeFlags = mMemoryProperties.memoryTypes[memoryType].propertyFlags;
+	if ((typeFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) && !(typeFlags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT))
+	{
+		alignment = std::max(alignment, mNonCoherentAtomSize);
+		size = alignUp(size, mNonCoherentAtomSize);
+	}
+
+	std::lock_guard<std::mutex> lock(mMutex);
+
+	uint32_t poolIndex = getPoolIndex(memoryType, linearResource, strategy);
+	auto& pool = mPools[poolIndex];
+	VkDeviceSize blockSize = getPreferredBlockSize(memoryType);
+
+	// large allocations get a dedicated block
+	if (size > blockSize / 2)
+	{
+		Block* block = createBlock(poolIndex, size, true);
+		if (block == nullptr)
+			return false;
+		return allocateFromBlock(block, strategy, size, alignment, allocation);
+	}
+
+	// try existing blocks first
+	for (auto& block : pool.blocks)
+		if (!block->dedicated && allocateFromBlock(block.get(), strategy, size, alignment, allocation))
+			return true;
+
+	// then create a new block; halve the block size if the heap cannot fit a full one
+	while (blockSize >= size && blockSize >= minimumBlockSize)
+	{
+		Block* block = createBlock(poolIndex, blockSize, false);
+		if (block != nullptr)
+			return allocateFromBlock(block, strategy, size, alignment, allocation);
+		blockSize /= 2;
+	}
+
+	// as a last resort, try to fit just this allocation
+	Block* block = createBlock(poolIndex, size, true);
+	if (block == nullptr)
+		return false;
+	return allocateFromBlock(block, strategy, size, alignment, allocation);
+}
+
+/**
+ * @brief Returns an allocation's memory to the block it came from.
+ *
+ * Freeing an empty allocation does nothing. After free() returns, allocation is reset
+ * to an empty state. Blocks which become empty are released to the driver, except
+ * for the last block of each pool, which is kept around to avoid thrashing.
+ *
+ * @param allocation The allocation to free.
+ */
+void GPUMemoryAllocator::free(Allocation& allocation)
+{
+	if (allocation.block == nullptr)
+		return;
+
+	std::lock_guard<std::mutex> lock(mMutex);
+
+	Block* block = (Block*)allocation.block;
+	auto& pool = mPools[block->poolIndex];
+
+	block->usedBytes -= allocation.size;
+	block->allocationCount--;
+
+	if (pool.strategy == STRATEGY_LINEAR)
+	{
+		// linear blocks are only reclaimed as a whole
+		if (block->allocationCount == 0)
+			block->linearOffset = 0;
+	}
+	else
+	{
+		// insert the range back into the free list, merging it with its neighbours
+		VkDeviceSize offset = allocation.offset;
+		VkDeviceSize size = allocation.size;
+
+		auto next = block->freeRanges.lower_bound(offset);
+		if (next != block->freeRanges.begin())
+		{
+			auto previous = std::prev(next);
+			if (previous->first + previous->second == offset)
+			{
+				offset = previous->first;
+				size += previous->second;
+				block->freeRanges.erase(previous);
+			}
+		}
+		if (next != block->freeRanges.end() && offset + size == next->first)
+		{
+			size += next->second;
+			block->freeRanges.erase(next);
+		}
+		block->freeRanges[offset] = size;
+	}
+
+	// release empty blocks
+	if (block->allocationCount == 0)
+	{
+		size_t emptyBlocks = 0;
+		for (auto& other : pool.blocks)
+			if (other->allocationCount == 0 && !other->dedicated)
+				emptyBlocks++;
+
+		if (block->dedicated || emptyBlocks > 1)
+		{
+			destroyBlock(block);
+			pool.blocks.erase(std::find_if(pool.blocks.begin(), pool.blocks.end(),
+				[block](const std::unique_ptr<Block>& other) { return other.get() == block; }));
+		}
+	}
+
+	allocation = Allocation();
+}
+
+/**
+ * @brief Returns usage statistics for all memory types combined.
+ *
+ * @return GPUMemoryAllocator::Stats
+ */
+GPUMemoryAllocator::Stats GPUMemoryAllocator::getStats()
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+
+	Stats stats;
+	for (auto& pool : mPools)
+		accumulateStats(stats, pool);
+
+	if (stats.freeBytes > 0)
+		stats.fragmentation = 1.0f - (float)stats.largestFreeRange / (float)stats.freeBytes;
+	return stats;
+}
+
+/**
+ * @brief Returns usage statistics for a single memory type.
+ *
+ * @param memoryType Index of the memory type, as returned by GPUEngine::findMemoryType().
+ * @return GPUMemoryAllocator::Stats
+ */
+GPUMemoryAllocator::Stats GPUMemoryAllocator::getStats(uint32_t memoryType)
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+
+	Stats stats;
+	for (auto& pool : mPools)
+		if (pool.memoryType == memoryType)
+			accumulateStats(stats, pool);
+
+	if (stats.freeBytes > 0)
+		stats.fragmentation = 1.0f - (float)stats.largestFreeRange / (float)stats.freeBytes;
+	return stats;
+}
+
+/**
+ * @brief Chooses a block size for a memory type, based on the size of its heap.
+ *
+ * Small heaps (such as the 256MB device-local, host-visible heap on many discrete GPUs)
+ * get smaller blocks, so that a single block cannot starve the heap.
+ */
+VkDeviceSize GPUMemoryAllocator::getPreferredBlockSize(uint32_t memoryType)
+{
+	uint32_t heapIndex = mMemoryProperties.memoryTypes[memoryType].heapIndex;
+	VkDeviceSize heapSize = mMemoryProperties.memoryHeaps[heapIndex].size;
+
+	VkDeviceSize blockSize = std::min(defaultBlockSize, heapSize / 8);
+	return std::max(blockSize, minimumBlockSize);
+}
+
+GPUMemoryAllocator::Block* GPUMemoryAllocator::createBlock(uint32_t poolIndex, VkDeviceSize size, bool dedicated)
+{
+	auto& pool = mPools[poolIndex];
+
+	VkMemoryAllocateInfo allocateInfo = {};
+	allocateInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+	allocateInfo.pNext = nullptr;
+	allocateInfo.allocationSize = size;
+	allocateInfo.memoryTypeIndex = pool.memoryType;
+
+	VkDeviceMemory memory;
+	if (vkAllocateMemory(mDevice, &allocateInfo, nullptr, &memory) != VK_SUCCESS)
+		return nullptr;
+
+	auto block = std::make_unique<Block>();
+	block->memory = memory;
+	block->size = size;
+	block->poolIndex = poolIndex;
+	block->dedicated = dedicated;
+	block->freeRanges[0] = size;
+
+	// host-visible blocks stay mapped for their whole lifetime
+	if (mMemoryProperties.memoryTypes[pool.memoryType].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT)
+	{
+		if (vkMapMemory(mDevice, memory, 0, VK_WHOLE_SIZE, 0, &block->mappedData) != VK_SUCCESS)
+		{
+			vkFreeMemory(mDevice, memory, nullptr);
+			return nullptr;
+		}
+	}
+
+	pool.blocks.push_back(std::move(block));
+	return pool.blocks.back().get();
+}
+
+void GPUMemoryAllocator::destroyBlock(Block* block)
+{
+	if (block->mappedData != nullptr)
+		vkUnmapMemory(mDevice, block->memory);
+	vkFreeMemory(mDevice, block->memory, nullptr);
+}
+
+/**
+ * @brief Attempts to place an allocation of a given size and alignment in a block.
+ *
+ * @return true The allocation was placed, and has been written to allocation.
+ * @return false The block does not have a large enough free range.
+ */
+bool GPUMemoryAllocator::allocateFromBlock(Block* block, Strategy strategy, VkDeviceSize size, VkDeviceSize alignment, Allocation& allocation)
+{
+	VkDeviceSize offset = 0;
+
+	if (strategy == STRATEGY_LINEAR)
+	{
+		offset = alignUp(block->linearOffset, alignment);
+		if (offset + size > block->size)
+			return false;
+		block->linearOffset = offset + size;
+	}
+	else
+	{
+		// first fit
+		auto range = block->freeRanges.begin();
+		for (; range != block->freeRanges.end(); range++)
+		{
+			offset = alignUp(range->first, alignment);
+			if (offset + size <= range->first + range->second)
+				break;
+		}
+		if (range == block->freeRanges.end())
+			return false;
+
+		// split the free range around the allocation
+		VkDeviceSize rangeOffset = range->first;
+		VkDeviceSize rangeEnd = range->first + range->second;
+		block->freeRanges.erase(range);
+		if (offset > rangeOffset)
+			block->freeRanges[rangeOffset] = offset - rangeOffset;
+		if (offset + size < rangeEnd)
+			block->freeRanges[offset + size] = rangeEnd - (offset + size);
+	}
+
+	block->usedBytes += size;
+	block->allocationCount++;
+
+	allocation.memory = block->memory;
+	allocation.offset = offset;
+	allocation.size = size;
+	allocation.mappedData = (block->mappedData != nullptr) ? (char*)block->mappedData + offset : nullptr;
+	allocation.memoryType = mPools[block->poolIndex].memoryType;
+	allocation.block = block;
+	return true;
+}
+
+void GPUMemoryAllocator::accumulateStats(Stats& stats, const Pool& pool)
+{
+	for (auto& block : pool.blocks)
+	{
+		stats.blockCount++;
+		if (block->dedicated)
+			stats.dedicatedBlockCount++;
+		stats.allocationCount += block->allocationCount;
+		stats.reservedBytes += block->size;
+		stats.usedBytes += block->usedBytes;
+
+		if (pool.strategy == STRATEGY_LINEAR)
+		{
+			// only the tail of a linear block can be reused before it empties
+			VkDeviceSize tail = block->size - block->linearOffset;
+			stats.freeBytes += tail;
+			stats.largestFreeRange = std::max(stats.largestFreeRange, tail);
+		}
+		else
+		{
+			for (auto& range : block->freeRanges)
+			{
+				stats.freeBytes += range.second;
+				stats.largestFreeRange = std::max(stats.largestFreeRange, range.second);
+			}
+		}
+	}
+}
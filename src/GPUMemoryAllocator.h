@@ -0,0 +1,144 @@
+#ifndef GPUMEMORYALLOCATOR_H
+#define GPUMEMORYALLOCATOR_H
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <vulkan/vulkan.h>
+
+class GPUEngine;
+
+/**
+ * @brief Sub-allocates device memory out of a small number of large VkDeviceMemory blocks.
+ *
+ * Every memory type gets its own set of block heaps, so that the number of vkAllocateMemory
+ * calls stays far below maxMemoryAllocationCount no matter how many buffers and images are
+ * created. Within a block, allocations are either placed with a first-fit free list (which
+ * supports freeing in any order) or bumped linearly (which is cheaper, but only reclaims
+ * memory once every allocation in the block has been freed).
+ *
+ * Resources with linear layouts (buffers and linearly tiled images) and resources with optimal
+ * layouts are never placed in the same block, which satisfies bufferImageGranularity without
+ * having to pad every allocation. Blocks in host-visible memory are mapped once, for their whole
+ * lifetime, and each Allocation carries a pointer into that mapping.
+ *
+ * Intended to be created and owned by a GPUEngine instance, after its logical device exists.
+ */
+class GPUMemoryAllocator
+{
+public:
+	/**
+	 * @brief Describes how an allocation is to be placed within a block.
+	 */
+	enum Strategy
+	{
+		STRATEGY_FREE_LIST,
+		STRATEGY_LINEAR,
+		STRATEGY_ENUM_LENGTH
+	};
+
+	/**
+	 * @brief A range of device memory handed out by a GPUMemoryAllocator.
+	 *
+	 * The memory handle and offset should be passed to vkBindBufferMemory() or vkBindImageMemory().
+	 * If the memory is host-visible, mappedData points to the start of the range; otherwise it is nullptr.
+	 * An Allocation must be given back to the GPUMemoryAllocator that created it through free().
+	 */
+	struct Allocation
+	{
+		VkDeviceMemory memory = VK_NULL_HANDLE;
+		VkDeviceSize offset = 0;
+		VkDeviceSize size = 0;
+		void* mappedData = nullptr;
+		uint32_t memoryType = UINT32_MAX;
+		void* block = nullptr;	// opaque pointer to the owning block
+	};
+
+	/**
+	 * @brief Usage statistics for one memory type, or for all memory types combined.
+	 *
+	 * fragmentation is 0 when all free memory in the counted blocks is contiguous, and approaches 1
+	 * as the free memory is split into many small ranges.
+	 */
+	struct Stats
+	{
+		uint32_t blockCount = 0;
+		uint32_t dedicatedBlockCount = 0;
+		uint32_t allocationCount = 0;
+		VkDeviceSize reservedBytes = 0;
+		VkDeviceSize usedBytes = 0;
+		VkDeviceSize freeBytes = 0;
+		VkDeviceSize largestFreeRange = 0;
+		float fragmentation = 0.0f;
+	};
+
+	static constexpr VkDeviceSize defaultBlockSize = 64 * 1024 * 1024;
+	static constexpr VkDeviceSize minimumBlockSize = 4 * 1024 * 1024;
+
+	// constructors and destructor
+	GPUMemoryAllocator(GPUEngine* engine);
+	GPUMemoryAllocator(GPUMemoryAllocator& other) = delete;
+	GPUMemoryAllocator(GPUMemoryAllocator&& other) = delete;
+	GPUMemoryAllocator& operator=(GPUMemoryAllocator& other) = delete;
+	~GPUMemoryAllocator();
+
+	// public functionality
+	bool allocate(const VkMemoryRequirements& requirements, VkMemoryPropertyFlags properties, bool linearResource,
+				Allocation& allocation, Strategy strategy = STRATEGY_FREE_LIST);
+	void free(Allocation& allocation);
+	Stats getStats();
+	Stats getStats(uint32_t memoryType);
+
+private:
+	struct Block
+	{
+		VkDeviceMemory memory = VK_NULL_HANDLE;
+		VkDeviceSize size = 0;
+		void* mappedData = nullptr;
+		uint32_t poolIndex = 0;
+		bool dedicated = false;
+
+		// used by STRATEGY_FREE_LIST blocks; maps offset to size of each free range
+		std::map<VkDeviceSize, VkDeviceSize> freeRanges;
+		// used by STRATEGY_LINEAR blocks
+		VkDeviceSize linearOffset = 0;
+
+		VkDeviceSize usedBytes = 0;
+		uint32_t allocationCount = 0;
+	};
+
+	struct Pool
+	{
+		uint32_t memoryType = 0;
+		Strategy strategy = STRATEGY_FREE_LIST;
+		std::vector<std::unique_ptr<Block>> blocks;
+	};
+
+	// private helper functions
+	static inline uint32_t getPoolIndex(uint32_t memoryType, bool linearResource, Strategy strategy)
+	{
+		return (memoryType * 2 + (linearResource ? 1 : 0)) * STRATEGY_ENUM_LENGTH + strategy;
+	}
+	static inline VkDeviceSize alignUp(VkDeviceSize value, VkDeviceSize alignment)
+	{
+		return (alignment > 1) ? ((value + alignment - 1) / alignment) * alignment : value;
+	}
+
+	VkDeviceSize getPreferredBlockSize(uint32_t memoryType);
+	Block* createBlock(uint32_t poolIndex, VkDeviceSize size, bool dedicated);
+	void destroyBlock(Block* block);
+	bool allocateFromBlock(Block* block, Strategy strategy, VkDeviceSize size, VkDeviceSize alignment, Allocation& allocation);
+	void accumulateStats(Stats& stats, const Pool& pool);
+
+	// private member variables
+	GPUEngine* mEngine;
+	VkDevice mDevice;
+	VkPhysicalDeviceMemoryProperties mMemoryProperties;
+	VkDeviceSize mNonCoherentAtomSize = 1;
+	std::vector<Pool> mPools;
+	std::mutex mMutex;
+};
+
+#endif
@@ -11,8 +11,8 @@
 /**
  * @brief Contains several zero-value VkDeviceSizes. Used when
  * drawing, because vkBindVertexBuffers() requires an array of
- * offsets, but due to the engine design, all of these offsets
- * are always zero.
+ * offsets, but since meshes are located through the vertex offset
+ * of each draw, all of these offsets are always zero.
  */
 const VkDeviceSize GPUMesh::zerosBuffer[16] = {0};
 
@@ -65,22 +65,17 @@ GPUMesh::~GPUMesh()
 	VkDevice device = mEngine->getDevice();
 
 	vkDestroyFence(device, mFence, nullptr);
-	vkFreeMemory(device, mPositionMemory, nullptr);
-	vkDestroyBuffer(device, mPositionBuffer, nullptr);
-	vkFreeMemory(device, mIndexMemory, nullptr);
-	vkDestroyBuffer(device, mIndexBuffer, nullptr);
-
-	if(mNormalBuffer != VK_NULL_HANDLE)
-	{
-		vkFreeMemory(device, mNormalMemory, nullptr);
-		vkDestroyBuffer(device, mNormalBuffer, nullptr);
-	}
+	mEngine->getGeometryPool()->free(mGeometry);
 }
 
 /**
  * @brief Load the data associated with this mesh and prepare it for rendering.
  * 
  * Mesh data is loaded from the file that was specified when this GPUMesh was created.
+ * All of the mesh's data is uploaded to the geometry pool in a single batch; if load() is called inside
+ * an upload batch, such as when loading several meshes at once, they join that batch.
+ * The upload is not waited on, but getUploadTicket() can be used to do so. If the mesh is an
+ * occluder, its positions and indices are also kept.
  */
 void GPUMesh::load()
 {
@@ -88,23 +83,33 @@ void GPUMesh::load()
 
 	ensureFenceExists();
 	loadFileData(data);
+	computeBounds(data);
+	if (mOccluder)
+	{
+		mOccluderMesh.positions = data.position;
+		mOccluderMesh.indices = data.index;
+	}
+	mEngine->beginUploadBatch();
 	createBuffers(data);
-	mNumIndices = data.index.size();
+	mUploadTicket = mEngine->endUploadBatch();
 }
 
 /**
- * @brief Record draw commands for this mesh into a given VkCommandBuffer.
+ * @brief Binds the geometry pool's vertex buffers for the given attribute types, and its index buffer.
  * 
- * The associated buffers are bound and then a draw call is recorded.
- * It is assumed that commandBuffer is in a state where draw commands can be successfully recorded to it.
- * It is also assumed that all relevant descriptor sets have already been bound, I.E. through the use
- * of the engine's GPUMeshWrangler.
+ * The buffers are those of the pool block holding this mesh, and are shared by every other mesh in
+ * that block, so they only need to be bound again when drawing a mesh with a different geometry block.
+ * Does nothing if the mesh has not been loaded successfully.
  * 
- * @param commandBuffer The VkCommandBuffer in which to record draw commands.
- * @param attachmentTypes An array listing the attribute types which must be bound, in the order they must be bound.
+ * @param commandBuffer The VkCommandBuffer in which to record the bind commands.
+ * @param attributeTypes An array listing the attribute types which must be bound, in the order they must be bound.
  */
-void GPUMesh::draw(VkCommandBuffer commandBuffer, std::vector<AttributeType>& attributeTypes)
+void GPUMesh::bindBuffers(VkCommandBuffer commandBuffer, std::vector<AttributeType>& attributeTypes)
 {
+	if (mGeometry.block == GPUGeometryPool::invalidBlock)
+		return;
+
+	GPUGeometryPool* pool = mEngine->getGeometryPool();
 	size_t numAttribs = attributeTypes.size();
 	std::vector<VkBuffer> attributeBuffers(numAttribs);
 	for(size_t i=0; i<numAttribs; i++)
@@ -112,10 +117,10 @@ void GPUMesh::draw(VkCommandBuffer commandBuffer, std::vector<AttributeType>& at
 		switch(attributeTypes[i])
 		{
 		case MESH_ATTRIBUTE_POSITION:
-			attributeBuffers[i] = mPositionBuffer;
+			attributeBuffers[i] = pool->getPositionBuffer(mGeometry.block);
 			break;
 		case MESH_ATTRIBUTE_NORMAL:
-			attributeBuffers[i] = mNormalBuffer;
+			attributeBuffers[i] = pool->getNormalBuffer(mGeometry.block);
 			break;
 		default:
 			attributeBuffers[i] = VK_NULL_HANDLE;
@@ -124,8 +129,27 @@ void GPUMesh::draw(VkCommandBuffer commandBuffer, std::vector<AttributeType>& at
 	}
 
 	vkCmdBindVertexBuffers(commandBuffer, 0, numAttribs, attributeBuffers.data(), zerosBuffer);
-	vkCmdBindIndexBuffer(commandBuffer, mIndexBuffer, 0, VK_INDEX_TYPE_UINT32);
-	vkCmdDrawIndexed(commandBuffer, mNumIndices, 1, 0, 0, 0);
+	vkCmdBindIndexBuffer(commandBuffer, pool->getIndexBuffer(mGeometry.block), 0, VK_INDEX_TYPE_UINT32);
+}
+
+/**
+ * @brief Record draw commands for this mesh into a given VkCommandBuffer.
+ * 
+ * It is assumed that commandBuffer is in a state where draw commands can be successfully recorded to it,
+ * and that this mesh's buffers have been bound through bindBuffers(), or through that of another mesh
+ * in the same geometry block. It is also assumed that all relevant descriptor sets have already been bound,
+ * I.E. through the use of the engine's GPUMeshWrangler.
+ * 
+ * @param commandBuffer The VkCommandBuffer in which to record draw commands.
+ * @param instanceCount Number of instances to draw with a single instanced draw call.
+ * @param firstInstance Instance index of the first instance, used by shaders to look up its transform.
+ */
+void GPUMesh::draw(VkCommandBuffer commandBuffer, uint32_t instanceCount, uint32_t firstInstance)
+{
+	if (mGeometry.block == GPUGeometryPool::invalidBlock)
+		return;
+
+	vkCmdDrawIndexed(commandBuffer, mGeometry.indexCount, instanceCount, mGeometry.firstIndex, mGeometry.vertexOffset, firstInstance);
 }
 
 aiMesh* findMesh(const aiScene* scene, aiNode* node)
@@ -187,35 +211,60 @@ bool GPUMesh::loadFileData(DataVectors& data)
 	return true;
 }
 
+/**
+ * @brief Allocates a range of the engine's geometry pool for the mesh data, and uploads it there.
+ * 
+ * Any range from a previous load() is given back first. If the mesh has no normals, those of
+ * its range are left undefined.
+ * 
+ * @return true The data was placed in the geometry pool.
+ * @return false The mesh has no vertices or indices, or the pool could not make room for them.
+ */
 bool GPUMesh::createBuffers(DataVectors& data)
 {
-	VkDevice device = mEngine->getDevice();
-	auto posSize = sizeof(data.position[0]) * data.position.size();
-	auto indexSize = sizeof(data.index[0]) * data.index.size();
+	GPUGeometryPool* pool = mEngine->getGeometryPool();
+	pool->free(mGeometry);
+	if (!pool->allocate(data.position.size(), data.index.size(), mGeometry))
+		return false;
+
+	pool->uploadPositions(mGeometry, data.position.data());
+	if (data.normal.size() == data.position.size())
+		pool->uploadNormals(mGeometry, data.normal.data());
+	pool->uploadIndices(mGeometry, data.index.data());
 
-	auto normalSize = data.normal.size();
-	if(normalSize > 0)
-		normalSize *= sizeof(data.normal[0]);
+	return true;
+}
 
-	// create & fill position buffer
-	mEngine->createBuffer(posSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
-		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, mPositionBuffer, mPositionMemory);
-	mEngine->transferToBuffer(mPositionBuffer, data.position.data(), posSize, 0);
+/**
+ * @brief Computes the axis-aligned bounding box and bounding sphere of the mesh's vertex positions.
+ * 
+ * The sphere is centered on the bounding box, which is not the tightest possible sphere, but
+ * is cheap to compute and close enough for culling.
+ * 
+ * @param data Mesh data containing the vertex positions.
+ */
+void GPUMesh::computeBounds(DataVectors& data)
+{
+	mBounds = Bounds();
+	if (data.position.empty())
+		return;
 
-	// create & fill normal buffer
-	if(normalSize > 0)
+	mBounds.min = data.position[0];
+	mBounds.max = data.position[0];
+	for (auto& position : data.position)
 	{
-		mEngine->createBuffer(normalSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
-			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, mNormalBuffer, mNormalMemory);
-		mEngine->transferToBuffer(mNormalBuffer, data.normal.data(), normalSize, 0);
+		mBounds.min = glm::min(mBounds.min, position);
+		mBounds.max = glm::max(mBounds.max, position);
 	}
 
-	// create & fill index buffer
-	mEngine->createBuffer(indexSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
-		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, mIndexBuffer, mIndexMemory);
-	mEngine->transferToBuffer(mIndexBuffer, data.index.data(), indexSize, 0);
-
-	return true;
+	mBounds.center = (mBounds.min + mBounds.max) * 0.5f;
+	float radiusSquared = 0.0f;
+	for (auto& position : data.position)
+	{
+		glm::vec3 offset = position - mBounds.center;
+		radiusSquared = glm::max(radiusSquared, glm::dot(offset, offset));
+	}
+	mBounds.radius = glm::sqrt(radiusSquared);
 }
 
 void GPUMesh::ensureFenceExists()
@@ -6,6 +6,8 @@
 #include <vector>
 
 #include "glm_includes.h"
+#include "GPUGeometryPool.h"
+#include "GPUOccluderRasterizer.h"
 
 class GPUEngine;
 
@@ -17,6 +19,14 @@ class GPUEngine;
  * While a mesh contains vertex and index data, a mesh instance contains a reference
  * to a mesh and one or more parameters used to render that mesh. There can be multiple
  * instances of a single mesh, and a mesh does not track its instances in any way.
+ * 
+ * Vertex and index data are not kept in buffers of the mesh's own, but in a range of the
+ * GPUEngine's GPUGeometryPool. Draws of meshes in the same pool block only need its buffers to be
+ * bound once, through bindBuffers(), after which draw() uses the mesh's first index and vertex offset.
+ * 
+ * A mesh can also be marked as an occluder before it is loaded, in which case its triangles are
+ * kept on the CPU for the GPUMeshWrangler's software occlusion culling. Occluders should be low
+ * resolution stand-ins which lie inside the meshes they hide things for.
  */
 class GPUMesh
 {
@@ -35,19 +45,38 @@ public:
 	};
 
 	/**
-	 * @brief Contains a reference to a GPUMesh, as well as transform data and a dynamic offset into the GPUMeshWrangler's uniform buffer.
+	 * @brief Contains a reference to a GPUMesh, as well as transform data and an index into the GPUMeshWrangler's transform buffer.
 	 * 
 	 * Transform data is currently the only parameter, although more may be added  later.
-	 * The dynamic offset is intended to be directly used only by GPUMeshWrangler, which collects
-	 * the uniform data for all mesh instances in a frame into a single uniform buffer and gives
-	 * each of them an offset into said buffer.
+	 * The transform index is intended to be directly used only by GPUMeshWrangler, which collects
+	 * the transforms of all mesh instances in a frame into a single storage buffer and gives
+	 * each of them the index of its transform in said buffer.
+	 * 
+	 * The GPUMeshWrangler only uploads an instance's transform again while the set of staged
+	 * instances is unchanged if the transform is marked dirty, so transforms should be changed
+	 * through setTransform().
 	 */
 	class Instance
 	{
 	public:
+		void setTransform(const glm::mat4& transform) { mTransform = transform; mTransformDirty = true; }
+
 		GPUMesh* mMesh;
 		glm::mat4 mTransform = glm::identity<glm::mat4>();
-		uint32_t mDynamicOffset = 0;
+		uint32_t mTransformIndex = 0;
+		bool mTransformDirty = true;
+		uint32_t mPendingUploads = 0;	// number of GPUMeshWrangler buffer regions which still hold an old transform
+	};
+
+	/**
+	 * @brief Bounding volumes of a mesh's vertex positions, in model space.
+	 */
+	struct Bounds
+	{
+		glm::vec3 min = glm::vec3(0.0f);
+		glm::vec3 max = glm::vec3(0.0f);
+		glm::vec3 center = glm::vec3(0.0f);	// center of the bounding sphere
+		float radius = 0.0f;				// radius of the bounding sphere
 	};
 
 	static bool getAttributeProperties(uint32_t& stride, VkFormat& format, AttributeType type);
@@ -61,7 +90,18 @@ public:
 
 	// public functionality
 	void load();
-	void draw(VkCommandBuffer commandBuffer, std::vector<AttributeType>& attributeTypes);
+	void setOccluder(bool occluder) { mOccluder = occluder; }
+	void bindBuffers(VkCommandBuffer commandBuffer, std::vector<AttributeType>& attributeTypes);
+	void draw(VkCommandBuffer commandBuffer, uint32_t instanceCount = 1, uint32_t firstInstance = 0);
+
+	// public getters
+	uint64_t getUploadTicket() { return mUploadTicket; }
+	const Bounds& getBounds() { return mBounds; }
+	uint32_t getIndexCount() { return mGeometry.indexCount; }
+	uint32_t getFirstIndex() { return mGeometry.firstIndex; }
+	int32_t getVertexOffset() { return mGeometry.vertexOffset; }
+	uint32_t getGeometryBlock() { return mGeometry.block; }
+	const GPUOccluderRasterizer::Mesh* getOccluderMesh() { return mOccluder ? &mOccluderMesh : nullptr; }
 
 private:
 	/**
@@ -75,6 +115,7 @@ private:
 
 	bool loadFileData(DataVectors& data);
 	bool createBuffers(DataVectors& data);
+	void computeBounds(DataVectors& data);
 
 	// private helper functions
 	void ensureFenceExists();
@@ -87,15 +128,11 @@ private:
 	std::string mName;
 	GPUEngine* mEngine;
 	VkFence mFence = VK_NULL_HANDLE;
-	VkBuffer mPositionBuffer = VK_NULL_HANDLE;
-	VkDeviceMemory mPositionMemory = VK_NULL_HANDLE;
-	VkBuffer mNormalBuffer = VK_NULL_HANDLE;
-	VkDeviceMemory mNormalMemory = VK_NULL_HANDLE;
-	VkBuffer mIndexBuffer = VK_NULL_HANDLE;
-	VkDeviceMemory mIndexMemory = VK_NULL_HANDLE;
-	size_t positionOffset = 0;
-	size_t indexOffset = 0;
-	size_t mNumIndices = 0;
+	GPUGeometryPool::Range mGeometry;
+	uint64_t mUploadTicket = 0;
+	Bounds mBounds;
+	bool mOccluder = false;
+	GPUOccluderRasterizer::Mesh mOccluderMesh;	// only filled in if mOccluder is set
 };
 
 #endif
\ No newline at end of file
@@ -1,22 +1,28 @@
 #include "GPUMeshWrangler.h"
 
+#include <algorithm>
+#if defined(__AVX__) || defined(__SSE2__) || defined(_M_X64)
+#include <immintrin.h>
+#endif
+
 #include "glm_includes.h"
 #include "GPUEngine.h"
 
 GPUMeshWrangler::GPUMeshWrangler()
 {
 	mPRUniformBuffer = std::make_unique<GPUProcess::PassableResource<VkBuffer>>(this, &mUniformBuffer);
+	// the transform buffer is either written by a transfer, or directly by the host
+	mPRUniformBuffer->setState(VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_HOST_BIT, VK_ACCESS_TRANSFER_WRITE_BIT | VK_ACCESS_HOST_WRITE_BIT);
 }
 
 GPUMeshWrangler::~GPUMeshWrangler()
 {
 	VkDevice device = mEngine->getDevice();
 
+	releaseRetiredResources(true);
 	vkDestroyDescriptorPool(device, mDescriptorPool, nullptr);
-	vkDestroyBuffer(device, mUniformBuffer, nullptr);
-	vkDestroyBuffer(device, mTransferBuffer, nullptr);
-	vkFreeMemory(device, mUniformBufferMemory, nullptr);
-	vkFreeMemory(device, mTransferBufferMemory, nullptr);
+	mEngine->destroyBuffer(mUniformBuffer, mUniformBufferMemory);
+	mEngine->destroyBuffer(mTransferBuffer, mTransferBufferMemory);
 }
 
 /**
@@ -25,27 +31,51 @@ GPUMeshWrangler::~GPUMeshWrangler()
 void GPUMeshWrangler::reset()
 {
 	mMeshInstances.clear();
-	mNextInstance = 0;
+	mOccluders.clear();
 	mNextBufferMat4 = 0;
+
+	for (auto& bucket : mBuckets)
+		bucket.clear();
+	mInstanceBatches.clear();
 }
 
 /**
  * @brief Stages a mesh instance for rendering.
  * 
- * Generates uniform data for the mesh instance and places it in an internal buffer so
- * that it can be transferred to GPU memory for use in render passes. Gives the mesh
- * instance an offset into the uniform buffer that can later be referenced when
- * rendering that mesh instance.
+ * Adds the mesh instance to the bucket of its mesh. When this GPUMeshWrangler's operation is
+ * performed, the mesh instance is culled if it is outside the view frustum; otherwise, its
+ * transform is placed in an internal buffer so that it can be transferred to GPU memory for use
+ * in render passes, and the mesh instance is given the index of its transform in the transform buffer.
  * 
  * @param instance The mesh instance to be staged.
  */
 void GPUMeshWrangler::stageMeshInstance(GPUMesh::Instance* instance)
 {
+	auto bucketIndex = mBucketIndices.find(instance->mMesh);
+	if (bucketIndex == mBucketIndices.end())
+	{
+		bucketIndex = mBucketIndices.insert({ instance->mMesh, mBuckets.size() }).first;
+		mBuckets.emplace_back();
+	}
+	mBuckets[bucketIndex->second].push_back(instance);
+
 	mMeshInstances.push_back(instance);
-	mUniformBufferData[mNextBufferMat4] = instance->mTransform;
-	instance->mDynamicOffset = sizeof(glm::mat4) * mNextBufferMat4;
-	mNextInstance++;
-	mNextBufferMat4 += mMinMat4sPerMeshInstance;
+}
+
+/**
+ * @brief Stages a mesh instance as an occluder for software occlusion culling.
+ * 
+ * The instance's mesh must have been marked as an occluder before it was loaded. Occluders are
+ * not drawn, so an instance which should also be drawn must be staged with stageMeshInstance()
+ * as well; its occluder is usually a simpler mesh placed with the same transform.
+ * 
+ * @param instance The mesh instance to be staged as an occluder.
+ */
+void GPUMeshWrangler::stageOccluder(GPUMesh::Instance* instance)
+{
+	const GPUOccluderRasterizer::Mesh* occluderMesh = instance->mMesh->getOccluderMesh();
+	if (occluderMesh)
+		mOccluders.push_back({ occluderMesh, instance->mTransform });
 }
 
 /**
@@ -59,22 +89,100 @@ const std::vector<GPUMesh::Instance*> GPUMeshWrangler::getMeshInstances()
 }
 
 /**
- * @brief Binds the descriptor set and offset for a given mesh instance.
+ * @brief Advances the generation counter, so that recorded command buffers which draw mesh instances are recorded again.
+ * 
+ * Should be called when anything else about the staged instances changes, such as a mesh's buffers.
+ */
+void GPUMeshWrangler::invalidate()
+{
+	mInstancesChanged = true;
+}
+
+/**
+ * @brief Sets the view-projection matrix used for frustum culling and pushed to shaders by render passes.
  * 
- * This enables the next draw command to use the mesh instance's uniform data.
+ * Should be called each frame before the GPUEngine renders it. Changing the matrix advances
+ * the generation counter, since recorded command buffers contain it.
+ * 
+ * @param viewProjection The new view-projection matrix.
+ */
+void GPUMeshWrangler::setViewProjection(const glm::mat4& viewProjection)
+{
+	if (viewProjection != mViewProjection)
+		mViewChanged = true;
+
+	mViewProjection = viewProjection;
+}
+
+/**
+ * @brief Choose whether staged instances outside the view frustum are culled.
+ * 
+ * @param enabled Whether to perform frustum culling.
+ */
+void GPUMeshWrangler::setFrustumCulling(bool enabled)
+{
+	if (enabled != mFrustumCulling)
+		mInstancesChanged = true;
+
+	mFrustumCulling = enabled;
+}
+
+/**
+ * @brief Choose whether staged instances hidden behind the staged occluders are culled.
+ * 
+ * Occlusion culling is only performed along with frustum culling, on the instances inside the
+ * view frustum. The occluders are rasterized into a depth buffer of the given size, split into
+ * tiles which are rasterized on several threads.
+ * 
+ * @param enabled Whether to perform occlusion culling.
+ * @param width Width of the occlusion depth buffer, in pixels.
+ * @param height Height of the occlusion depth buffer, in pixels.
+ */
+void GPUMeshWrangler::setOcclusionCulling(bool enabled, uint32_t width, uint32_t height)
+{
+	mInstancesChanged = true;
+	mOccluderRasterizer.reset();
+	mOccludedInstanceCount = 0;
+
+	if (enabled)
+		mOccluderRasterizer = std::make_unique<GPUOccluderRasterizer>(width, height, mEngine->getWorkerPool());
+}
+
+/**
+ * @brief Binds the descriptor set for the transform buffer.
+ * 
+ * This enables following draw commands to use the transforms of all staged mesh instances,
+ * indexed by instance index; it only needs to be done once per command buffer and pipeline layout.
+ * The descriptor set of the current frame in flight is bound, so a command buffer recorded with it
+ * may only be submitted in frames with the same index.
  * 
  * @param commandBuffer Command buffer to record into.
  * @param bindPoint Pipeline bind point at which the descriptor set will be used.
  * @param pipelineLayout Pipeline layout used to program the binding.
- * @param instance Mesh instance for which the descriptor set is to be bound.
  */
-void GPUMeshWrangler::bindModelDescriptor(VkCommandBuffer commandBuffer, VkPipelineBindPoint bindPoint, VkPipelineLayout pipelineLayout, GPUMesh::Instance* instance)
+void GPUMeshWrangler::bindModelDescriptor(VkCommandBuffer commandBuffer, VkPipelineBindPoint bindPoint, VkPipelineLayout pipelineLayout)
 {
-	vkCmdBindDescriptorSets(commandBuffer, bindPoint, pipelineLayout, 0, 1, &mDescriptorSet, 1, &(instance->mDynamicOffset));
+	vkCmdBindDescriptorSets(commandBuffer, bindPoint, pipelineLayout, 0, 1, &mDescriptorSets[mEngine->getFrameIndex()], 0, nullptr);
 }
 
 /**
- * @brief Returns a const pointer to the PassableResource for this GPUMeshWrangler's uniform buffer.
+ * @brief Returns the region of the transform buffer which holds the current frame's transforms.
+ * 
+ * The buffer and region change when the transform buffer grows, which also advances the generation counter.
+ * 
+ * @return VkDescriptorBufferInfo 
+ */
+VkDescriptorBufferInfo GPUMeshWrangler::getTransformBufferInfo()
+{
+	VkDescriptorBufferInfo bufferInfo = {};
+	bufferInfo.buffer = mUniformBuffer;
+	bufferInfo.offset = sizeof(glm::mat4) * mInstanceCapacity * mEngine->getFrameIndex();
+	bufferInfo.range = sizeof(glm::mat4) * mInstanceCapacity;
+	return bufferInfo;
+}
+
+/**
+ * @brief Returns a const pointer to the PassableResource for this GPUMeshWrangler's transform storage buffer.
  * 
  * @return const GPUProcess::PassableResource<VkBuffer>* 
  */
@@ -85,30 +193,45 @@ const GPUProcess::PassableResource<VkBuffer>* GPUMeshWrangler::getPRUniformBuffe
 
 void GPUMeshWrangler::acquireLongtermResources()
 {
-	mMinMat4sPerMeshInstance = mEngine->getPhysicalDeviceLimits()->minUniformBufferOffsetAlignment / sizeof(glm::mat4);
-	if(mMinMat4sPerMeshInstance < 1)
-		mMinMat4sPerMeshInstance = 1;
+	// write transforms straight into device memory if the host can see it, and stage them otherwise
+	mDirectWrite = mEngine->hasHostVisibleDeviceLocalMemory();
+	if (!createBuffers() && mDirectWrite)
+	{
+		mDirectWrite = false;
+		createBuffers();
+	}
 
 	createDescriptorPool();
 	createDescriptorSet();
-	createBuffers();
-
-	VkDescriptorBufferInfo bufferInfo = {};
-	bufferInfo.buffer = mUniformBuffer;
-	bufferInfo.offset = 0;
-	bufferInfo.range = maxBonesPerMesh * sizeof(glm::mat4);
-
-	VkWriteDescriptorSet descriptorWrite = {};
-	descriptorWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-	descriptorWrite.pNext = nullptr;
-	descriptorWrite.dstSet = mDescriptorSet;
-	descriptorWrite.dstBinding = 0;
-	descriptorWrite.dstArrayElement = 0;
-	descriptorWrite.descriptorCount = 1;
-	descriptorWrite.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
-	descriptorWrite.pBufferInfo = &bufferInfo;
+	writeDescriptorSet();
+}
 
-	vkUpdateDescriptorSets(mEngine->getDevice(), 1, &descriptorWrite, 0, nullptr);
+/**
+ * @brief Points each descriptor set at its region of the current transform buffer, and updates the PassableResource's possible values.
+ */
+void GPUMeshWrangler::writeDescriptorSet()
+{
+	std::vector<VkDescriptorBufferInfo> bufferInfos(mRegionCount);
+	std::vector<VkWriteDescriptorSet> descriptorWrites(mRegionCount);
+	for (uint32_t region = 0; region < mRegionCount; region++)
+	{
+		auto& bufferInfo = bufferInfos[region];
+		bufferInfo.buffer = mUniformBuffer;
+		bufferInfo.offset = sizeof(glm::mat4) * mInstanceCapacity * region;
+		bufferInfo.range = sizeof(glm::mat4) * mInstanceCapacity;
+
+		auto& descriptorWrite = descriptorWrites[region];
+		descriptorWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		descriptorWrite.pNext = nullptr;
+		descriptorWrite.dstSet = mDescriptorSets[region];
+		descriptorWrite.dstBinding = 0;
+		descriptorWrite.dstArrayElement = 0;
+		descriptorWrite.descriptorCount = 1;
+		descriptorWrite.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		descriptorWrite.pBufferInfo = &bufferInfo;
+	}
+
+	vkUpdateDescriptorSets(mEngine->getDevice(), descriptorWrites.size(), descriptorWrites.data(), 0, nullptr);
 
 	mPRUniformBuffer->setPossibleValues({ mUniformBuffer });
 }
@@ -120,6 +243,30 @@ VkCommandBuffer GPUMeshWrangler::performOperation(VkCommandPool commandPool)
 {
 	VkDevice device = mEngine->getDevice();
 
+	// this frame's previous use of any retired resources has completed
+	releaseRetiredResources(false);
+
+	// only visible instances are drawn, so only they need transforms
+	cullInstances();
+
+	// grow before anything is written, so that every visible instance fits
+	if (mVisibleInstances.size() > mInstanceCapacity && growBuffers(mVisibleInstances.size()))
+		mInstancesChanged = true;
+
+	// the instance set is final for this frame, so update the generation before anything records draws
+	bool layoutChanged = mInstancesChanged || mVisibleInstances != mPreviousVisibleInstances;
+	if (layoutChanged || mViewChanged)
+		mGeneration++;
+	mInstancesChanged = false;
+	mViewChanged = false;
+
+	// transform indices only change along with the generation, so otherwise only dirty transforms are uploaded
+	buildInstanceBatches(layoutChanged);
+
+	// transforms written directly, or none written at all, need no transfer
+	if (mDirectWrite || mCopyRegions.empty())
+		return VK_NULL_HANDLE;
+
 	// Set up a transfer operation using staged transform data
 	VkCommandBuffer commandBuffer = mEngine->allocateCommandBuffer(commandPool);
 	VkCommandBufferBeginInfo beginInfo = {};
@@ -128,30 +275,365 @@ VkCommandBuffer GPUMeshWrangler::performOperation(VkCommandPool commandPool)
 	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
 	vkBeginCommandBuffer(commandBuffer, &beginInfo);
 
-	VkBufferCopy copyRegion = {};
-	copyRegion.srcOffset = 0;
-	copyRegion.dstOffset = 0;
-	copyRegion.size = sizeof(glm::mat4) * maxMeshInstances;
-	vkCmdCopyBuffer(commandBuffer, mTransferBuffer, mUniformBuffer, 1, &copyRegion);
+	// copy only the transforms written this frame into this frame's region; no barrier is
+	// needed first, since the frame which last read the region has completed
+	vkCmdCopyBuffer(commandBuffer, mTransferBuffer, mUniformBuffer, mCopyRegions.size(), mCopyRegions.data());
 
 	vkEndCommandBuffer(commandBuffer);
 
 	return commandBuffer;
 }
 
+/**
+ * @brief Assigns the transforms of visible instances contiguous indices, and creates an InstanceBatch for each mesh.
+ * 
+ * Transforms are tightly packed. Instances which do not fit in the transform buffer are dropped.
+ * Transforms which must be uploaded are written to this frame's region of the transfer buffer,
+ * and mCopyRegions is filled with the regions to copy into this frame's region of the transform
+ * buffer, merging adjacent transforms. When writing directly, they are written to this frame's
+ * region of the transform buffer instead.
+ * 
+ * @param uploadAll Whether to upload every transform, rather than only those marked dirty.
+ */
+void GPUMeshWrangler::buildInstanceBatches(bool uploadAll)
+{
+	// each frame in flight writes its data to its own region of the transfer or transform buffer
+	VkDeviceSize frameOffset = sizeof(glm::mat4) * mInstanceCapacity * mEngine->getFrameIndex();
+	void* mappedData = mDirectWrite ? mUniformBufferMemory.mappedData : mTransferBufferMemory.mappedData;
+	mUniformBufferData = (glm::mat4*) ((char*) mappedData + frameOffset);
+	mCopyRegions.clear();
+
+	// visible instances are in bucket order, so each run of instances of one mesh becomes a batch
+	size_t count = mVisibleInstances.size();
+	if (count > mInstanceCapacity)
+		count = mInstanceCapacity;
+
+	for (size_t first = 0; first < count;)
+	{
+		InstanceBatch batch;
+		batch.mesh = mVisibleInstances[first]->mMesh;
+		batch.firstInstance = first;
+		batch.instanceCount = 0;
+		while (first + batch.instanceCount < count && mVisibleInstances[first + batch.instanceCount]->mMesh == batch.mesh)
+			batch.instanceCount++;
+		mInstanceBatches.push_back(batch);
+		first += batch.instanceCount;
+
+		for (size_t i = batch.firstInstance; i < first; i++)
+		{
+			GPUMesh::Instance* instance = mVisibleInstances[i];
+			instance->mTransformIndex = mNextBufferMat4++;
+
+			// a new transform must be written to every region once
+			if (uploadAll || instance->mTransformDirty)
+			{
+				instance->mPendingUploads = mRegionCount;
+				instance->mTransformDirty = false;
+			}
+			if (instance->mPendingUploads == 0)
+				continue;
+
+			instance->mPendingUploads--;
+			mUniformBufferData[instance->mTransformIndex] = instance->mTransform;
+			if (mDirectWrite)
+				continue;
+
+			// both buffers use the same layout of regions, so source and destination offsets match
+			VkDeviceSize offset = frameOffset + sizeof(glm::mat4) * instance->mTransformIndex;
+			if (!mCopyRegions.empty() && mCopyRegions.back().dstOffset + mCopyRegions.back().size == offset)
+				mCopyRegions.back().size += sizeof(glm::mat4);
+			else
+				mCopyRegions.push_back({ offset, offset, sizeof(glm::mat4) });
+		}
+	}
+}
+
+/**
+ * @brief Tests a set of bounding spheres against the planes of a view frustum.
+ * 
+ * Several spheres are tested at once with SIMD instructions where available; spheres which are
+ * left over, or all of them on other architectures, are tested one at a time.
+ * 
+ * @param planes The six frustum planes, with normals pointing inward and normalized.
+ * @param x X coordinates of the sphere centers.
+ * @param y Y coordinates of the sphere centers.
+ * @param z Z coordinates of the sphere centers.
+ * @param radius Radii of the spheres.
+ * @param count Number of spheres.
+ * @param visible Array which receives 1 for each sphere that intersects the frustum, and 0 otherwise.
+ */
+static void cullSpheres(const glm::vec4* planes, const float* x, const float* y, const float* z, const float* radius,
+	size_t count, uint8_t* visible)
+{
+	size_t i = 0;
+
+#if defined(__AVX__)
+	for (; i + 8 <= count; i += 8)
+	{
+		__m256 cx = _mm256_loadu_ps(x + i);
+		__m256 cy = _mm256_loadu_ps(y + i);
+		__m256 cz = _mm256_loadu_ps(z + i);
+		__m256 negativeRadius = _mm256_sub_ps(_mm256_setzero_ps(), _mm256_loadu_ps(radius + i));
+		__m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+		for (int p = 0; p < 6; p++)
+		{
+			__m256 distance = _mm256_add_ps(
+				_mm256_add_ps(_mm256_mul_ps(cx, _mm256_set1_ps(planes[p].x)), _mm256_mul_ps(cy, _mm256_set1_ps(planes[p].y))),
+				_mm256_add_ps(_mm256_mul_ps(cz, _mm256_set1_ps(planes[p].z)), _mm256_set1_ps(planes[p].w)));
+			inside = _mm256_and_ps(inside, _mm256_cmp_ps(distance, negativeRadius, _CMP_GE_OQ));
+		}
+
+		int mask = _mm256_movemask_ps(inside);
+		for (int j = 0; j < 8; j++)
+			visible[i + j] = (mask >> j) & 1;
+	}
+#elif defined(__SSE2__) || defined(_M_X64)
+	for (; i + 4 <= count; i += 4)
+	{
+		__m128 cx = _mm_loadu_ps(x + i);
+		__m128 cy = _mm_loadu_ps(y + i);
+		__m128 cz = _mm_loadu_ps(z + i);
+		__m128 negativeRadius = _mm_sub_ps(_mm_setzero_ps(), _mm_loadu_ps(radius + i));
+		__m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+		for (int p = 0; p < 6; p++)
+		{
+			__m128 distance = _mm_add_ps(
+				_mm_add_ps(_mm_mul_ps(cx, _mm_set1_ps(planes[p].x)), _mm_mul_ps(cy, _mm_set1_ps(planes[p].y))),
+				_mm_add_ps(_mm_mul_ps(cz, _mm_set1_ps(planes[p].z)), _mm_set1_ps(planes[p].w)));
+			inside = _mm_and_ps(inside, _mm_cmpge_ps(distance, negativeRadius));
+		}
+
+		int mask = _mm_movemask_ps(inside);
+		for (int j = 0; j < 4; j++)
+			visible[i + j] = (mask >> j) & 1;
+	}
+#endif
+
+	for (; i < count; i++)
+	{
+		visible[i] = 1;
+		for (int p = 0; p < 6; p++)
+		{
+			float distance = planes[p].x * x[i] + planes[p].y * y[i] + planes[p].z * z[i] + planes[p].w;
+			if (distance < -radius[i])
+			{
+				visible[i] = 0;
+				break;
+			}
+		}
+	}
+}
+
+/**
+ * @brief Extracts the planes of the view frustum from a view-projection matrix.
+ * 
+ * The planes are taken from the rows of the matrix, with depth ranging from zero to one. Their
+ * normals point into the frustum and are normalized, so that the signed distance of a point
+ * from a plane is dot(plane.xyz, point) + plane.w.
+ * 
+ * @param viewProjection The view-projection matrix.
+ * @param planes Array which receives the left, right, top, bottom, near and far planes.
+ */
+void GPUMeshWrangler::getFrustumPlanes(const glm::mat4& viewProjection, glm::vec4* planes)
+{
+	glm::vec4 rows[4];
+	for (int row = 0; row < 4; row++)
+		rows[row] = glm::vec4(viewProjection[0][row], viewProjection[1][row], viewProjection[2][row], viewProjection[3][row]);
+
+	planes[0] = rows[3] + rows[0];	// left
+	planes[1] = rows[3] - rows[0];	// right
+	planes[2] = rows[3] + rows[1];	// top
+	planes[3] = rows[3] - rows[1];	// bottom
+	planes[4] = rows[2];			// near
+	planes[5] = rows[3] - rows[2];	// far
+	for (int p = 0; p < 6; p++)
+	{
+		float length = glm::length(glm::vec3(planes[p].x, planes[p].y, planes[p].z));
+		if (length > 0.0f)
+			planes[p] = planes[p] / length;
+	}
+}
+
+/**
+ * @brief Fills mVisibleInstances with the staged instances which intersect the view frustum, in bucket order.
+ * 
+ * Each instance's bounding sphere is transformed into world space; its radius is scaled by the
+ * largest scale of the transform, so that the sphere stays conservative. With occlusion culling,
+ * instances whose bounding boxes are hidden behind the staged occluders are left out as well.
+ */
+void GPUMeshWrangler::cullInstances()
+{
+	// keep the previous frame's visible instances, so that changes can be detected
+	mPreviousVisibleInstances.swap(mVisibleInstances);
+	mVisibleInstances.clear();
+
+	if (!mFrustumCulling)
+	{
+		for (auto& bucket : mBuckets)
+			mVisibleInstances.insert(mVisibleInstances.end(), bucket.begin(), bucket.end());
+		mCulledInstanceCount = 0;
+		mOccludedInstanceCount = 0;
+		return;
+	}
+
+	glm::vec4 planes[6];
+	getFrustumPlanes(mViewProjection, planes);
+
+	// gather world-space bounding spheres into separate arrays, for testing several at once
+	size_t count = mMeshInstances.size();
+	mSphereData.resize(count * 4);
+	mSphereVisible.resize(count);
+	float* x = mSphereData.data();
+	float* y = x + count;
+	float* z = y + count;
+	float* radius = z + count;
+
+	size_t sphere = 0;
+	for (auto& bucket : mBuckets)
+	{
+		for (auto instance : bucket)
+		{
+			const GPUMesh::Bounds& bounds = instance->mMesh->getBounds();
+			const glm::mat4& transform = instance->mTransform;
+			glm::vec4 center = transform * glm::vec4(bounds.center, 1.0f);
+
+			float scaleSquared = glm::max(glm::dot(transform[0], transform[0]) - transform[0].w * transform[0].w,
+				glm::dot(transform[1], transform[1]) - transform[1].w * transform[1].w);
+			scaleSquared = glm::max(scaleSquared, glm::dot(transform[2], transform[2]) - transform[2].w * transform[2].w);
+
+			x[sphere] = center.x;
+			y[sphere] = center.y;
+			z[sphere] = center.z;
+			radius[sphere] = bounds.radius * glm::sqrt(scaleSquared);
+			sphere++;
+		}
+	}
+
+	cullSpheres(planes, x, y, z, radius, count, mSphereVisible.data());
+
+	// instances inside the frustum are then tested against the occluders, if there are any
+	bool occlusionCulling = mOccluderRasterizer && !mOccluders.empty();
+	if (occlusionCulling)
+		mOccluderRasterizer->rasterize(mViewProjection, mOccluders);
+
+	mOccludedInstanceCount = 0;
+	sphere = 0;
+	for (auto& bucket : mBuckets)
+	{
+		for (auto instance : bucket)
+		{
+			if (!mSphereVisible[sphere++])
+				continue;
+
+			const GPUMesh::Bounds& bounds = instance->mMesh->getBounds();
+			if (occlusionCulling && !mOccluderRasterizer->isBoxVisible(instance->mTransform, bounds.min, bounds.max))
+			{
+				mOccludedInstanceCount++;
+				continue;
+			}
+
+			mVisibleInstances.push_back(instance);
+		}
+	}
+
+	mCulledInstanceCount = count - mVisibleInstances.size();
+}
+
+/**
+ * @brief Replaces the transform buffer, transfer buffer and descriptor sets with ones large enough for instanceCount instances.
+ * 
+ * Capacity is doubled until it is sufficient. The new buffers have a region for each of the
+ * current number of frames in flight. The replaced resources are retired rather than
+ * destroyed, since command buffers of frames in flight may still use them. If the new buffers
+ * cannot be created, the current ones are kept.
+ * 
+ * @param instanceCount Number of instances which must fit.
+ * @return Whether the buffers were replaced.
+ */
+bool GPUMeshWrangler::growBuffers(size_t instanceCount)
+{
+	RetiredResources retired = {};
+	retired.uniformBuffer = mUniformBuffer;
+	retired.uniformBufferMemory = mUniformBufferMemory;
+	retired.transferBuffer = mTransferBuffer;
+	retired.transferBufferMemory = mTransferBufferMemory;
+	retired.descriptorPool = mDescriptorPool;
+	retired.framesRemaining = mRegionCount;
+
+	std::vector<VkDescriptorSet> oldDescriptorSets = mDescriptorSets;
+	size_t oldCapacity = mInstanceCapacity;
+	while (mInstanceCapacity < instanceCount)
+		mInstanceCapacity *= 2;
+
+	mUniformBuffer = VK_NULL_HANDLE;
+	mUniformBufferMemory = {};
+	mTransferBuffer = VK_NULL_HANDLE;
+	mTransferBufferMemory = {};
+	mDescriptorPool = VK_NULL_HANDLE;
+
+	if (!createBuffers() || !createDescriptorPool() || !createDescriptorSet())
+	{
+		vkDestroyDescriptorPool(mEngine->getDevice(), mDescriptorPool, nullptr);
+		mEngine->destroyBuffer(mUniformBuffer, mUniformBufferMemory);
+		mEngine->destroyBuffer(mTransferBuffer, mTransferBufferMemory);
+
+		mUniformBuffer = retired.uniformBuffer;
+		mUniformBufferMemory = retired.uniformBufferMemory;
+		mTransferBuffer = retired.transferBuffer;
+		mTransferBufferMemory = retired.transferBufferMemory;
+		mDescriptorPool = retired.descriptorPool;
+		mDescriptorSets = oldDescriptorSets;
+		mInstanceCapacity = oldCapacity;
+		return false;
+	}
+
+	writeDescriptorSet();
+	mRetiredResources.push_back(retired);
+	return true;
+}
+
+/**
+ * @brief Destroys retired resources which are no longer in use by any frame in flight.
+ * 
+ * Called once per frame; a retired resource is destroyed after as many frames as there are
+ * frames in flight, at which point the frames which could have used it have completed.
+ * 
+ * @param all Whether to destroy all retired resources regardless, I.E. because the device is idle.
+ */
+void GPUMeshWrangler::releaseRetiredResources(bool all)
+{
+	VkDevice device = mEngine->getDevice();
+
+	size_t kept = 0;
+	for (auto& retired : mRetiredResources)
+	{
+		if (!all && --retired.framesRemaining > 0)
+		{
+			mRetiredResources[kept++] = retired;
+			continue;
+		}
+
+		vkDestroyDescriptorPool(device, retired.descriptorPool, nullptr);
+		mEngine->destroyBuffer(retired.uniformBuffer, retired.uniformBufferMemory);
+		mEngine->destroyBuffer(retired.transferBuffer, retired.transferBufferMemory);
+	}
+	mRetiredResources.resize(kept);
+}
+
 bool GPUMeshWrangler::createDescriptorPool()
 {
 	VkDevice device = mEngine->getDevice();
 
+	// the model descriptor set layout has two bindings, although only the transform buffer is written
 	VkDescriptorPoolSize poolSize = {};
-	poolSize.type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
-	poolSize.descriptorCount = 1;
+	poolSize.type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	poolSize.descriptorCount = mRegionCount * 2;
 
 	VkDescriptorPoolCreateInfo createInfo = {};
 	createInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
 	createInfo.pNext = nullptr;
 	createInfo.flags = VK_DESCRIPTOR_POOL_CREATE_FREE_DESCRIPTOR_SET_BIT;
-	createInfo.maxSets = 1;
+	createInfo.maxSets = mRegionCount;
 	createInfo.poolSizeCount = 1;
 	createInfo.pPoolSizes = &poolSize;
 
@@ -163,34 +645,46 @@ bool GPUMeshWrangler::createDescriptorSet()
 {
 	VkDevice device = mEngine->getDevice();
 
-	VkDescriptorSetLayout layout = mEngine->getModelDescriptorLayout();
+	std::vector<VkDescriptorSetLayout> layouts(mRegionCount, mEngine->getModelDescriptorLayout());
+	mDescriptorSets.resize(mRegionCount);
 
 	VkDescriptorSetAllocateInfo allocateInfo = {};
 	allocateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
 	allocateInfo.pNext = nullptr;
 	allocateInfo.descriptorPool = mDescriptorPool;
-	allocateInfo.descriptorSetCount = 1;
-	allocateInfo.pSetLayouts = &layout;
+	allocateInfo.descriptorSetCount = mRegionCount;
+	allocateInfo.pSetLayouts = layouts.data();
 
-	return (vkAllocateDescriptorSets(device, &allocateInfo, &mDescriptorSet) == VK_SUCCESS);
+	return (vkAllocateDescriptorSets(device, &allocateInfo, mDescriptorSets.data()) == VK_SUCCESS);
 }
 
 bool GPUMeshWrangler::createBuffers()
 {
+	// each frame in flight writes its own region, while the GPU reads the others
+	mRegionCount = mEngine->getFramesInFlight();
+	if (mDirectWrite)
+	{
+		return mEngine->createBuffer(
+			sizeof(glm::mat4) * mInstanceCapacity * mRegionCount,
+			VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+			mUniformBuffer, mUniformBufferMemory);
+	}
+
 	if (!mEngine->createBuffer(
-		sizeof(glm::mat4) * maxMeshInstances,
-		VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+		sizeof(glm::mat4) * mInstanceCapacity * mRegionCount,
+		VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
 		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, mUniformBuffer, mUniformBufferMemory))
 		return false;
 
 	if (!mEngine->createBuffer(
-		sizeof(glm::mat4) * maxMeshInstances,
+		sizeof(glm::mat4) * mInstanceCapacity * mRegionCount,
 		VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
 		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
 		mTransferBuffer, mTransferBufferMemory))
 		return false;
 
-	vkMapMemory(mEngine->getDevice(), mTransferBufferMemory, 0, sizeof(glm::mat4) * maxMeshInstances, 0, (void**) &mUniformBufferData);
+	// staging memory is persistently mapped by the allocator
 
 	/*
 	// test by just rotating 45 degrees
@@ -2,11 +2,14 @@
 #define GPUMESHWRANGLER_H
 
 #include <memory>
+#include <unordered_map>
 #include <vector>
 #include <vulkan/vulkan.h>
 
 #include "GPUProcess.h"
 #include "GPUMesh.h"
+#include "GPUMemoryAllocator.h"
+#include "GPUOccluderRasterizer.h"
 #include "glm_includes.h"
 
 class GPUEngine;
@@ -14,17 +17,64 @@ class GPUEngine;
 /**
  * @brief Prepares active mesh instances to be rendered each frame.
  * 
- * Groups transform data for each mesh instance into a single large uniform buffer
- * and gives each mesh instance an offset into said buffer. This class's
- * responsibilities will likely expand as features are added to Violet.
+ * Groups transform data for each mesh instance into a single tightly packed storage buffer,
+ * which is bound once per subpass. Staged instances are bucketed by mesh, and the transforms of
+ * each bucket are written contiguously, so that a bucket can be drawn with a single instanced
+ * draw call whose firstInstance is the index of the bucket's first transform; shaders index the
+ * transforms by instance index.
+ * 
+ * Before any transforms are written, staged instances whose bounding spheres lie entirely outside
+ * the view frustum are culled, so that only visible instances reach the draw list. The frustum is
+ * taken from the view-projection matrix set through setViewProjection(), which render passes also
+ * push to their shaders. Culling tests several instances at once, using AVX when it is enabled at
+ * compile time and SSE2 otherwise, with a scalar fallback for other architectures.
+ * 
+ * If occlusion culling is enabled, the occluders staged through stageOccluder() are rasterized
+ * into a coarse depth buffer on the CPU by a GPUOccluderRasterizer, and instances which passed
+ * frustum culling are culled if their bounding boxes are hidden behind the occluders. This does
+ * not need any GPU work, so it can be used where GPU culling is unavailable or too costly.
+ * 
+ * The transform buffer has a separate region, with its own descriptor set, for each frame in
+ * flight, so that a frame's transforms can be written while earlier frames are still reading
+ * theirs. Transform data is staged in the matching region of the transfer buffer and copied
+ * into the transform buffer. If the device has memory which is both device-local and host-visible,
+ * the transform buffer is placed in it instead; transforms are then written straight into the
+ * region of the current frame, and no transfer command buffer is recorded at all.
+ * 
+ * While the set of staged instances is unchanged, every instance keeps its transform index,
+ * and each region of the transform buffer keeps its contents between frames; only the transforms
+ * of instances marked dirty are written, once to each region. When staging, adjacent transforms
+ * are coalesced into one copy region.
+ * 
+ * The transform and transfer buffers start with room for initialInstanceCapacity instances and
+ * double in size whenever more instances are staged. Growing replaces the buffers and the
+ * descriptor sets; the old ones are retired, and destroyed once every frame which may still
+ * use them has completed. This class's responsibilities will likely
+ * expand as features are added to Violet.
+ * 
+ * The wrangler keeps a generation counter, which changes whenever the list of visible
+ * mesh instances differs from the previous frame's list, the view-projection matrix changes,
+ * or invalidate() is called.
+ * Processes which keep recorded command buffers use it to decide when to record again.
  */
 class GPUMeshWrangler : public GPUProcess
 {
 public:
-	static constexpr size_t maxBonesPerMesh = 64;	// it could be more and still fit in the
-													// minimum maxUniformBufferRange, but 64
-													// seems a reasonable limit for now
-	static constexpr size_t maxMeshInstances = 1024;
+	static constexpr size_t initialInstanceCapacity = 1024;
+	static constexpr uint32_t defaultOcclusionWidth = 256;
+	static constexpr uint32_t defaultOcclusionHeight = 128;
+
+	/**
+	 * @brief A run of instances of a single mesh whose transforms are contiguous in the transform buffer.
+	 */
+	struct InstanceBatch
+	{
+		GPUMesh* mesh;
+		uint32_t firstInstance;		// index of the first transform in the transform buffer
+		uint32_t instanceCount;
+	};
+
+	static void getFrustumPlanes(const glm::mat4& viewProjection, glm::vec4* planes);
 
 	// constructors and destructor
 	GPUMeshWrangler();
@@ -36,8 +86,20 @@ public:
 	// public functionality
 	void reset();
 	void stageMeshInstance(GPUMesh::Instance* instance);
+	void stageOccluder(GPUMesh::Instance* instance);
 	const std::vector<GPUMesh::Instance*> getMeshInstances();
-	void bindModelDescriptor(VkCommandBuffer commandBuffer, VkPipelineBindPoint bindPoint, VkPipelineLayout pipelineLayout, GPUMesh::Instance* instance);
+	const std::vector<InstanceBatch>& getInstanceBatches() { return mInstanceBatches; }
+	void invalidate();
+	uint64_t getGeneration() { return mGeneration; }
+	void setViewProjection(const glm::mat4& viewProjection);
+	const glm::mat4& getViewProjection() { return mViewProjection; }
+	void setFrustumCulling(bool enabled);
+	void setOcclusionCulling(bool enabled, uint32_t width = defaultOcclusionWidth, uint32_t height = defaultOcclusionHeight);
+	size_t getVisibleInstanceCount() { return mVisibleInstances.size(); }
+	size_t getCulledInstanceCount() { return mCulledInstanceCount; }
+	size_t getOccludedInstanceCount() { return mOccludedInstanceCount; }
+	void bindModelDescriptor(VkCommandBuffer commandBuffer, VkPipelineBindPoint bindPoint, VkPipelineLayout pipelineLayout);
+	VkDescriptorBufferInfo getTransformBufferInfo();
 
 	// functions for setting up passable resource relationships
 	const PassableResource<VkBuffer>* getPRUniformBuffer();
@@ -47,28 +109,68 @@ public:
 	virtual VkCommandBuffer performOperation(VkCommandPool commandPool);
 
 private:
+	// resources replaced by growing, which may still be in use by frames in flight
+	struct RetiredResources
+	{
+		VkBuffer uniformBuffer;
+		GPUMemoryAllocator::Allocation uniformBufferMemory;
+		VkBuffer transferBuffer;
+		GPUMemoryAllocator::Allocation transferBufferMemory;
+		VkDescriptorPool descriptorPool;
+		uint32_t framesRemaining;
+	};
+
+	void cullInstances();
+	void buildInstanceBatches(bool uploadAll);
+	bool growBuffers(size_t instanceCount);
+	void releaseRetiredResources(bool all);
 	bool createDescriptorPool();
 	bool createDescriptorSet();
+	void writeDescriptorSet();
 	bool createBuffers();
 
 	// data used to assemble list of mesh instances for rendering
 	glm::mat4* mUniformBufferData = nullptr;
 	std::vector<GPUMesh::Instance*> mMeshInstances;
-	size_t mNextInstance = 0;
+	uint64_t mGeneration = 1;
+	bool mInstancesChanged = false;
+	bool mViewChanged = false;
 	size_t mNextBufferMat4 = 0;
-	size_t mMinMat4sPerMeshInstance = 256 / sizeof(glm::mat4);	// 256 = guaranteed maximum physical device
-																// minUniformBufferOffsetAlignment as per VK spec
+	size_t mInstanceCapacity = initialInstanceCapacity;
+	bool mDirectWrite = false;		// whether transforms are written straight into the transform buffer
+	uint32_t mRegionCount = 1;		// number of frames in flight the buffers were created for
+	std::vector<RetiredResources> mRetiredResources;
+
+	// per-mesh buckets of staged instances; bucket vectors are kept between frames to avoid reallocation
+	std::unordered_map<GPUMesh*, size_t> mBucketIndices;
+	std::vector<std::vector<GPUMesh::Instance*>> mBuckets;
+	std::vector<InstanceBatch> mInstanceBatches;
+	std::vector<VkBufferCopy> mCopyRegions;
+
+	// frustum culling; visible instances are kept in bucket order, and the previous frame's are kept to detect changes
+	glm::mat4 mViewProjection = glm::identity<glm::mat4>();
+	bool mFrustumCulling = true;
+	std::vector<GPUMesh::Instance*> mVisibleInstances;
+	std::vector<GPUMesh::Instance*> mPreviousVisibleInstances;
+	size_t mCulledInstanceCount = 0;
+	std::vector<float> mSphereData;		// world-space bounding spheres, as separate arrays of x, y, z and radius
+	std::vector<uint8_t> mSphereVisible;
+
+	// software occlusion culling; occluders are staged each frame, like mesh instances
+	std::unique_ptr<GPUOccluderRasterizer> mOccluderRasterizer;
+	std::vector<GPUOccluderRasterizer::Occluder> mOccluders;
+	size_t mOccludedInstanceCount = 0;
 
 	// passable resources
 	std::unique_ptr<PassableResource<VkBuffer>> mPRUniformBuffer;
 
 	// Vulkan handles owned by GPUMeshWrangler
-	VkDescriptorPool mDescriptorPool;
-	VkDescriptorSet mDescriptorSet;
-	VkBuffer mUniformBuffer;
-	VkDeviceMemory mUniformBufferMemory;
-	VkBuffer mTransferBuffer;
-	VkDeviceMemory mTransferBufferMemory;
+	VkDescriptorPool mDescriptorPool = VK_NULL_HANDLE;
+	std::vector<VkDescriptorSet> mDescriptorSets;	// indexed by frame in flight
+	VkBuffer mUniformBuffer = VK_NULL_HANDLE;
+	GPUMemoryAllocator::Allocation mUniformBufferMemory;
+	VkBuffer mTransferBuffer = VK_NULL_HANDLE;
+	GPUMemoryAllocator::Allocation mTransferBufferMemory;
 };
 
 #endif
\ No newline at end of file
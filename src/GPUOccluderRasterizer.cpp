@@ -0,0 +1,316 @@
+#include "GPUOccluderRasterizer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#if defined(__AVX__) || defined(__SSE2__) || defined(_M_X64)
+#include <immintrin.h>
+#endif
+
+// vertices with a smaller clip-space w are treated as crossing the near plane
+static constexpr float minClipW = 1e-5f;
+
+/**
+ * @brief Construct a new GPUOccluderRasterizer object.
+ *
+ * The depth buffer is rounded up to a whole number of tiles in each direction, and the view
+ * is stretched across all of it.
+ *
+ * @param width Minimum width of the depth buffer, in pixels.
+ * @param height Minimum height of the depth buffer, in pixels.
+ * @param workerPool Pool to rasterize tiles on, which must outlive the rasterizer; if nullptr, tiles are rasterized
+ * on the thread calling rasterize().
+ */
+GPUOccluderRasterizer::GPUOccluderRasterizer(uint32_t width, uint32_t height, GPUWorkerPool* workerPool)
+{
+	mWorkerPool = workerPool;
+
+	mTilesX = std::max((width + tileWidth - 1) / tileWidth, 1u);
+	mTilesY = std::max((height + tileHeight - 1) / tileHeight, 1u);
+	mWidth = mTilesX * tileWidth;
+	mHeight = mTilesY * tileHeight;
+
+	mDepth.resize(mWidth * mHeight, 1.0f);
+	mTileBins.resize(mTilesX * mTilesY);
+}
+
+/**
+ * @brief Replaces the contents of the depth buffer with the given occluders, seen through a view-projection matrix.
+ *
+ * The view-projection matrix is kept for isBoxVisible().
+ *
+ * @param viewProjection The view-projection matrix, with depth ranging from zero to one.
+ * @param occluders The occluders to rasterize.
+ */
+void GPUOccluderRasterizer::rasterize(const glm::mat4& viewProjection, const std::vector<Occluder>& occluders)
+{
+	mViewProjection = viewProjection;
+	mTriangles.clear();
+	for (auto& bin : mTileBins)
+		bin.clear();
+
+	for (auto& occluder : occluders)
+		setupTriangles(occluder);
+
+	// each tile is cleared and rasterized by a single job, so jobs never write the same pixels
+	if (mWorkerPool)
+		mWorkerPool->run(mTileBins.size(), [this](uint32_t tile) { rasterizeTile(tile); });
+	else
+		for (uint32_t tile = 0; tile < mTileBins.size(); tile++)
+			rasterizeTile(tile);
+}
+
+/**
+ * @brief Tests whether any part of a bounding box may be visible past the occluders of the last rasterize().
+ *
+ * The box is projected to a rectangle of pixels, which is visible if any of its pixels is at
+ * least as far as the nearest corner of the box. Boxes which cross the near plane, or which
+ * lie entirely outside the depth buffer, are always reported visible, and left to frustum culling.
+ *
+ * @param transform Transform which places the box in the world.
+ * @param boxMin Minimum corner of the box, in model space.
+ * @param boxMax Maximum corner of the box, in model space.
+ * @return Whether the box may be visible.
+ */
+bool GPUOccluderRasterizer::isBoxVisible(const glm::mat4& transform, const glm::vec3& boxMin, const glm::vec3& boxMax)
+{
+	glm::mat4 matrix = mViewProjection * transform;
+
+	float minX = std::numeric_limits<float>::max();
+	float minY = std::numeric_limits<float>::max();
+	float maxX = -std::numeric_limits<float>::max();
+	float maxY = -std::numeric_limits<float>::max();
+	float nearest = std::numeric_limits<float>::max();
+	for (int i = 0; i < 8; i++)
+	{
+		glm::vec4 corner((i & 1) ? boxMax.x : boxMin.x, (i & 2) ? boxMax.y : boxMin.y, (i & 4) ? boxMax.z : boxMin.z, 1.0f);
+		glm::vec4 clip = matrix * corner;
+		if (clip.w <= minClipW || clip.z < 0.0f)
+			return true;
+
+		float x = (clip.x / clip.w * 0.5f + 0.5f) * mWidth;
+		float y = (clip.y / clip.w * 0.5f + 0.5f) * mHeight;
+		minX = std::min(minX, x);
+		minY = std::min(minY, y);
+		maxX = std::max(maxX, x);
+		maxY = std::max(maxY, y);
+		nearest = std::min(nearest, clip.z / clip.w);
+	}
+
+	if (maxX < 0.0f || maxY < 0.0f || minX >= mWidth || minY >= mHeight)
+		return true;
+
+	// every pixel the rectangle touches, even partially, is tested
+	int32_t startX = (int32_t) std::max(minX, 0.0f);
+	int32_t startY = (int32_t) std::max(minY, 0.0f);
+	int32_t endX = (int32_t) std::min(maxX, mWidth - 1.0f);
+	int32_t endY = (int32_t) std::min(maxY, mHeight - 1.0f);
+
+	for (int32_t y = startY; y <= endY; y++)
+	{
+		const float* row = mDepth.data() + mWidth * y;
+		int32_t x = startX;
+
+#if defined(__AVX__)
+		__m256 nearestDepth = _mm256_set1_ps(nearest);
+		for (; x + 8 <= endX + 1; x += 8)
+			if (_mm256_movemask_ps(_mm256_cmp_ps(_mm256_loadu_ps(row + x), nearestDepth, _CMP_GE_OQ)))
+				return true;
+#elif defined(__SSE2__) || defined(_M_X64)
+		__m128 nearestDepth = _mm_set1_ps(nearest);
+		for (; x + 4 <= endX + 1; x += 4)
+			if (_mm_movemask_ps(_mm_cmpge_ps(_mm_loadu_ps(row + x), nearestDepth)))
+				return true;
+#endif
+
+		for (; x <= endX; x++)
+			if (row[x] >= nearest)
+				return true;
+	}
+
+	return false;
+}
+
+/**
+ * @brief Transforms the triangles of an occluder to screen space, and adds each one to the bins of the tiles it overlaps.
+ *
+ * Triangles are wound so that their edge functions are positive inside, since both faces of an
+ * occluder hide what is behind it. Each edge function is then moved inwards by half a pixel along
+ * both axes, so that it is only non-negative at the centers of pixels lying entirely inside the
+ * edge. Triangles which cross the near plane, are degenerate, or lie outside the depth buffer are dropped.
+ *
+ * @param occluder The occluder to set up.
+ */
+void GPUOccluderRasterizer::setupTriangles(const Occluder& occluder)
+{
+	const Mesh* mesh = occluder.mesh;
+	glm::mat4 matrix = mViewProjection * occluder.transform;
+
+	// transform each vertex once, however many triangles share it
+	mClipPositions.resize(mesh->positions.size());
+	for (size_t i = 0; i < mesh->positions.size(); i++)
+		mClipPositions[i] = matrix * glm::vec4(mesh->positions[i], 1.0f);
+
+	for (size_t i = 0; i + 2 < mesh->indices.size(); i += 3)
+	{
+		float x[3];
+		float y[3];
+		float depth = 0.0f;
+		bool rejected = false;
+		for (int v = 0; v < 3; v++)
+		{
+			const glm::vec4& clip = mClipPositions[mesh->indices[i + v]];
+			if (clip.w <= minClipW || clip.z < 0.0f)
+			{
+				rejected = true;
+				break;
+			}
+
+			x[v] = (clip.x / clip.w * 0.5f + 0.5f) * mWidth;
+			y[v] = (clip.y / clip.w * 0.5f + 0.5f) * mHeight;
+			depth = std::max(depth, clip.z / clip.w);
+		}
+		if (rejected)
+			continue;
+
+		float area = (x[1] - x[0]) * (y[2] - y[0]) - (y[1] - y[0]) * (x[2] - x[0]);
+		if (!(std::fabs(area) > 0.0f))
+			continue;
+		if (area < 0.0f)
+		{
+			std::swap(x[1], x[2]);
+			std::swap(y[1], y[2]);
+		}
+
+		float minX = std::max(std::min(std::min(x[0], x[1]), x[2]), 0.0f);
+		float minY = std::max(std::min(std::min(y[0], y[1]), y[2]), 0.0f);
+		float maxX = std::min(std::max(std::max(x[0], x[1]), x[2]), mWidth - 1.0f);
+		float maxY = std::min(std::max(std::max(y[0], y[1]), y[2]), mHeight - 1.0f);
+		if (minX > maxX || minY > maxY)
+			continue;
+
+		Triangle triangle;
+		for (int edge = 0; edge < 3; edge++)
+		{
+			int from = (edge + 1) % 3;
+			int to = (edge + 2) % 3;
+			triangle.edgeA[edge] = y[from] - y[to];
+			triangle.edgeB[edge] = x[to] - x[from];
+			triangle.edgeC[edge] = (y[to] - y[from]) * x[from] - (x[to] - x[from]) * y[from];
+
+			// the edge function changes by at most this much between a pixel's center and its corners
+			triangle.edgeC[edge] -= (std::fabs(triangle.edgeA[edge]) + std::fabs(triangle.edgeB[edge])) * 0.5f;
+		}
+		triangle.depth = depth;
+		triangle.minX = (int32_t) minX;
+		triangle.minY = (int32_t) minY;
+		triangle.maxX = (int32_t) maxX;
+		triangle.maxY = (int32_t) maxY;
+
+		uint32_t index = mTriangles.size();
+		mTriangles.push_back(triangle);
+		for (int32_t tileY = triangle.minY / (int32_t) tileHeight; tileY <= triangle.maxY / (int32_t) tileHeight; tileY++)
+			for (int32_t tileX = triangle.minX / (int32_t) tileWidth; tileX <= triangle.maxX / (int32_t) tileWidth; tileX++)
+				mTileBins[mTilesX * tileY + tileX].push_back(index);
+	}
+}
+
+/**
+ * @brief Clears one tile of the depth buffer, and rasterizes the triangles in its bin.
+ *
+ * @param tile Index of the tile, in row-major order.
+ */
+void GPUOccluderRasterizer::rasterizeTile(uint32_t tile)
+{
+	int32_t tileX = (tile % mTilesX) * tileWidth;
+	int32_t tileY = (tile / mTilesX) * tileHeight;
+
+	for (int32_t y = tileY; y < tileY + (int32_t) tileHeight; y++)
+		std::fill_n(mDepth.data() + mWidth * y + tileX, tileWidth, 1.0f);
+
+	for (uint32_t index : mTileBins[tile])
+	{
+		const Triangle& triangle = mTriangles[index];
+
+		// rows start at a multiple of the SIMD width, which never crosses the end of the tile
+		int32_t startX = std::max(triangle.minX, tileX) & ~7;
+		int32_t endX = std::min(triangle.maxX, tileX + (int32_t) tileWidth - 1);
+		int32_t startY = std::max(triangle.minY, tileY);
+		int32_t endY = std::min(triangle.maxY, tileY + (int32_t) tileHeight - 1);
+
+		for (int32_t y = startY; y <= endY; y++)
+			rasterizeRow(triangle, mDepth.data() + mWidth * y, startX, endX, y + 0.5f);
+	}
+}
+
+/**
+ * @brief Rasterizes a triangle into a span of one row of the depth buffer, testing coverage at pixel centers.
+ *
+ * Since the edge functions are biased inwards, a pixel only passes if the triangle covers all of it.
+ *
+ * With SIMD instructions, pixels are processed in groups, and the last group may extend past
+ * endX; startX must be a multiple of 8 so that it never extends past the end of the tile.
+ *
+ * @param triangle The triangle to rasterize.
+ * @param row The first pixel of the row.
+ * @param startX First pixel of the span.
+ * @param endX Last pixel of the span.
+ * @param y Vertical coordinate of the row's pixel centers.
+ */
+void GPUOccluderRasterizer::rasterizeRow(const Triangle& triangle, float* row, int32_t startX, int32_t endX, float y)
+{
+	float rowC[3];
+	for (int edge = 0; edge < 3; edge++)
+		rowC[edge] = triangle.edgeB[edge] * y + triangle.edgeC[edge];
+
+	int32_t x = startX;
+
+#if defined(__AVX__)
+	__m256 pixelOffsets = _mm256_setr_ps(0.5f, 1.5f, 2.5f, 3.5f, 4.5f, 5.5f, 6.5f, 7.5f);
+	__m256 depth = _mm256_set1_ps(triangle.depth);
+	__m256 zero = _mm256_setzero_ps();
+	for (; x <= endX; x += 8)
+	{
+		__m256 px = _mm256_add_ps(_mm256_set1_ps((float) x), pixelOffsets);
+		__m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+		for (int edge = 0; edge < 3; edge++)
+		{
+			__m256 value = _mm256_add_ps(_mm256_mul_ps(px, _mm256_set1_ps(triangle.edgeA[edge])), _mm256_set1_ps(rowC[edge]));
+			inside = _mm256_and_ps(inside, _mm256_cmp_ps(value, zero, _CMP_GE_OQ));
+		}
+
+		__m256 previous = _mm256_loadu_ps(row + x);
+		_mm256_storeu_ps(row + x, _mm256_blendv_ps(previous, _mm256_min_ps(previous, depth), inside));
+	}
+#elif defined(__SSE2__) || defined(_M_X64)
+	__m128 pixelOffsets = _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f);
+	__m128 depth = _mm_set1_ps(triangle.depth);
+	__m128 zero = _mm_setzero_ps();
+	for (; x <= endX; x += 4)
+	{
+		__m128 px = _mm_add_ps(_mm_set1_ps((float) x), pixelOffsets);
+		__m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+		for (int edge = 0; edge < 3; edge++)
+		{
+			__m128 value = _mm_add_ps(_mm_mul_ps(px, _mm_set1_ps(triangle.edgeA[edge])), _mm_set1_ps(rowC[edge]));
+			inside = _mm_and_ps(inside, _mm_cmpge_ps(value, zero));
+		}
+
+		// SSE2 has no blend, so covered pixels are selected with masks
+		__m128 previous = _mm_loadu_ps(row + x);
+		__m128 nearer = _mm_min_ps(previous, depth);
+		_mm_storeu_ps(row + x, _mm_or_ps(_mm_and_ps(inside, nearer), _mm_andnot_ps(inside, previous)));
+	}
+#endif
+
+	for (; x <= endX; x++)
+	{
+		float px = x + 0.5f;
+		bool inside = true;
+		for (int edge = 0; edge < 3; edge++)
+			inside = inside && (triangle.edgeA[edge] * px + rowC[edge] >= 0.0f);
+		if (inside)
+			row[x] = std::min(row[x], triangle.depth);
+	}
+}
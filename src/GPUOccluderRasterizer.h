@@ -0,0 +1,102 @@
+#ifndef GPUOCCLUDERRASTERIZER_H
+#define GPUOCCLUDERRASTERIZER_H
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "GPUWorkerPool.h"
+#include "glm_includes.h"
+
+/**
+ * @brief Rasterizes occluder meshes into a coarse depth buffer on the CPU, and tests bounding boxes against it.
+ *
+ * Occluders are low-resolution stand-ins for meshes which hide large parts of the scene. Their
+ * triangles should lie inside the meshes they stand in for, since anything behind an occluder
+ * is treated as hidden. rasterize() replaces the depth buffer with the occluders seen through a
+ * view-projection matrix, and isBoxVisible() then tests bounding boxes against it.
+ *
+ * Triangles are transformed and binned into tiles of tileWidth by tileHeight pixels first. Each
+ * tile is then cleared and rasterized as a separate job of a shared GPUWorkerPool, if one is
+ * given, so that no two threads ever write the same pixels. Rasterization is conservative: a
+ * pixel is only covered by a triangle which contains all of it, and a covered pixel keeps the
+ * nearest of the depths of the triangles covering it, where each triangle's depth is that of its
+ * farthest vertex, so that the buffer never hides anything the occluders do not. Triangles
+ * which cross the near plane are dropped. Rows of 8 pixels are rasterized and tested at once
+ * using AVX floating-point instructions when AVX is enabled at compile time, I.E. through the
+ * VIOLET_ENABLE_AVX CMake option, and 4 using SSE2 otherwise, with a scalar fallback for other
+ * architectures.
+ *
+ * Has no Vulkan dependency, so that it can be used and benchmarked on its own.
+ */
+class GPUOccluderRasterizer
+{
+public:
+	static constexpr uint32_t tileWidth = 32;	// must be a multiple of 8, the width of a SIMD row
+	static constexpr uint32_t tileHeight = 16;
+
+	/**
+	 * @brief Triangles of an occluder, in model space.
+	 */
+	struct Mesh
+	{
+		std::vector<glm::vec3> positions;
+		std::vector<uint32_t> indices;		// three per triangle
+	};
+
+	/**
+	 * @brief An occluder mesh, and the transform to place it in the world with.
+	 */
+	struct Occluder
+	{
+		const Mesh* mesh;
+		glm::mat4 transform;
+	};
+
+	// constructors
+	GPUOccluderRasterizer(uint32_t width, uint32_t height, GPUWorkerPool* workerPool = nullptr);
+	GPUOccluderRasterizer(GPUOccluderRasterizer& other) = delete;
+	GPUOccluderRasterizer(GPUOccluderRasterizer&& other) = delete;
+	GPUOccluderRasterizer& operator=(GPUOccluderRasterizer& other) = delete;
+
+	// public functionality
+	void rasterize(const glm::mat4& viewProjection, const std::vector<Occluder>& occluders);
+	bool isBoxVisible(const glm::mat4& transform, const glm::vec3& boxMin, const glm::vec3& boxMax);
+
+	// public getters
+	uint32_t getWidth() { return mWidth; }
+	uint32_t getHeight() { return mHeight; }
+	const float* getDepthData() { return mDepth.data(); }
+	size_t getTriangleCount() { return mTriangles.size(); }
+
+private:
+	// a triangle set up for rasterization; edge function i is edgeA[i] * x + edgeB[i] * y + edgeC[i],
+	// which is non-negative at the centers of pixels lying entirely inside the triangle
+	struct Triangle
+	{
+		float edgeA[3];
+		float edgeB[3];
+		float edgeC[3];
+		float depth;					// depth of the farthest vertex
+		int32_t minX, minY, maxX, maxY;	// covered pixels, clamped to the depth buffer
+	};
+
+	// private helper functions
+	void setupTriangles(const Occluder& occluder);
+	void rasterizeTile(uint32_t tile);
+	void rasterizeRow(const Triangle& triangle, float* row, int32_t startX, int32_t endX, float y);
+
+	// private member variables
+	uint32_t mWidth;
+	uint32_t mHeight;
+	uint32_t mTilesX;
+	uint32_t mTilesY;
+	glm::mat4 mViewProjection = glm::identity<glm::mat4>();
+	std::vector<float> mDepth;						// row-major, with 1 where nothing was rasterized
+	std::vector<Triangle> mTriangles;
+	std::vector<std::vector<uint32_t>> mTileBins;	// indices of the triangles overlapping each tile
+	std::vector<glm::vec4> mClipPositions;			// vertices of the occluder being set up, in clip space
+	GPUWorkerPool* mWorkerPool;
+};
+
+#endif
@@ -88,7 +88,7 @@ void GPUPipeline::buildPipelineLayout()
 
 	VkPushConstantRange pushConstantRange = {};
 	pushConstantRange.offset = 0;
-	pushConstantRange.size = 64; // size of glm::mat4
+	pushConstantRange.size = 68; // size of glm::mat4, then the instance offset of indirect draws
 	pushConstantRange.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
 
 	VkPipelineLayoutCreateInfo createInfo = {};
@@ -63,8 +63,12 @@ GPUProcess::OperationType GPUProcess::getOperationType()
  * @brief Perform this GPUProcess's operation by allocating a command buffer, recording commands into it, and returning it.
  * 
  * If getOperationType() does not return OP_TYPE_COMMAND, this function will never be called.
- * After this function is called, the GPUDependencyGraph submits the returned command buffer,
- * and then frees it once it is no longer needed.
+ * The command buffer should be obtained through GPUEngine::allocateCommandBuffer(), and must not
+ * be freed. After this function is called, the GPUDependencyGraph submits the returned command
+ * buffer, and once the GPU has finished with it, hands it out again in a later frame.
+ * 
+ * If there is nothing to record this frame, VK_NULL_HANDLE may be returned instead; processes
+ * which depend on this one are still ordered after it.
  * 
  * @param commandPool The command pool from which to allocate a command buffer.
  * @return VkCommandBuffer 
@@ -124,4 +128,50 @@ void GPUProcess::acquireFrameResources()
 void GPUProcess::cleanupFrameResources()
 {
 	// do nothing for default implementation
+}
+
+/**
+ * @brief Return true if this GPUProcess owns a resource which only needs to hold its contents while it is used within a frame.
+ * 
+ * The GPUDependencyGraph places the frame resources of transient processes whose users never
+ * execute at the same time in the same memory. A transient process must create its resource
+ * without binding memory upon acquireFrameResources(), and wait for bindTransientMemory().
+ * 
+ * @return true This GPUProcess's frame resources may share memory with other transient processes.
+ * @return false This GPUProcess allocates its own memory.
+ */
+bool GPUProcess::isTransient()
+{
+	return false;
+}
+
+/**
+ * @brief Get the memory requirements of this GPUProcess's transient resource.
+ * 
+ * If isTransient() does not return true, this function will never be called.
+ * 
+ * @param requirements Reference to which the memory requirements should be written.
+ * @return true The resource is waiting for memory to be bound.
+ * @return false There is no resource waiting for memory.
+ */
+bool GPUProcess::getTransientMemoryRequirements(VkMemoryRequirements& requirements)
+{
+	return false;
+}
+
+/**
+ * @brief Bind memory to this GPUProcess's transient resource, and finish acquiring it.
+ * 
+ * If isTransient() does not return true, this function will never be called. The memory
+ * is owned by the GPUDependencyGraph, and stays valid until cleanupFrameResources() is called.
+ * 
+ * @param memory Memory to bind, or VK_NULL_HANDLE if the GPUProcess should allocate its own memory.
+ * @param offset Offset into memory at which to bind the resource.
+ * @return true The resource was bound to memory, or there was no resource waiting for memory.
+ * @return false The resource could not be bound, or its own memory could not be allocated.
+ */
+bool GPUProcess::bindTransientMemory(VkDeviceMemory memory, VkDeviceSize offset)
+{
+	// do nothing for default implementation
+	return true;
 }
\ No newline at end of file
@@ -28,8 +28,11 @@ class GPUEngine;
  * 
  * If a GPUProcess uses any PassableResources which are owned by another GPUProcess, it
  * must override getPRDependencies() so that it can describe what PassableResources it uses,
- * and at which pipeline stage(s). The GPUDependencyGraph will analyze these relationships to
- * determine the proper execution order and potentially group command buffer submits together.
+ * at which pipeline stage(s), with which access types and in which image layout. The owner
+ * of a PassableResource describes how its own operation leaves the resource by setting the
+ * resource's state. The GPUDependencyGraph will analyze these relationships to determine the
+ * proper execution order, potentially group command buffer submits together, and insert
+ * barriers between the producer and consumer of each resource.
  * 
  * GPUProcess is not meant to be instantiated; however, there is no single function which
  * all child classes must override, so I have not found a good way to make this class
@@ -58,11 +61,43 @@ public:
 			return mProcess;
 		}
 
+		VkPipelineStageFlags getStage() const {
+			return mStage;
+		}
+
+		VkAccessFlags getAccess() const {
+			return mAccess;
+		}
+
+		VkImageLayout getLayout() const {
+			return mLayout;
+		}
+
+		/**
+		 * @brief Describe how the owning GPUProcess's operation leaves the resource.
+		 * 
+		 * Should be set by the owning GPUProcess before its GPUDependencyGraph is built.
+		 * A stage of 0 means the state is unknown, in which case dependent processes are
+		 * synchronized against all prior commands.
+		 * 
+		 * @param stage Pipeline stage(s) in which the operation last uses the resource.
+		 * @param access Types of writes the operation makes to the resource; 0 if it only reads it.
+		 * @param layout Layout an image is left in; VK_IMAGE_LAYOUT_UNDEFINED if its contents need not be preserved.
+		 */
+		void setState(VkPipelineStageFlags stage, VkAccessFlags access, VkImageLayout layout = VK_IMAGE_LAYOUT_UNDEFINED) {
+			mStage = stage;
+			mAccess = access;
+			mLayout = layout;
+		}
+
 	protected:
 		// do not allow instances of base class
 		~PassableResourceBase() {};
 
 		GPUProcess* mProcess = nullptr;
+		VkPipelineStageFlags mStage = 0;
+		VkAccessFlags mAccess = 0;
+		VkImageLayout mLayout = VK_IMAGE_LAYOUT_UNDEFINED;
 	};
 	
 	/**
@@ -151,12 +186,16 @@ public:
 	 * @brief Structure describing a dependency on a passable resource.
 	 * 
 	 * Contains a const pointer to the passable resource, as well as a set of flags describing
-	 * which pipeline stage(s) the resource is used in.
+	 * which pipeline stage(s) the resource is used in and with which access types. If access is
+	 * 0, the access types are derived from the pipeline stages. layout is the image layout the
+	 * resource is expected to be in; VK_IMAGE_LAYOUT_UNDEFINED means that any layout is accepted.
 	 */
 	struct PRDependency
 	{
 		const PassableResourceBase* resource;
 		VkPipelineStageFlags pipelineStage = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+		VkAccessFlags access = 0;
+		VkImageLayout layout = VK_IMAGE_LAYOUT_UNDEFINED;
 	};
 
 	// GPUProcess functionality
@@ -172,6 +211,9 @@ public:
 	virtual void acquireLongtermResources();
 	virtual void acquireFrameResources();
 	virtual void cleanupFrameResources();
+	virtual bool isTransient();
+	virtual bool getTransientMemoryRequirements(VkMemoryRequirements& requirements);
+	virtual bool bindTransientMemory(VkDeviceMemory memory, VkDeviceSize offset);
 
 protected:
 	GPUEngine* mEngine = nullptr;
@@ -0,0 +1,696 @@
+#include "GPUProcessCull.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+
+#include "GPUEngine.h"
+
+/**
+ * @brief Construct a new GPUProcessCull object.
+ *
+ * @param phase Which instances to draw; see GPUProcessCull::Phase.
+ */
+GPUProcessCull::GPUProcessCull(Phase phase)
+{
+	mPhase = phase;
+
+	mPRIndirectBuffer = std::make_unique<GPUProcess::PassableResource<VkBuffer>>(this, &mIndirectBuffer);
+	mPRIndirectBuffer->setState(VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT);
+}
+
+GPUProcessCull::~GPUProcessCull()
+{
+	VkDevice device = mEngine->getDevice();
+
+	releaseRetiredResources(true);
+	vkDestroyDescriptorPool(device, mDescriptorPool, nullptr);
+	vkDestroyPipeline(device, mPipeline, nullptr);
+	vkDestroyPipelineLayout(device, mPipelineLayout, nullptr);
+	vkDestroyDescriptorSetLayout(device, mComputeDescriptorLayout, nullptr);
+	vkDestroyShaderModule(device, mShaderModule, nullptr);
+	destroyBuffers();
+}
+
+/**
+ * @brief Binds the model descriptor set which points at the transform buffer and the visible instance list.
+ *
+ * Must be used instead of the GPUMeshWrangler's descriptor set by shaders which draw the output of this
+ * process, such as phong_indirect.vert. The descriptor set of the current frame in flight is bound, so a
+ * command buffer recorded with it may only be submitted in frames with the same index.
+ *
+ * @param commandBuffer Command buffer to record into.
+ * @param bindPoint Pipeline bind point at which the descriptor set will be used.
+ * @param pipelineLayout Pipeline layout used to program the binding.
+ */
+void GPUProcessCull::bindModelDescriptor(VkCommandBuffer commandBuffer, VkPipelineBindPoint bindPoint, VkPipelineLayout pipelineLayout)
+{
+	vkCmdBindDescriptorSets(commandBuffer, bindPoint, pipelineLayout, 0, 1, &mModelDescriptorSets[mEngine->getFrameIndex()], 0, nullptr);
+}
+
+/**
+ * @brief Records the indirect draws of a consecutive run of the GPUMeshWrangler's instance batches.
+ *
+ * The meshes of the batches must all be in the same geometry block, whose buffers must already
+ * be bound, since the commands only differ in their first index and vertex offset. If the device
+ * supports multi-draw indirect, the whole run is drawn with a single vkCmdDrawIndexedIndirect()
+ * call, as long as it does not exceed maxDrawIndirectCount; otherwise each draw is recorded on its own.
+ * Draws which did not fit in the buffers this frame are skipped.
+ *
+ * The vertex shader adds an instance offset, pushed after the view-projection matrix, to
+ * gl_InstanceIndex. If the device lacks drawIndirectFirstInstance, every command starts at
+ * instance zero, so each draw is recorded on its own with its first instance pushed as the offset.
+ *
+ * @param commandBuffer Command buffer to record into.
+ * @param pipelineLayout Layout of the bound graphics pipeline, used to push the instance offset.
+ * @param firstDraw Index of the first instance batch in the GPUMeshWrangler's list of instance batches.
+ * @param drawCount Number of instance batches to draw.
+ */
+void GPUProcessCull::drawIndirect(VkCommandBuffer commandBuffer, VkPipelineLayout pipelineLayout, size_t firstDraw, size_t drawCount)
+{
+	if (firstDraw >= mDrawCount)
+		return;
+	drawCount = std::min(drawCount, mDrawCount - firstDraw);
+
+	uint32_t stride = sizeof(VkDrawIndexedIndirectCommand);
+	VkDeviceSize offset = stride * (mDrawCapacity * mEngine->getFrameIndex() + firstDraw);
+
+	if (!mEngine->supportsDrawIndirectFirstInstance())
+	{
+		auto& batches = mEngine->getMeshWrangler()->getInstanceBatches();
+		for (size_t i = 0; i < drawCount; i++)
+		{
+			uint32_t instanceOffset = batches[firstDraw + i].firstInstance;
+			vkCmdPushConstants(commandBuffer, pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, sizeof(glm::mat4), sizeof(uint32_t), &instanceOffset);
+			vkCmdDrawIndexedIndirect(commandBuffer, mIndirectBuffer, offset + stride * i, 1, stride);
+		}
+		return;
+	}
+
+	uint32_t instanceOffset = 0;
+	vkCmdPushConstants(commandBuffer, pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, sizeof(glm::mat4), sizeof(uint32_t), &instanceOffset);
+	size_t maxDrawsPerCall = mEngine->supportsMultiDrawIndirect() ? mEngine->getPhysicalDeviceLimits()->maxDrawIndirectCount : 1;
+
+	while (drawCount > 0)
+	{
+		uint32_t count = std::min(drawCount, maxDrawsPerCall);
+		vkCmdDrawIndexedIndirect(commandBuffer, mIndirectBuffer, offset, count, stride);
+		offset += stride * count;
+		drawCount -= count;
+	}
+}
+
+/**
+ * @brief Assign the early phase whose per-instance visibility a late phase reads and updates.
+ *
+ * Only used by the late phase, and must be called before the GPUDependencyGraph is built.
+ *
+ * @param earlyPhase A GPUProcessCull of phase CULL_PHASE_EARLY.
+ */
+void GPUProcessCull::setEarlyPhase(GPUProcessCull* earlyPhase)
+{
+	mEarlyPhase = earlyPhase;
+}
+
+/**
+ * @brief Assign the PassableResource<VkBuffer> of the GPUMeshWrangler's transform storage buffer, which is read by the compute shader.
+ *
+ * @param prUniformBuffer
+ */
+void GPUProcessCull::setUniformBufferPR(const PassableResource<VkBuffer>* prUniformBuffer)
+{
+	mPRUniformBuffer = prUniformBuffer;
+}
+
+/**
+ * @brief Assign the PassableImageView of the depth pyramid a late phase tests instances against, I.E. from a GPUProcessDepthPyramid.
+ *
+ * @param prPyramidView
+ */
+void GPUProcessCull::setPyramidViewPR(const PassableImageView* prPyramidView)
+{
+	mPRPyramidView = prPyramidView;
+}
+
+/**
+ * @brief Returns a const pointer to the PassableResource for this GPUProcessCull's indirect command buffer.
+ *
+ * @return const GPUProcess::PassableResource<VkBuffer>*
+ */
+const GPUProcess::PassableResource<VkBuffer>* GPUProcessCull::getPRIndirectBuffer()
+{
+	return mPRIndirectBuffer.get();
+}
+
+std::vector<GPUProcess::PRDependency> GPUProcessCull::getPRDependencies()
+{
+	std::vector<PRDependency> dependencies({
+		{mPRUniformBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT}
+	});
+
+	// the pyramid is built after the early phase, so the late phase also runs after it
+	if (mPhase == CULL_PHASE_LATE)
+		dependencies.push_back({mPRPyramidView, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT, VK_IMAGE_LAYOUT_GENERAL});
+
+	return dependencies;
+}
+
+VkQueueFlags GPUProcessCull::getNeededQueueType()
+{
+	return VK_QUEUE_GRAPHICS_BIT;
+}
+
+void GPUProcessCull::acquireLongtermResources()
+{
+	// every instance must reach the transform buffer, since visibility is decided on the GPU
+	mEngine->getMeshWrangler()->setFrustumCulling(false);
+	mInstanceCapacity = GPUMeshWrangler::initialInstanceCapacity;
+
+	createPipeline();
+	createBuffers();
+	createDescriptorSets();
+}
+
+void GPUProcessCull::cleanupFrameResources()
+{
+	// the depth pyramid's view is destroyed, and a new one may reuse its handle
+	for (auto& written : mWrittenDescriptors)
+		written = {};
+}
+
+VkCommandBuffer GPUProcessCull::performOperation(VkCommandPool commandPool)
+{
+	// this frame's previous use of any retired resources has completed
+	releaseRetiredResources(false);
+	readCounters();
+
+	GPUMeshWrangler* meshWrangler = mEngine->getMeshWrangler();
+	auto& batches = meshWrangler->getInstanceBatches();
+	size_t instanceCount = batches.empty() ? 0 : batches.back().firstInstance + batches.back().instanceCount;
+
+	if (batches.size() > mDrawCapacity || instanceCount > mInstanceCapacity)
+		growBuffers(batches.size(), instanceCount);
+
+	// draws and instances which do not fit are dropped
+	mDrawCount = std::min(batches.size(), mDrawCapacity);
+	instanceCount = std::min(instanceCount, mInstanceCapacity);
+	if (mDrawCount == 0)
+		return VK_NULL_HANDLE;
+
+	// the late phase's instances must also fit in the early phase's visibility buffer
+	if (mPhase == CULL_PHASE_LATE)
+		instanceCount = std::min(instanceCount, mEarlyPhase->mInstanceCapacity);
+
+	// write this frame's draws, and the commands whose instance counts the compute shader fills in
+	uint32_t frameIndex = mEngine->getFrameIndex();
+	DrawInfo* draws = (DrawInfo*) mDrawBufferMemory.mappedData + mDrawCapacity * frameIndex;
+	VkDrawIndexedIndirectCommand* commands = (VkDrawIndexedIndirectCommand*) mCommandTemplateBufferMemory.mappedData + mDrawCapacity * frameIndex;
+	for (size_t i = 0; i < mDrawCount; i++)
+	{
+		const GPUMesh::Bounds& bounds = batches[i].mesh->getBounds();
+		draws[i].sphere = glm::vec4(bounds.center, bounds.radius);
+		draws[i].firstInstance = batches[i].firstInstance;
+		draws[i].instanceCount = batches[i].instanceCount;
+
+		commands[i].indexCount = batches[i].mesh->getIndexCount();
+		commands[i].instanceCount = 0;
+		commands[i].firstIndex = batches[i].mesh->getFirstIndex();
+		commands[i].vertexOffset = batches[i].mesh->getVertexOffset();
+		commands[i].firstInstance = mEngine->supportsDrawIndirectFirstInstance() ? batches[i].firstInstance : 0;
+	}
+
+	// only rewrite descriptor sets when something they point at changes, since rewriting
+	// a set invalidates command buffers it is bound in
+	WrittenDescriptors descriptors = {};
+	descriptors.transformBufferInfo = meshWrangler->getTransformBufferInfo();
+	if (mPhase == CULL_PHASE_EARLY)
+		descriptors.visibilityBuffer = mVisibilityBuffer;
+	if (mPhase == CULL_PHASE_LATE)
+	{
+		descriptors.visibilityBuffer = mEarlyPhase->mVisibilityBuffer;
+		descriptors.pyramidView = mPRPyramidView->getVkHandle();
+	}
+
+	WrittenDescriptors& written = mWrittenDescriptors[frameIndex];
+	if (written.transformBufferInfo.buffer != descriptors.transformBufferInfo.buffer
+		|| written.transformBufferInfo.offset != descriptors.transformBufferInfo.offset
+		|| written.transformBufferInfo.range != descriptors.transformBufferInfo.range
+		|| written.visibilityBuffer != descriptors.visibilityBuffer || written.pyramidView != descriptors.pyramidView)
+		writeDescriptorSets(descriptors);
+
+	VkCommandBuffer commandBuffer = mEngine->allocateCommandBuffer(commandPool);
+	VkCommandBufferBeginInfo beginInfo = {};
+	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	beginInfo.pNext = nullptr;
+	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+	vkBeginCommandBuffer(commandBuffer, &beginInfo);
+
+	if (mPhase == CULL_PHASE_EARLY)
+	{
+		// the previous frame's late phase wrote the visibility which is read here
+		VkMemoryBarrier visibilityBarrier = {};
+		visibilityBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+		visibilityBarrier.pNext = nullptr;
+		visibilityBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+		visibilityBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT,
+			0, 1, &visibilityBarrier, 0, nullptr, 0, nullptr);
+
+		// without any history, every instance is drawn early and tested late
+		if (mResetVisibility)
+		{
+			vkCmdFillBuffer(commandBuffer, mVisibilityBuffer, 0, VK_WHOLE_SIZE, 1);
+			mResetVisibility = false;
+		}
+	}
+
+	// reset the commands; the frame which last used this region has completed
+	VkDeviceSize commandOffset = sizeof(VkDrawIndexedIndirectCommand) * mDrawCapacity * frameIndex;
+	VkBufferCopy copyRegion = { commandOffset, commandOffset, sizeof(VkDrawIndexedIndirectCommand) * mDrawCount };
+	vkCmdCopyBuffer(commandBuffer, mCommandTemplateBuffer, mIndirectBuffer, 1, &copyRegion);
+
+	VkMemoryBarrier barrier = {};
+	barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	barrier.pNext = nullptr;
+	barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+		0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+	// cull every instance against the same frustum the render pass draws with
+	PushConstants pushConstants = {};
+	pushConstants.viewProjection = meshWrangler->getViewProjection();
+	pushConstants.instanceCount = instanceCount;
+	pushConstants.drawCount = mDrawCount;
+
+	vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, mPipeline);
+	vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, mPipelineLayout, 0, 1, &mComputeDescriptorSets[frameIndex], 0, nullptr);
+	vkCmdPushConstants(commandBuffer, mPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(PushConstants), &pushConstants);
+	vkCmdDispatch(commandBuffer, (instanceCount + workgroupSize - 1) / workgroupSize, 1, 1);
+
+	// make the counters visible to readCounters() once this frame's fence has been waited on
+	VkMemoryBarrier counterBarrier = {};
+	counterBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	counterBarrier.pNext = nullptr;
+	counterBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+	counterBarrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_HOST_BIT,
+		0, 1, &counterBarrier, 0, nullptr, 0, nullptr);
+
+	vkEndCommandBuffer(commandBuffer);
+
+	return commandBuffer;
+}
+
+/**
+ * @brief Takes the instance counts of this frame's previous use of its counter buffer region, and clears them.
+ */
+void GPUProcessCull::readCounters()
+{
+	Counters* counters = (Counters*) ((char*) mCounterBufferMemory.mappedData + counterRegionSize * mEngine->getFrameIndex());
+	mVisibleInstanceCount = counters->visible;
+	mFrustumCulledInstanceCount = counters->frustumCulled;
+	mOccludedInstanceCount = counters->occluded;
+	*counters = {};
+}
+
+/**
+ * @brief Returns the number of storage buffer bindings in this phase's compute descriptor set layout.
+ *
+ * The transform, draw, indirect command, visible instance and counter buffers are used by every
+ * phase; the early and late phases also use the visibility buffer.
+ */
+uint32_t GPUProcessCull::getStorageBindingCount()
+{
+	return (mPhase == CULL_PHASE_ALL) ? 5 : 6;
+}
+
+/**
+ * @brief Loads this phase's culling compute shader and creates its descriptor set layout, pipeline layout and pipeline.
+ *
+ * @return Whether the pipeline was created successfully.
+ */
+bool GPUProcessCull::createPipeline()
+{
+	VkDevice device = mEngine->getDevice();
+
+	// read compiled shader
+	const char* shaderNames[] = { "shaders/cull_comp.spv", "shaders/cull_early_comp.spv", "shaders/cull_late_comp.spv" };
+	std::ifstream infile(shaderNames[mPhase], std::ios::ate | std::ios::binary);
+	if (!infile.is_open())
+		return false;
+	size_t fileSize = infile.tellg();
+	std::vector<char> fileBuffer(fileSize);
+	infile.seekg(0);
+	infile.read(fileBuffer.data(), fileSize);
+	infile.close();
+
+	VkShaderModuleCreateInfo moduleCreateInfo = {};
+	moduleCreateInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+	moduleCreateInfo.pNext = nullptr;
+	moduleCreateInfo.flags = 0;
+	moduleCreateInfo.codeSize = fileSize;
+	moduleCreateInfo.pCode = reinterpret_cast<uint32_t*>(fileBuffer.data());
+	if (vkCreateShaderModule(device, &moduleCreateInfo, nullptr, &mShaderModule) != VK_SUCCESS)
+		return false;
+
+	// storage buffers, followed by the depth pyramid in the late phase
+	std::vector<VkDescriptorSetLayoutBinding> bindings(getStorageBindingCount());
+	if (mPhase == CULL_PHASE_LATE)
+		bindings.resize(bindings.size() + 1);
+	for (uint32_t i = 0; i < bindings.size(); i++)
+	{
+		bindings[i].binding = i;
+		bindings[i].descriptorType = (i < getStorageBindingCount()) ? VK_DESCRIPTOR_TYPE_STORAGE_BUFFER : VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+		bindings[i].descriptorCount = 1;
+		bindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+		bindings[i].pImmutableSamplers = nullptr;
+	}
+
+	VkDescriptorSetLayoutCreateInfo layoutCreateInfo = {};
+	layoutCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+	layoutCreateInfo.pNext = nullptr;
+	layoutCreateInfo.flags = 0;
+	layoutCreateInfo.bindingCount = bindings.size();
+	layoutCreateInfo.pBindings = bindings.data();
+	if (vkCreateDescriptorSetLayout(device, &layoutCreateInfo, nullptr, &mComputeDescriptorLayout) != VK_SUCCESS)
+		return false;
+
+	VkPushConstantRange pushConstantRange = {};
+	pushConstantRange.offset = 0;
+	pushConstantRange.size = sizeof(PushConstants);
+	pushConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+	VkPipelineLayoutCreateInfo pipelineLayoutCreateInfo = {};
+	pipelineLayoutCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+	pipelineLayoutCreateInfo.pNext = nullptr;
+	pipelineLayoutCreateInfo.flags = 0;
+	pipelineLayoutCreateInfo.setLayoutCount = 1;
+	pipelineLayoutCreateInfo.pSetLayouts = &mComputeDescriptorLayout;
+	pipelineLayoutCreateInfo.pushConstantRangeCount = 1;
+	pipelineLayoutCreateInfo.pPushConstantRanges = &pushConstantRange;
+	if (vkCreatePipelineLayout(device, &pipelineLayoutCreateInfo, nullptr, &mPipelineLayout) != VK_SUCCESS)
+		return false;
+
+	VkComputePipelineCreateInfo pipelineCreateInfo = {};
+	pipelineCreateInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+	pipelineCreateInfo.pNext = nullptr;
+	pipelineCreateInfo.flags = 0;
+	pipelineCreateInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+	pipelineCreateInfo.stage.pNext = nullptr;
+	pipelineCreateInfo.stage.flags = 0;
+	pipelineCreateInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+	pipelineCreateInfo.stage.module = mShaderModule;
+	pipelineCreateInfo.stage.pName = "main";
+	pipelineCreateInfo.stage.pSpecializationInfo = nullptr;
+	pipelineCreateInfo.layout = mPipelineLayout;
+	pipelineCreateInfo.basePipelineHandle = VK_NULL_HANDLE;
+	pipelineCreateInfo.basePipelineIndex = -1;
+	if (vkCreateComputePipelines(device, VK_NULL_HANDLE, 1, &pipelineCreateInfo, nullptr, &mPipeline) != VK_SUCCESS)
+		return false;
+
+	return true;
+}
+
+/**
+ * @brief Creates the draw, command template, indirect command, visible instance and counter buffers, with a region for each frame in flight.
+ *
+ * Capacities start at powers of two and are doubled, so every region's offset is a multiple of
+ * 256 bytes, the largest minimum storage buffer offset alignment a device may have. The early
+ * phase also creates the visibility buffer, which has a single region that is kept between frames.
+ *
+ * @return Whether all buffers were created successfully.
+ */
+bool GPUProcessCull::createBuffers()
+{
+	mRegionCount = mEngine->getFramesInFlight();
+	VkMemoryPropertyFlags hostMemoryFlags = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+	VkDeviceSize commandsSize = sizeof(VkDrawIndexedIndirectCommand) * mDrawCapacity * mRegionCount;
+
+	if (!mEngine->createBuffer(sizeof(DrawInfo) * mDrawCapacity * mRegionCount, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+		hostMemoryFlags, mDrawBuffer, mDrawBufferMemory))
+		return false;
+
+	if (!mEngine->createBuffer(commandsSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+		hostMemoryFlags, mCommandTemplateBuffer, mCommandTemplateBufferMemory))
+		return false;
+
+	if (!mEngine->createBuffer(commandsSize,
+		VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, mIndirectBuffer, mIndirectBufferMemory))
+		return false;
+
+	if (!mEngine->createBuffer(sizeof(uint32_t) * mInstanceCapacity * mRegionCount, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, mVisibleBuffer, mVisibleBufferMemory))
+		return false;
+
+	if (!mEngine->createBuffer(counterRegionSize * mRegionCount, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+		hostMemoryFlags, mCounterBuffer, mCounterBufferMemory))
+		return false;
+	memset(mCounterBufferMemory.mappedData, 0, counterRegionSize * mRegionCount);
+
+	if (mPhase == CULL_PHASE_EARLY)
+	{
+		if (!mEngine->createBuffer(sizeof(uint32_t) * mInstanceCapacity, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, mVisibilityBuffer, mVisibilityBufferMemory))
+			return false;
+		mResetVisibility = true;
+	}
+
+	mPRIndirectBuffer->setPossibleValues({ mIndirectBuffer });
+	return true;
+}
+
+/**
+ * @brief Creates a descriptor pool, and a compute and a model descriptor set for each frame in flight.
+ *
+ * The descriptor sets are written by performOperation() the first time each frame uses them.
+ *
+ * @return Whether the descriptor sets were allocated successfully.
+ */
+bool GPUProcessCull::createDescriptorSets()
+{
+	VkDevice device = mEngine->getDevice();
+
+	// storage buffers of each compute set, and two per model set, plus the pyramid of the late phase
+	VkDescriptorPoolSize poolSizes[2] = {};
+	poolSizes[0].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	poolSizes[0].descriptorCount = mRegionCount * (getStorageBindingCount() + 2);
+	poolSizes[1].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+	poolSizes[1].descriptorCount = mRegionCount;
+
+	VkDescriptorPoolCreateInfo createInfo = {};
+	createInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+	createInfo.pNext = nullptr;
+	createInfo.flags = 0;
+	createInfo.maxSets = mRegionCount * 2;
+	createInfo.poolSizeCount = (mPhase == CULL_PHASE_LATE) ? 2 : 1;
+	createInfo.pPoolSizes = poolSizes;
+	if (vkCreateDescriptorPool(device, &createInfo, nullptr, &mDescriptorPool) != VK_SUCCESS)
+		return false;
+
+	std::vector<VkDescriptorSetLayout> layouts(mRegionCount * 2);
+	std::fill(layouts.begin(), layouts.begin() + mRegionCount, mComputeDescriptorLayout);
+	std::fill(layouts.begin() + mRegionCount, layouts.end(), mEngine->getModelDescriptorLayout());
+
+	std::vector<VkDescriptorSet> descriptorSets(layouts.size());
+	VkDescriptorSetAllocateInfo allocateInfo = {};
+	allocateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+	allocateInfo.pNext = nullptr;
+	allocateInfo.descriptorPool = mDescriptorPool;
+	allocateInfo.descriptorSetCount = layouts.size();
+	allocateInfo.pSetLayouts = layouts.data();
+	if (vkAllocateDescriptorSets(device, &allocateInfo, descriptorSets.data()) != VK_SUCCESS)
+		return false;
+
+	mComputeDescriptorSets.assign(descriptorSets.begin(), descriptorSets.begin() + mRegionCount);
+	mModelDescriptorSets.assign(descriptorSets.begin() + mRegionCount, descriptorSets.end());
+	mWrittenDescriptors.assign(mRegionCount, WrittenDescriptors{});
+	return true;
+}
+
+/**
+ * @brief Points the current frame's descriptor sets at the given resources and at the frame's regions of this process's buffers.
+ *
+ * @param descriptors The transform buffer region for the current frame, and the visibility buffer and pyramid view where used.
+ */
+void GPUProcessCull::writeDescriptorSets(const WrittenDescriptors& descriptors)
+{
+	uint32_t frameIndex = mEngine->getFrameIndex();
+	VkDescriptorSet computeSet = mComputeDescriptorSets[frameIndex];
+	VkDescriptorSet modelSet = mModelDescriptorSets[frameIndex];
+
+	VkDescriptorBufferInfo bufferInfos[6] = {
+		descriptors.transformBufferInfo,
+		{ mDrawBuffer, sizeof(DrawInfo) * mDrawCapacity * frameIndex, sizeof(DrawInfo) * mDrawCapacity },
+		{ mIndirectBuffer, sizeof(VkDrawIndexedIndirectCommand) * mDrawCapacity * frameIndex, sizeof(VkDrawIndexedIndirectCommand) * mDrawCapacity },
+		{ mVisibleBuffer, sizeof(uint32_t) * mInstanceCapacity * frameIndex, sizeof(uint32_t) * mInstanceCapacity },
+		{ mCounterBuffer, counterRegionSize * frameIndex, sizeof(Counters) },
+		{ descriptors.visibilityBuffer, 0, VK_WHOLE_SIZE }
+	};
+
+	VkDescriptorImageInfo pyramidInfo = {};
+	pyramidInfo.sampler = mEngine->getNearestSampler();
+	pyramidInfo.imageView = descriptors.pyramidView;
+	pyramidInfo.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+
+	VkWriteDescriptorSet descriptorWrite = {};
+	descriptorWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+	descriptorWrite.pNext = nullptr;
+	descriptorWrite.dstArrayElement = 0;
+	descriptorWrite.descriptorCount = 1;
+	descriptorWrite.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+
+	// compute bindings, then model bindings 0-1
+	std::vector<VkWriteDescriptorSet> descriptorWrites;
+	for (uint32_t i = 0; i < getStorageBindingCount(); i++)
+	{
+		descriptorWrite.dstSet = computeSet;
+		descriptorWrite.dstBinding = i;
+		descriptorWrite.pBufferInfo = &bufferInfos[i];
+		descriptorWrites.push_back(descriptorWrite);
+	}
+
+	descriptorWrite.dstSet = modelSet;
+	descriptorWrite.dstBinding = 0;
+	descriptorWrite.pBufferInfo = &bufferInfos[0];
+	descriptorWrites.push_back(descriptorWrite);
+	descriptorWrite.dstBinding = 1;
+	descriptorWrite.pBufferInfo = &bufferInfos[3];
+	descriptorWrites.push_back(descriptorWrite);
+
+	if (mPhase == CULL_PHASE_LATE)
+	{
+		descriptorWrite.dstSet = computeSet;
+		descriptorWrite.dstBinding = getStorageBindingCount();
+		descriptorWrite.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+		descriptorWrite.pBufferInfo = nullptr;
+		descriptorWrite.pImageInfo = &pyramidInfo;
+		descriptorWrites.push_back(descriptorWrite);
+	}
+
+	vkUpdateDescriptorSets(mEngine->getDevice(), descriptorWrites.size(), descriptorWrites.data(), 0, nullptr);
+	mWrittenDescriptors[frameIndex] = descriptors;
+}
+
+/**
+ * @brief Replaces all buffers and descriptor sets with ones large enough for drawCount draws and instanceCount instances.
+ *
+ * Works like GPUMeshWrangler::growBuffers(); the replaced resources are retired, and if the new
+ * ones cannot be created, the current ones are kept.
+ *
+ * @param drawCount Number of draws which must fit.
+ * @param instanceCount Number of instances which must fit.
+ * @return Whether the buffers were replaced.
+ */
+bool GPUProcessCull::growBuffers(size_t drawCount, size_t instanceCount)
+{
+	RetiredResources retired = {};
+	retired.drawBuffer = mDrawBuffer;
+	retired.drawBufferMemory = mDrawBufferMemory;
+	retired.commandTemplateBuffer = mCommandTemplateBuffer;
+	retired.commandTemplateBufferMemory = mCommandTemplateBufferMemory;
+	retired.indirectBuffer = mIndirectBuffer;
+	retired.indirectBufferMemory = mIndirectBufferMemory;
+	retired.visibleBuffer = mVisibleBuffer;
+	retired.visibleBufferMemory = mVisibleBufferMemory;
+	retired.counterBuffer = mCounterBuffer;
+	retired.counterBufferMemory = mCounterBufferMemory;
+	retired.visibilityBuffer = mVisibilityBuffer;
+	retired.visibilityBufferMemory = mVisibilityBufferMemory;
+	retired.descriptorPool = mDescriptorPool;
+	retired.framesRemaining = mRegionCount;
+
+	std::vector<VkDescriptorSet> oldComputeDescriptorSets = mComputeDescriptorSets;
+	std::vector<VkDescriptorSet> oldModelDescriptorSets = mModelDescriptorSets;
+	std::vector<WrittenDescriptors> oldWrittenDescriptors = mWrittenDescriptors;
+	size_t oldDrawCapacity = mDrawCapacity;
+	size_t oldInstanceCapacity = mInstanceCapacity;
+	bool oldResetVisibility = mResetVisibility;
+	while (mDrawCapacity < drawCount)
+		mDrawCapacity *= 2;
+	while (mInstanceCapacity < instanceCount)
+		mInstanceCapacity *= 2;
+
+	mDrawBuffer = VK_NULL_HANDLE;
+	mDrawBufferMemory = {};
+	mCommandTemplateBuffer = VK_NULL_HANDLE;
+	mCommandTemplateBufferMemory = {};
+	mIndirectBuffer = VK_NULL_HANDLE;
+	mIndirectBufferMemory = {};
+	mVisibleBuffer = VK_NULL_HANDLE;
+	mVisibleBufferMemory = {};
+	mCounterBuffer = VK_NULL_HANDLE;
+	mCounterBufferMemory = {};
+	mVisibilityBuffer = VK_NULL_HANDLE;
+	mVisibilityBufferMemory = {};
+	mDescriptorPool = VK_NULL_HANDLE;
+
+	if (!createBuffers() || !createDescriptorSets())
+	{
+		vkDestroyDescriptorPool(mEngine->getDevice(), mDescriptorPool, nullptr);
+		destroyBuffers();
+
+		mDrawBuffer = retired.drawBuffer;
+		mDrawBufferMemory = retired.drawBufferMemory;
+		mCommandTemplateBuffer = retired.commandTemplateBuffer;
+		mCommandTemplateBufferMemory = retired.commandTemplateBufferMemory;
+		mIndirectBuffer = retired.indirectBuffer;
+		mIndirectBufferMemory = retired.indirectBufferMemory;
+		mVisibleBuffer = retired.visibleBuffer;
+		mVisibleBufferMemory = retired.visibleBufferMemory;
+		mCounterBuffer = retired.counterBuffer;
+		mCounterBufferMemory = retired.counterBufferMemory;
+		mVisibilityBuffer = retired.visibilityBuffer;
+		mVisibilityBufferMemory = retired.visibilityBufferMemory;
+		mDescriptorPool = retired.descriptorPool;
+		mComputeDescriptorSets = oldComputeDescriptorSets;
+		mModelDescriptorSets = oldModelDescriptorSets;
+		mWrittenDescriptors = oldWrittenDescriptors;
+		mDrawCapacity = oldDrawCapacity;
+		mInstanceCapacity = oldInstanceCapacity;
+		mResetVisibility = oldResetVisibility;
+		mPRIndirectBuffer->setPossibleValues({ mIndirectBuffer });
+		return false;
+	}
+
+	mRetiredResources.push_back(retired);
+	return true;
+}
+
+/**
+ * @brief Destroys retired resources which are no longer in use by any frame in flight.
+ *
+ * @param all Whether to destroy all retired resources regardless, I.E. because the device is idle.
+ */
+void GPUProcessCull::releaseRetiredResources(bool all)
+{
+	size_t kept = 0;
+	for (auto& retired : mRetiredResources)
+	{
+		if (!all && --retired.framesRemaining > 0)
+		{
+			mRetiredResources[kept++] = retired;
+			continue;
+		}
+
+		vkDestroyDescriptorPool(mEngine->getDevice(), retired.descriptorPool, nullptr);
+		mEngine->destroyBuffer(retired.drawBuffer, retired.drawBufferMemory);
+		mEngine->destroyBuffer(retired.commandTemplateBuffer, retired.commandTemplateBufferMemory);
+		mEngine->destroyBuffer(retired.indirectBuffer, retired.indirectBufferMemory);
+		mEngine->destroyBuffer(retired.visibleBuffer, retired.visibleBufferMemory);
+		mEngine->destroyBuffer(retired.counterBuffer, retired.counterBufferMemory);
+		mEngine->destroyBuffer(retired.visibilityBuffer, retired.visibilityBufferMemory);
+	}
+	mRetiredResources.resize(kept);
+}
+
+void GPUProcessCull::destroyBuffers()
+{
+	mEngine->destroyBuffer(mDrawBuffer, mDrawBufferMemory);
+	mEngine->destroyBuffer(mCommandTemplateBuffer, mCommandTemplateBufferMemory);
+	mEngine->destroyBuffer(mIndirectBuffer, mIndirectBufferMemory);
+	mEngine->destroyBuffer(mVisibleBuffer, mVisibleBufferMemory);
+	mEngine->destroyBuffer(mCounterBuffer, mCounterBufferMemory);
+	mEngine->destroyBuffer(mVisibilityBuffer, mVisibilityBufferMemory);
+}
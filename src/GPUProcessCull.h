@@ -0,0 +1,198 @@
+#ifndef GPUPROCESSCULL_H
+#define GPUPROCESSCULL_H
+
+#include <memory>
+#include <vector>
+#include <vulkan/vulkan.h>
+
+#include "GPUProcess.h"
+#include "GPUMesh.h"
+#include "GPUMemoryAllocator.h"
+#include "glm_includes.h"
+
+class GPUEngine;
+
+/**
+ * @brief A GPUProcess which culls mesh instances against the view frustum in a compute shader.
+ *
+ * Each frame, one draw is set up for each of the GPUMeshWrangler's instance batches, holding the
+ * batch's range of instances and the bounding sphere of its mesh. A compute shader then tests
+ * every instance's transformed bounding sphere against the frustum of the wrangler's view-projection
+ * matrix, and appends each visible instance's transform index to its draw's range of a compacted
+ * visible instance list, counting it in the draw's VkDrawIndexedIndirectCommand. A
+ * GPUProcessRenderPass which uses this process draws each batch with vkCmdDrawIndexedIndirect,
+ * and its shaders look up transforms through the visible instance list, so the CPU never needs
+ * to know which instances are visible. Consecutive batches whose meshes share a GPUGeometryPool
+ * block are drawn with a single multi-draw indirect call where the device supports it. The wrangler's own frustum culling is disabled, since
+ * every instance must reach the transform buffer.
+ *
+ * The indirect command buffer is passed to the render pass through a PassableResource, so that
+ * the GPUDependencyGraph orders the compute work before the render pass and places a barrier
+ * between them; the visible instance list is written and read at the same stages, and is
+ * covered by the same barrier. The work is submitted to the graphics queue.
+ *
+ * Occlusion culling is done in two phases, each performed by its own GPUProcessCull and drawn by
+ * its own render pass. The early phase draws the instances which were visible in the previous
+ * frame. A GPUProcessDepthPyramid then builds a depth pyramid from the early render pass's depth
+ * buffer, and the late phase tests every instance against it: visible instances which the early
+ * phase did not draw are drawn by the late render pass, and each instance's visibility is kept
+ * for the next frame's early phase. No instance which is visible can be missed, since the late
+ * phase tests all of them.
+ * 
+ * Each phase counts the instances it draws, and the instances it culls, for tuning. The counts
+ * are read back when a frame's buffer region is used again, so they lag a few frames behind.
+ * 
+ * Like the wrangler's buffers, every buffer has a region for each frame in flight, and grows
+ * by doubling. Growing only happens when the wrangler's instance batches change, which advances
+ * its generation counter, so command buffers cached by render passes are recorded again.
+ */
+class GPUProcessCull : public GPUProcess
+{
+public:
+	static constexpr uint32_t workgroupSize = 64;			// must match local_size_x in cull_common.glsl
+	static constexpr size_t initialDrawCapacity = 64;
+	static constexpr VkDeviceSize counterRegionSize = 256;	// largest minimum storage buffer offset alignment
+
+	/**
+	 * @brief Which instances a GPUProcessCull draws.
+	 */
+	enum Phase
+	{
+		CULL_PHASE_ALL,		// every instance inside the view frustum
+		CULL_PHASE_EARLY,	// instances inside the view frustum which were visible in the previous frame
+		CULL_PHASE_LATE		// instances which pass occlusion culling, and which the early phase did not draw
+	};
+
+	// constructors and destructor
+	GPUProcessCull(Phase phase = CULL_PHASE_ALL);
+	GPUProcessCull(GPUProcessCull& other) = delete;
+	GPUProcessCull(GPUProcessCull&& other) = delete;
+	GPUProcessCull& operator=(GPUProcessCull& other) = delete;
+	~GPUProcessCull();
+
+	// public functionality
+	void bindModelDescriptor(VkCommandBuffer commandBuffer, VkPipelineBindPoint bindPoint, VkPipelineLayout pipelineLayout);
+	void drawIndirect(VkCommandBuffer commandBuffer, VkPipelineLayout pipelineLayout, size_t firstDraw, size_t drawCount);
+	void setEarlyPhase(GPUProcessCull* earlyPhase);
+	size_t getVisibleInstanceCount() { return mVisibleInstanceCount; }
+	size_t getFrustumCulledInstanceCount() { return mFrustumCulledInstanceCount; }
+	size_t getOccludedInstanceCount() { return mOccludedInstanceCount; }
+
+	// functions for setting up passable resource relationships
+	void setUniformBufferPR(const PassableResource<VkBuffer>* prUniformBuffer);
+	void setPyramidViewPR(const PassableImageView* prPyramidView);
+	const PassableResource<VkBuffer>* getPRIndirectBuffer();
+
+	// virtual functions inherited from GPUProcess
+	virtual std::vector<PRDependency> getPRDependencies();
+	virtual VkQueueFlags getNeededQueueType();
+	virtual VkCommandBuffer performOperation(VkCommandPool commandPool);
+	virtual void acquireLongtermResources();
+	virtual void cleanupFrameResources();
+
+private:
+	// layout of a draw in the draw buffer, matching DrawInfo in cull.comp
+	struct DrawInfo
+	{
+		glm::vec4 sphere;			// model-space bounding sphere of the mesh, with the radius in w
+		uint32_t firstInstance;
+		uint32_t instanceCount;
+		uint32_t pad[2];
+	};
+
+	// layout of the compute shader's push constants, matching cull_common.glsl
+	struct PushConstants
+	{
+		glm::mat4 viewProjection;
+		uint32_t instanceCount;
+		uint32_t drawCount;
+	};
+
+	// layout of the counter buffer, matching cull_common.glsl
+	struct Counters
+	{
+		uint32_t visible;
+		uint32_t frustumCulled;
+		uint32_t occluded;
+	};
+
+	// what each frame's descriptor sets point at, so that they are only rewritten when something changes
+	struct WrittenDescriptors
+	{
+		VkDescriptorBufferInfo transformBufferInfo;
+		VkBuffer visibilityBuffer;
+		VkImageView pyramidView;
+	};
+
+	// buffers replaced by growing, which may still be in use by frames in flight
+	struct RetiredResources
+	{
+		VkBuffer drawBuffer;
+		GPUMemoryAllocator::Allocation drawBufferMemory;
+		VkBuffer commandTemplateBuffer;
+		GPUMemoryAllocator::Allocation commandTemplateBufferMemory;
+		VkBuffer indirectBuffer;
+		GPUMemoryAllocator::Allocation indirectBufferMemory;
+		VkBuffer visibleBuffer;
+		GPUMemoryAllocator::Allocation visibleBufferMemory;
+		VkBuffer counterBuffer;
+		GPUMemoryAllocator::Allocation counterBufferMemory;
+		VkBuffer visibilityBuffer;
+		GPUMemoryAllocator::Allocation visibilityBufferMemory;
+		VkDescriptorPool descriptorPool;
+		uint32_t framesRemaining;
+	};
+
+	// private helper functions
+	bool createPipeline();
+	bool createBuffers();
+	bool createDescriptorSets();
+	bool growBuffers(size_t drawCount, size_t instanceCount);
+	void releaseRetiredResources(bool all);
+	void writeDescriptorSets(const WrittenDescriptors& descriptors);
+	void readCounters();
+	void destroyBuffers();
+	uint32_t getStorageBindingCount();
+
+	// private member variables
+	Phase mPhase;
+	GPUProcessCull* mEarlyPhase = nullptr;
+	const PassableResource<VkBuffer>* mPRUniformBuffer = nullptr;
+	const PassableImageView* mPRPyramidView = nullptr;
+	std::unique_ptr<PassableResource<VkBuffer>> mPRIndirectBuffer;
+	size_t mDrawCapacity = initialDrawCapacity;
+	size_t mDrawCount = 0;								// number of draws set up for the current frame
+	size_t mInstanceCapacity = 0;
+	uint32_t mRegionCount = 1;							// number of frames in flight the buffers were created for
+	std::vector<WrittenDescriptors> mWrittenDescriptors;	// indexed by frame in flight
+	std::vector<RetiredResources> mRetiredResources;
+	bool mResetVisibility = true;						// whether to mark every instance visible, I.E. after growing
+
+	// instance counts read back from the GPU
+	size_t mVisibleInstanceCount = 0;
+	size_t mFrustumCulledInstanceCount = 0;
+	size_t mOccludedInstanceCount = 0;
+
+	// Vulkan handles owned by GPUProcessCull
+	VkShaderModule mShaderModule = VK_NULL_HANDLE;
+	VkDescriptorSetLayout mComputeDescriptorLayout = VK_NULL_HANDLE;
+	VkPipelineLayout mPipelineLayout = VK_NULL_HANDLE;
+	VkPipeline mPipeline = VK_NULL_HANDLE;
+	VkDescriptorPool mDescriptorPool = VK_NULL_HANDLE;
+	std::vector<VkDescriptorSet> mComputeDescriptorSets;	// indexed by frame in flight
+	std::vector<VkDescriptorSet> mModelDescriptorSets;		// indexed by frame in flight
+	VkBuffer mDrawBuffer = VK_NULL_HANDLE;
+	GPUMemoryAllocator::Allocation mDrawBufferMemory;
+	VkBuffer mCommandTemplateBuffer = VK_NULL_HANDLE;
+	GPUMemoryAllocator::Allocation mCommandTemplateBufferMemory;
+	VkBuffer mIndirectBuffer = VK_NULL_HANDLE;
+	GPUMemoryAllocator::Allocation mIndirectBufferMemory;
+	VkBuffer mVisibleBuffer = VK_NULL_HANDLE;
+	GPUMemoryAllocator::Allocation mVisibleBufferMemory;
+	VkBuffer mCounterBuffer = VK_NULL_HANDLE;
+	GPUMemoryAllocator::Allocation mCounterBufferMemory;
+	VkBuffer mVisibilityBuffer = VK_NULL_HANDLE;			// only used by the early phase, and shared with the late phase
+	GPUMemoryAllocator::Allocation mVisibilityBufferMemory;
+};
+
+#endif
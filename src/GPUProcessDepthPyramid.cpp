@@ -0,0 +1,431 @@
+#include "GPUProcessDepthPyramid.h"
+
+#include <algorithm>
+#include <cassert>
+#include <fstream>
+#include <iterator>
+
+#include "GPUEngine.h"
+
+GPUProcessDepthPyramid::GPUProcessDepthPyramid()
+{
+	mPRPyramidView = std::make_unique<PassableImageView>(this, &mPyramidView);
+	mPRPyramidView->setState(VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT, VK_IMAGE_LAYOUT_GENERAL);
+	mPRPyramidView->setFormat(VK_FORMAT_R32_SFLOAT);
+}
+
+GPUProcessDepthPyramid::~GPUProcessDepthPyramid()
+{
+	VkDevice device = mEngine->getDevice();
+
+	cleanupFrameResources();
+	vkDestroyPipeline(device, mPipeline, nullptr);
+	vkDestroyPipelineLayout(device, mPipelineLayout, nullptr);
+	vkDestroyDescriptorSetLayout(device, mDescriptorLayout, nullptr);
+	vkDestroyShaderModule(device, mShaderModule, nullptr);
+}
+
+/**
+ * @brief Assign the PassableImageView of the depth buffer to build the pyramid from.
+ *
+ * The depth buffer must be sampleable, and is expected in VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL.
+ *
+ * @param prDepthView
+ */
+void GPUProcessDepthPyramid::setDepthViewPR(const PassableImageView* prDepthView)
+{
+	mPRDepthView = prDepthView;
+}
+
+/**
+ * @brief Returns a const pointer to the PassableImageView for a view of every level of the depth pyramid.
+ *
+ * @return const GPUProcess::PassableImageView*
+ */
+const GPUProcess::PassableImageView* GPUProcessDepthPyramid::getPRPyramidView()
+{
+	return mPRPyramidView.get();
+}
+
+std::vector<GPUProcess::PRDependency> GPUProcessDepthPyramid::getPRDependencies()
+{
+	return {
+		{mPRDepthView, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT, VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL}
+	};
+}
+
+VkQueueFlags GPUProcessDepthPyramid::getNeededQueueType()
+{
+	return VK_QUEUE_GRAPHICS_BIT;
+}
+
+void GPUProcessDepthPyramid::acquireLongtermResources()
+{
+	createPipeline();
+}
+
+void GPUProcessDepthPyramid::acquireFrameResources()
+{
+	createPyramid();
+	createDescriptorSets();
+}
+
+void GPUProcessDepthPyramid::cleanupFrameResources()
+{
+	VkDevice device = mEngine->getDevice();
+
+	vkDestroyDescriptorPool(device, mDescriptorPool, nullptr);
+	for (VkImageView levelView : mLevelViews)
+		vkDestroyImageView(device, levelView, nullptr);
+	vkDestroyImageView(device, mPyramidView, nullptr);
+	vkDestroyImage(device, mPyramidImage, nullptr);
+	if (mPyramidImage != VK_NULL_HANDLE)
+		mEngine->getMemoryAllocator()->free(mPyramidMemory);
+
+	mDescriptorPool = VK_NULL_HANDLE;
+	mDescriptorSets.clear();
+	mDepthViews.clear();
+	mLevelViews.clear();
+	mPyramidView = VK_NULL_HANDLE;
+	mPyramidImage = VK_NULL_HANDLE;
+	mLevelCount = 0;
+}
+
+VkCommandBuffer GPUProcessDepthPyramid::performOperation(VkCommandPool commandPool)
+{
+	if (mLevelCount == 0 || mDescriptorSets.empty())
+		return VK_NULL_HANDLE;
+
+	VkCommandBuffer commandBuffer = mEngine->allocateCommandBuffer(commandPool);
+	VkCommandBufferBeginInfo beginInfo = {};
+	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	beginInfo.pNext = nullptr;
+	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+	vkBeginCommandBuffer(commandBuffer, &beginInfo);
+
+	// the previous contents are discarded, once the previous frame's culling has finished reading them
+	{
+		VkImageMemoryBarrier barrier = {};
+		barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+		barrier.pNext = nullptr;
+		barrier.srcAccessMask = 0;
+		barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+		barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+		barrier.newLayout = VK_IMAGE_LAYOUT_GENERAL;
+		barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.image = mPyramidImage;
+		barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		barrier.subresourceRange.baseMipLevel = 0;
+		barrier.subresourceRange.levelCount = mLevelCount;
+		barrier.subresourceRange.baseArrayLayer = 0;
+		barrier.subresourceRange.layerCount = 1;
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+			0, 0, nullptr, 0, nullptr, 1, &barrier);
+	}
+
+	vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, mPipeline);
+
+	// build each level from the one before it, starting from the depth buffer
+	VkExtent2D sourceExtent = mPRDepthView->getExtent();
+	auto depthView = std::find(mDepthViews.begin(), mDepthViews.end(), mPRDepthView->getVkHandle());
+	assert(depthView != mDepthViews.end());
+	size_t depthViewIndex = std::distance(mDepthViews.begin(), depthView);
+	for (uint32_t level = 0; level < mLevelCount; level++)
+	{
+		if (level > 0)
+		{
+			VkMemoryBarrier barrier = {};
+			barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+			barrier.pNext = nullptr;
+			barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+			barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+			vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+				0, 1, &barrier, 0, nullptr, 0, nullptr);
+		}
+
+		VkExtent2D levelExtent = getLevelExtent(level);
+		PushConstants pushConstants = {
+			{ (int32_t) sourceExtent.width, (int32_t) sourceExtent.height },
+			{ (int32_t) levelExtent.width, (int32_t) levelExtent.height }
+		};
+
+		VkDescriptorSet descriptorSet = (level == 0) ? mDescriptorSets[depthViewIndex] : mDescriptorSets[mDepthViews.size() + level - 1];
+		vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, mPipelineLayout, 0, 1, &descriptorSet, 0, nullptr);
+		vkCmdPushConstants(commandBuffer, mPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(PushConstants), &pushConstants);
+		vkCmdDispatch(commandBuffer, (levelExtent.width + workgroupSize - 1) / workgroupSize, (levelExtent.height + workgroupSize - 1) / workgroupSize, 1);
+
+		sourceExtent = levelExtent;
+	}
+
+	vkEndCommandBuffer(commandBuffer);
+
+	return commandBuffer;
+}
+
+/**
+ * @brief Returns the extent of a level of the depth pyramid.
+ *
+ * @param level
+ * @return VkExtent2D
+ */
+VkExtent2D GPUProcessDepthPyramid::getLevelExtent(uint32_t level)
+{
+	return { std::max(mPyramidExtent.width >> level, 1u), std::max(mPyramidExtent.height >> level, 1u) };
+}
+
+/**
+ * @brief Loads the depth pyramid compute shader, and creates its descriptor set layout, pipeline layout and pipeline.
+ *
+ * @return Whether the pipeline was created successfully.
+ */
+bool GPUProcessDepthPyramid::createPipeline()
+{
+	VkDevice device = mEngine->getDevice();
+
+	// read compiled shader
+	std::ifstream infile("shaders/depth_pyramid_comp.spv", std::ios::ate | std::ios::binary);
+	if (!infile.is_open())
+		return false;
+	size_t fileSize = infile.tellg();
+	std::vector<char> fileBuffer(fileSize);
+	infile.seekg(0);
+	infile.read(fileBuffer.data(), fileSize);
+	infile.close();
+
+	VkShaderModuleCreateInfo moduleCreateInfo = {};
+	moduleCreateInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+	moduleCreateInfo.pNext = nullptr;
+	moduleCreateInfo.flags = 0;
+	moduleCreateInfo.codeSize = fileSize;
+	moduleCreateInfo.pCode = reinterpret_cast<uint32_t*>(fileBuffer.data());
+	if (vkCreateShaderModule(device, &moduleCreateInfo, nullptr, &mShaderModule) != VK_SUCCESS)
+		return false;
+
+	// the source level, and the level being built
+	VkDescriptorSetLayoutBinding bindings[2] = {};
+	bindings[0].binding = 0;
+	bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+	bindings[0].descriptorCount = 1;
+	bindings[0].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+	bindings[0].pImmutableSamplers = nullptr;
+	bindings[1].binding = 1;
+	bindings[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+	bindings[1].descriptorCount = 1;
+	bindings[1].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+	bindings[1].pImmutableSamplers = nullptr;
+
+	VkDescriptorSetLayoutCreateInfo layoutCreateInfo = {};
+	layoutCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+	layoutCreateInfo.pNext = nullptr;
+	layoutCreateInfo.flags = 0;
+	layoutCreateInfo.bindingCount = 2;
+	layoutCreateInfo.pBindings = bindings;
+	if (vkCreateDescriptorSetLayout(device, &layoutCreateInfo, nullptr, &mDescriptorLayout) != VK_SUCCESS)
+		return false;
+
+	VkPushConstantRange pushConstantRange = {};
+	pushConstantRange.offset = 0;
+	pushConstantRange.size = sizeof(PushConstants);
+	pushConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+	VkPipelineLayoutCreateInfo pipelineLayoutCreateInfo = {};
+	pipelineLayoutCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+	pipelineLayoutCreateInfo.pNext = nullptr;
+	pipelineLayoutCreateInfo.flags = 0;
+	pipelineLayoutCreateInfo.setLayoutCount = 1;
+	pipelineLayoutCreateInfo.pSetLayouts = &mDescriptorLayout;
+	pipelineLayoutCreateInfo.pushConstantRangeCount = 1;
+	pipelineLayoutCreateInfo.pPushConstantRanges = &pushConstantRange;
+	if (vkCreatePipelineLayout(device, &pipelineLayoutCreateInfo, nullptr, &mPipelineLayout) != VK_SUCCESS)
+		return false;
+
+	VkComputePipelineCreateInfo pipelineCreateInfo = {};
+	pipelineCreateInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+	pipelineCreateInfo.pNext = nullptr;
+	pipelineCreateInfo.flags = 0;
+	pipelineCreateInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+	pipelineCreateInfo.stage.pNext = nullptr;
+	pipelineCreateInfo.stage.flags = 0;
+	pipelineCreateInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+	pipelineCreateInfo.stage.module = mShaderModule;
+	pipelineCreateInfo.stage.pName = "main";
+	pipelineCreateInfo.stage.pSpecializationInfo = nullptr;
+	pipelineCreateInfo.layout = mPipelineLayout;
+	pipelineCreateInfo.basePipelineHandle = VK_NULL_HANDLE;
+	pipelineCreateInfo.basePipelineIndex = -1;
+	return (vkCreateComputePipelines(device, VK_NULL_HANDLE, 1, &pipelineCreateInfo, nullptr, &mPipeline) == VK_SUCCESS);
+}
+
+/**
+ * @brief Creates the depth pyramid image, a view of every level, and a view of each level.
+ *
+ * Each dimension of the first level is the largest power of two no larger than that of the depth
+ * buffer, so every level is exactly half the size of the one before it, and each of its texels
+ * covers at most three texels of the depth buffer in each direction.
+ *
+ * @return Whether the image and its views were created successfully.
+ */
+bool GPUProcessDepthPyramid::createPyramid()
+{
+	VkDevice device = mEngine->getDevice();
+
+	VkExtent2D depthExtent = mPRDepthView->getExtent();
+	mPyramidExtent = { 1, 1 };
+	while (mPyramidExtent.width * 2 <= depthExtent.width)
+		mPyramidExtent.width *= 2;
+	while (mPyramidExtent.height * 2 <= depthExtent.height)
+		mPyramidExtent.height *= 2;
+
+	uint32_t levelCount = 1;
+	while ((std::max(mPyramidExtent.width, mPyramidExtent.height) >> levelCount) > 0)
+		levelCount++;
+
+	VkImageCreateInfo createInfo = {};
+	createInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+	createInfo.pNext = nullptr;
+	createInfo.flags = 0;
+	createInfo.imageType = VK_IMAGE_TYPE_2D;
+	createInfo.format = VK_FORMAT_R32_SFLOAT;
+	createInfo.extent.width = mPyramidExtent.width;
+	createInfo.extent.height = mPyramidExtent.height;
+	createInfo.extent.depth = 1;
+	createInfo.mipLevels = levelCount;
+	createInfo.arrayLayers = 1;
+	createInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+	createInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+	createInfo.usage = VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+	createInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+	createInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	if (vkCreateImage(device, &createInfo, nullptr, &mPyramidImage) != VK_SUCCESS)
+		return false;
+
+	VkMemoryRequirements memoryRequirements;
+	vkGetImageMemoryRequirements(device, mPyramidImage, &memoryRequirements);
+	if (!mEngine->getMemoryAllocator()->allocate(memoryRequirements, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, false, mPyramidMemory))
+	{
+		vkDestroyImage(device, mPyramidImage, nullptr);
+		mPyramidImage = VK_NULL_HANDLE;
+		return false;
+	}
+	vkBindImageMemory(device, mPyramidImage, mPyramidMemory.memory, mPyramidMemory.offset);
+
+	VkImageViewCreateInfo viewCreateInfo = {};
+	viewCreateInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+	viewCreateInfo.pNext = nullptr;
+	viewCreateInfo.flags = 0;
+	viewCreateInfo.image = mPyramidImage;
+	viewCreateInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+	viewCreateInfo.format = VK_FORMAT_R32_SFLOAT;
+	viewCreateInfo.components.r = VK_COMPONENT_SWIZZLE_R;
+	viewCreateInfo.components.g = VK_COMPONENT_SWIZZLE_G;
+	viewCreateInfo.components.b = VK_COMPONENT_SWIZZLE_B;
+	viewCreateInfo.components.a = VK_COMPONENT_SWIZZLE_A;
+	viewCreateInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	viewCreateInfo.subresourceRange.baseMipLevel = 0;
+	viewCreateInfo.subresourceRange.levelCount = levelCount;
+	viewCreateInfo.subresourceRange.baseArrayLayer = 0;
+	viewCreateInfo.subresourceRange.layerCount = 1;
+	if (vkCreateImageView(device, &viewCreateInfo, nullptr, &mPyramidView) != VK_SUCCESS)
+		return false;
+
+	mLevelViews.resize(levelCount, VK_NULL_HANDLE);
+	for (uint32_t level = 0; level < levelCount; level++)
+	{
+		viewCreateInfo.subresourceRange.baseMipLevel = level;
+		viewCreateInfo.subresourceRange.levelCount = 1;
+		if (vkCreateImageView(device, &viewCreateInfo, nullptr, &mLevelViews[level]) != VK_SUCCESS)
+			return false;
+	}
+
+	// only count the levels once every view exists, so that nothing is dispatched otherwise
+	mLevelCount = levelCount;
+
+	// set passable resource values
+	mPRPyramidView->setPossibleValues({ mPyramidView });
+	mPRPyramidView->setExtent(mPyramidExtent);
+	return true;
+}
+
+/**
+ * @brief Creates a descriptor pool and descriptor sets for building each level of the depth pyramid, and writes them.
+ *
+ * The first level reads the depth buffer, and every other level reads the level before it. The
+ * depth buffer may be a different view from frame to frame, so the first level gets a descriptor
+ * set for each of its possible views, followed by one set for each other level.
+ *
+ * @return Whether the descriptor sets were allocated successfully.
+ */
+bool GPUProcessDepthPyramid::createDescriptorSets()
+{
+	if (mLevelCount == 0)
+		return false;
+
+	VkDevice device = mEngine->getDevice();
+
+	mDepthViews = mPRDepthView->getPossibleValues();
+	if (mDepthViews.empty())
+		return false;
+	uint32_t setCount = mDepthViews.size() + mLevelCount - 1;
+
+	VkDescriptorPoolSize poolSizes[2] = {};
+	poolSizes[0].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+	poolSizes[0].descriptorCount = setCount;
+	poolSizes[1].type = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+	poolSizes[1].descriptorCount = setCount;
+
+	VkDescriptorPoolCreateInfo createInfo = {};
+	createInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+	createInfo.pNext = nullptr;
+	createInfo.flags = 0;
+	createInfo.maxSets = setCount;
+	createInfo.poolSizeCount = 2;
+	createInfo.pPoolSizes = poolSizes;
+	if (vkCreateDescriptorPool(device, &createInfo, nullptr, &mDescriptorPool) != VK_SUCCESS)
+		return false;
+
+	std::vector<VkDescriptorSetLayout> layouts(setCount, mDescriptorLayout);
+	mDescriptorSets.resize(setCount);
+	VkDescriptorSetAllocateInfo allocateInfo = {};
+	allocateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+	allocateInfo.pNext = nullptr;
+	allocateInfo.descriptorPool = mDescriptorPool;
+	allocateInfo.descriptorSetCount = setCount;
+	allocateInfo.pSetLayouts = layouts.data();
+	if (vkAllocateDescriptorSets(device, &allocateInfo, mDescriptorSets.data()) != VK_SUCCESS)
+		return false;
+
+	std::vector<VkDescriptorImageInfo> imageInfos(setCount * 2);
+	std::vector<VkWriteDescriptorSet> descriptorWrites(setCount * 2);
+	for (uint32_t set = 0; set < setCount; set++)
+	{
+		bool readsDepth = set < mDepthViews.size();
+		uint32_t level = readsDepth ? 0 : set - mDepthViews.size() + 1;
+
+		VkDescriptorImageInfo& sourceInfo = imageInfos[set * 2];
+		sourceInfo.sampler = mEngine->getNearestSampler();
+		sourceInfo.imageView = readsDepth ? mDepthViews[set] : mLevelViews[level - 1];
+		sourceInfo.imageLayout = readsDepth ? VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL : VK_IMAGE_LAYOUT_GENERAL;
+
+		VkDescriptorImageInfo& destinationInfo = imageInfos[set * 2 + 1];
+		destinationInfo.sampler = VK_NULL_HANDLE;
+		destinationInfo.imageView = mLevelViews[level];
+		destinationInfo.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+
+		for (uint32_t binding = 0; binding < 2; binding++)
+		{
+			VkWriteDescriptorSet& descriptorWrite = descriptorWrites[set * 2 + binding];
+			descriptorWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+			descriptorWrite.pNext = nullptr;
+			descriptorWrite.dstSet = mDescriptorSets[set];
+			descriptorWrite.dstBinding = binding;
+			descriptorWrite.dstArrayElement = 0;
+			descriptorWrite.descriptorCount = 1;
+			descriptorWrite.descriptorType = (binding == 0) ? VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER : VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+			descriptorWrite.pImageInfo = &imageInfos[set * 2 + binding];
+		}
+	}
+
+	vkUpdateDescriptorSets(device, descriptorWrites.size(), descriptorWrites.data(), 0, nullptr);
+	return true;
+}
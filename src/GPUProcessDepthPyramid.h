@@ -0,0 +1,85 @@
+#ifndef GPUPROCESSDEPTHPYRAMID_H
+#define GPUPROCESSDEPTHPYRAMID_H
+
+#include <memory>
+#include <vector>
+#include <vulkan/vulkan.h>
+
+#include "GPUProcess.h"
+#include "GPUMemoryAllocator.h"
+
+class GPUEngine;
+
+/**
+ * @brief A GPUProcess which builds a depth pyramid from a depth buffer in a compute shader.
+ *
+ * The pyramid is an R32_SFLOAT image whose first level is the largest power of two no larger than
+ * the depth buffer in each direction, with a full mip chain. Each texel holds the farthest depth
+ * of the texels it covers in the level above it, so a bounding rectangle whose nearest depth is
+ * farther than every pyramid texel it covers is certainly hidden. Each level is built by its own
+ * dispatch, with a barrier between them.
+ *
+ * The depth buffer is passed in through a PassableImageView, I.E. from a GPUProcessRenderPass
+ * which keeps its attachments, and must be in VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL.
+ * The pyramid is passed out in VK_IMAGE_LAYOUT_GENERAL, I.E. to the late phase of a GPUProcessCull.
+ * Its resources are screen-sized, so they are recreated along with the other frame resources.
+ */
+class GPUProcessDepthPyramid : public GPUProcess
+{
+public:
+	static constexpr uint32_t workgroupSize = 8;	// must match local_size_x and local_size_y in depth_pyramid.comp
+
+	// constructors and destructor
+	GPUProcessDepthPyramid();
+	GPUProcessDepthPyramid(GPUProcessDepthPyramid& other) = delete;
+	GPUProcessDepthPyramid(GPUProcessDepthPyramid&& other) = delete;
+	GPUProcessDepthPyramid& operator=(GPUProcessDepthPyramid& other) = delete;
+	~GPUProcessDepthPyramid();
+
+	// functions for setting up passable resource relationships
+	void setDepthViewPR(const PassableImageView* prDepthView);
+	const PassableImageView* getPRPyramidView();
+
+	// virtual functions inherited from GPUProcess
+	virtual std::vector<PRDependency> getPRDependencies();
+	virtual VkQueueFlags getNeededQueueType();
+	virtual VkCommandBuffer performOperation(VkCommandPool commandPool);
+	virtual void acquireLongtermResources();
+	virtual void acquireFrameResources();
+	virtual void cleanupFrameResources();
+
+private:
+	// layout of the compute shader's push constants, matching depth_pyramid.comp
+	struct PushConstants
+	{
+		int32_t sourceSize[2];
+		int32_t destinationSize[2];
+	};
+
+	// private helper functions
+	bool createPipeline();
+	bool createPyramid();
+	bool createDescriptorSets();
+	VkExtent2D getLevelExtent(uint32_t level);
+
+	// private member variables
+	const PassableImageView* mPRDepthView = nullptr;
+	std::unique_ptr<PassableImageView> mPRPyramidView;
+	VkExtent2D mPyramidExtent = {};
+	uint32_t mLevelCount = 0;
+
+	// Vulkan handles owned by GPUProcessDepthPyramid
+	VkShaderModule mShaderModule = VK_NULL_HANDLE;
+	VkDescriptorSetLayout mDescriptorLayout = VK_NULL_HANDLE;
+	VkPipelineLayout mPipelineLayout = VK_NULL_HANDLE;
+	VkPipeline mPipeline = VK_NULL_HANDLE;
+	VkDescriptorPool mDescriptorPool = VK_NULL_HANDLE;
+	std::vector<VkImageView> mDepthViews;			// possible views of the depth buffer
+	std::vector<VkDescriptorSet> mDescriptorSets;	// one per depth view for the first level, then one per later level
+	VkImage mPyramidImage = VK_NULL_HANDLE;
+	GPUMemoryAllocator::Allocation mPyramidMemory;
+	VkImageView mPyramidView = VK_NULL_HANDLE;		// view of every level, which is passed out
+	std::vector<VkImageView> mLevelViews;			// indexed by pyramid level
+};
+
+#endif
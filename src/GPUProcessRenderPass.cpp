@@ -1,11 +1,15 @@
 #include "GPUProcessRenderPass.h"
 
+#include <algorithm>
+
 #include "GPUEngine.h"
 #include "glm_includes.h"
 
 GPUProcessRenderPass::GPUProcessRenderPass(size_t numSubpasses)
 {
-	mPRImageViewOut = std::make_unique<PassableResource<VkImageView>>(this, &mCurrentImageView);
+	mPRImageViewOut = std::make_unique<PassableImageView>(this, &mCurrentImageView);
+	mPRZBufferViewOut = std::make_unique<PassableImageView>(this, &mCurrentZBufferView);
+	setKeepAttachments(false);
 
 	mSubpasses.resize(numSubpasses);
 }
@@ -15,6 +19,8 @@ GPUProcessRenderPass::~GPUProcessRenderPass()
 	VkDevice device = mEngine->getDevice();
 
 	cleanupFrameResources();
+	cleanupSecondaryCommandPools();
+	vkDestroyCommandPool(device, mCachedCommandPool, nullptr);
 	vkDestroyRenderPass(device, mRenderPass, nullptr);
 }
 
@@ -32,6 +38,69 @@ GPUProcessRenderPass::Subpass* GPUProcessRenderPass::getSubpass(size_t index)
 	return &(((Subpass*)(mSubpasses.data()))[index]);
 }
 
+/**
+ * @brief Choose whether draws are recorded into secondary command buffers on worker threads.
+ * 
+ * Must be called before the GPUDependencyGraph is built. With many different meshes, recording
+ * chunks of their draws in parallel takes less time than recording all of them inline.
+ * 
+ * @param enabled Whether to record draws into secondary command buffers.
+ * @param drawsPerChunk Number of instanced draws recorded into each secondary command buffer.
+ */
+void GPUProcessRenderPass::setSecondaryCommandBuffers(bool enabled, size_t drawsPerChunk)
+{
+	mUseSecondaryCommandBuffers = enabled;
+	mDrawsPerChunk = (drawsPerChunk > 0) ? drawsPerChunk : 1;
+}
+
+/**
+ * @brief Choose whether recorded command buffers are kept and submitted again in later frames.
+ * 
+ * Must be called before the GPUDependencyGraph is built. When enabled, a command buffer is kept
+ * for each frame in flight and each possible color attachment, and is only recorded again when
+ * the GPUMeshWrangler's generation changes or frame resources are re-acquired; a static scene then
+ * costs almost no CPU time per frame. Since they are recorded so rarely, cached command buffers
+ * always record their draws inline.
+ * 
+ * @param enabled Whether to cache command buffers.
+ */
+void GPUProcessRenderPass::setCommandBufferCaching(bool enabled)
+{
+	mCacheCommandBuffers = enabled;
+}
+
+/**
+ * @brief Choose whether the attachments are loaded, instead of cleared, at the start of the render pass.
+ * 
+ * Must be called before the GPUDependencyGraph is built. Used by a render pass which continues
+ * drawing into the attachments of another one, whose attachments must be kept.
+ * 
+ * @param load Whether to load the color and depth attachments.
+ */
+void GPUProcessRenderPass::setLoadAttachments(bool load)
+{
+	mLoadAttachments = load;
+}
+
+/**
+ * @brief Choose whether the attachments are kept for another process, instead of being presented and discarded.
+ * 
+ * Must be called before the GPUDependencyGraph is built. The color attachment is left in
+ * VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, and the depth attachment is stored and left in
+ * VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL, so that it can also be sampled.
+ * 
+ * @param keep Whether to keep the color and depth attachments.
+ */
+void GPUProcessRenderPass::setKeepAttachments(bool keep)
+{
+	mKeepAttachments = keep;
+
+	mPRImageViewOut->setState(VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+		keep ? VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL : VK_IMAGE_LAYOUT_PRESENT_SRC_KHR);
+	mPRZBufferViewOut->setState(VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT, VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+		keep ? VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL : VK_IMAGE_LAYOUT_UNDEFINED);
+}
+
 /**
  * @brief Assign a PassableImageView for this GPURenderPass to render color information to.
  * 
@@ -61,7 +130,7 @@ void GPUProcessRenderPass::setZBufferViewPR(const PassableImageView* prZBufferVi
 }
 
 /**
- * @brief Assign a PassableResource<VkBuffer> for this GPURenderPass to read from as a uniform buffer.
+ * @brief Assign a PassableResource<VkBuffer> for this GPURenderPass to read from as the transform storage buffer.
  * 
  * It is currently assumed that the passed prUniformBuffer belongs to the GPUEngine's GPUMeshWrangler.
  * This relationship will probably be changed later so that the GPUProcessRenderPass can automatically
@@ -75,28 +144,68 @@ void GPUProcessRenderPass::setUniformBufferPR(const PassableResource<VkBuffer>*
 }
 
 /**
- * @brief Get a const pointer to a PassableResource<VkImageView> that can be passed to another process.
+ * @brief Assign a GPUProcessCull whose indirect draws this GPURenderPass performs, instead of drawing every instance batch directly.
+ * 
+ * Must be called before the GPUDependencyGraph is built. A dependency on the GPUProcessCull's
+ * indirect command buffer is added, so that culling is performed before the render pass.
+ * Every subpass's shader must have an "_indirect" vertex shader variant.
+ * 
+ * @param cullProcess 
+ */
+void GPUProcessRenderPass::setCullProcess(GPUProcessCull* cullProcess)
+{
+	mCullProcess = cullProcess;
+}
+
+/**
+ * @brief Get a const pointer to a PassableImageView that can be passed to another process.
  * 
  * This must be used to syncronize presentation of the color attachment after rendering.
- * When the PassableResource returned by getImageViewOutPR() is passed to a GPUProcessPresent,
+ * When the PassableImageView returned by getImageViewOutPR() is passed to a GPUProcessPresent,
  * this GPUProcessRenderPass's color attachment must be obtained from the corresponding GPUProcessSwapchain.
+ * If the attachments are kept, it can instead be passed to another GPUProcessRenderPass which loads them.
  * This function will later be useful to facilitate render-to-texture, although other functionality
  * must first be implemented to support that.
  * 
- * @return const GPUProcess::PassableResource<VkImageView>* 
+ * @return const GPUProcess::PassableImageView* 
  */
-const GPUProcess::PassableResource<VkImageView>* GPUProcessRenderPass::getImageViewOutPR()
+const GPUProcess::PassableImageView* GPUProcessRenderPass::getImageViewOutPR()
 {
 	return mPRImageViewOut.get();
 }
 
+/**
+ * @brief Get a const pointer to a PassableImageView for the depth attachment, which can be passed to another process.
+ * 
+ * Only useful if the attachments are kept; the depth attachment can then be sampled, or loaded
+ * by another GPUProcessRenderPass.
+ * 
+ * @return const GPUProcess::PassableImageView* 
+ */
+const GPUProcess::PassableImageView* GPUProcessRenderPass::getZBufferViewOutPR()
+{
+	return mPRZBufferViewOut.get();
+}
+
 std::vector<GPUProcess::PRDependency>  GPUProcessRenderPass::getPRDependencies()
 {
-	return std::vector<PRDependency>({ 
-		{mPRImageView, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT},
-		{mPRUniformBuffer, VK_PIPELINE_STAGE_VERTEX_SHADER_BIT},
-		{mPRZBufferView, VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT}
+	VkAccessFlags colorAccess = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+	if (mLoadAttachments)
+		colorAccess |= VK_ACCESS_COLOR_ATTACHMENT_READ_BIT;
+
+	std::vector<PRDependency> dependencies({ 
+		{mPRImageView, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, colorAccess},
+		{mPRUniformBuffer, VK_PIPELINE_STAGE_VERTEX_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT},
+		{mPRZBufferView, VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT,
+			VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT}
 	});
+
+	// the visible instance list is written along with the indirect commands, so this dependency covers both
+	if (mCullProcess)
+		dependencies.push_back({mCullProcess->getPRIndirectBuffer(), VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT,
+			VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_SHADER_READ_BIT});
+
+	return dependencies;
 }
 
 VkQueueFlags GPUProcessRenderPass::getNeededQueueType()
@@ -108,16 +217,52 @@ VkCommandBuffer GPUProcessRenderPass::performOperation(VkCommandPool commandPool
 {
 	// Acquire passed-in resources
 	mCurrentImageView = (VkImageView)mPRImageView->getVkHandle();
+	mCurrentZBufferView = (VkImageView)mPRZBufferView->getVkHandle();
+
+	if (mCacheCommandBuffers)
+	{
+		// this frame's previous submission of the cached command buffer has completed, so it can be re-recorded
+		auto& cached = mCachedCommandBuffers[mEngine->getFrameIndex()][mCurrentImageView];
+		uint64_t generation = mEngine->getMeshWrangler()->getGeneration();
+		if (cached.commandBuffer != VK_NULL_HANDLE && cached.generation == generation)
+			return cached.commandBuffer;
+
+		if (cached.commandBuffer == VK_NULL_HANDLE)
+		{
+			VkCommandBufferAllocateInfo allocateInfo = {};
+			allocateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+			allocateInfo.pNext = nullptr;
+			allocateInfo.commandPool = mCachedCommandPool;
+			allocateInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+			allocateInfo.commandBufferCount = 1;
+			vkAllocateCommandBuffers(mEngine->getDevice(), &allocateInfo, &cached.commandBuffer);
+		}
+
+		recordCommandBuffer(cached.commandBuffer, 0, false);
+		cached.generation = generation;
+		return cached.commandBuffer;
+	}
 
-	// Record command buffer
 	VkCommandBuffer commandBuffer = mEngine->allocateCommandBuffer(commandPool);
+	recordCommandBuffer(commandBuffer, VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT, mUseSecondaryCommandBuffers);
+	return commandBuffer;
+}
 
+/**
+ * @brief Records the render pass into commandBuffer, using the framebuffer for the current image view.
+ * 
+ * @param commandBuffer Primary command buffer to record into.
+ * @param usage Usage flags with which to begin the command buffer.
+ * @param useSecondaryCommandBuffers Whether to record draws into secondary command buffers.
+ */
+void GPUProcessRenderPass::recordCommandBuffer(VkCommandBuffer commandBuffer, VkCommandBufferUsageFlags usage, bool useSecondaryCommandBuffers)
+{
 	// begin recording
 	{
 		VkCommandBufferBeginInfo beginInfo = {};
 		beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
 		beginInfo.pNext = nullptr;
-		beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+		beginInfo.flags = usage;
 		beginInfo.pInheritanceInfo = nullptr;
 		vkBeginCommandBuffer(commandBuffer, &beginInfo);
 	}
@@ -126,39 +271,49 @@ VkCommandBuffer GPUProcessRenderPass::performOperation(VkCommandPool commandPool
 	{
 		std::vector<GPUMesh::AttributeType> attributeTypes = {GPUMesh::MESH_ATTRIBUTE_POSITION, GPUMesh::MESH_ATTRIBUTE_NORMAL};
 
-		glm::vec3 tvec = { 0.0f, 0.0f, -3.0f };
-		auto extent = mEngine->getSurfaceExtent();
-		glm::mat4 viewProjection = glm::perspective(45.0f, ((float)extent.width / (float)extent.height), 0.01f, 100.0f) * glm::translate(glm::identity<glm::mat4>(), tvec);
+		// the same matrix is used by the GPUMeshWrangler to cull instances
+		glm::mat4 viewProjection = mEngine->getMeshWrangler()->getViewProjection();
 
 		VkClearValue clearValues[2];
 		clearValues[0].color = { 0.8f, 0.1f, 0.3f, 1.0f };
 		clearValues[1].depthStencil = { 1.0f, 0 };
 
+		VkFramebuffer framebuffer = mFramebuffers.find(mCurrentImageView)->second;
+		auto& batches = mEngine->getMeshWrangler()->getInstanceBatches();
+
 		VkRenderPassBeginInfo beginInfo = {};
 		beginInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
 		beginInfo.pNext = nullptr;
 		beginInfo.renderPass = mRenderPass;
-		beginInfo.framebuffer = mFramebuffers.find(mCurrentImageView)->second;
+		beginInfo.framebuffer = framebuffer;
 		beginInfo.renderArea.offset = { 0, 0 };
 		beginInfo.renderArea.extent = mEngine->getSurfaceExtent();
 		beginInfo.clearValueCount = 2;
 		beginInfo.pClearValues = clearValues;
-		vkCmdBeginRenderPass(commandBuffer, &beginInfo, VK_SUBPASS_CONTENTS_INLINE);
+
+		VkSubpassContents contents = useSecondaryCommandBuffers ? VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS : VK_SUBPASS_CONTENTS_INLINE;
+		vkCmdBeginRenderPass(commandBuffer, &beginInfo, contents);
 
 		// iterate through all subpasses
-		mSubpasses[0].draw(commandBuffer, mEngine, &viewProjection);
-		for(size_t i=1; i<mSubpasses.size(); i++)
+		for(uint32_t i=0; i<mSubpasses.size(); i++)
 		{
-			vkCmdNextSubpass(commandBuffer, VK_SUBPASS_CONTENTS_INLINE);
-			mSubpasses[i].draw(commandBuffer, mEngine, &viewProjection);
+			if (i > 0)
+				vkCmdNextSubpass(commandBuffer, contents);
+
+			if (useSecondaryCommandBuffers)
+			{
+				recordSecondaryCommandBuffers(i, framebuffer, &viewProjection, batches);
+				if (!mSecondaryCommandBuffers.empty())
+					vkCmdExecuteCommands(commandBuffer, mSecondaryCommandBuffers.size(), mSecondaryCommandBuffers.data());
+			}
+			else
+				mSubpasses[i].draw(commandBuffer, mEngine, &viewProjection, batches, 0, batches.size(), mCullProcess);
 		}
 
 		vkCmdEndRenderPass(commandBuffer);
 	}
 
 	vkEndCommandBuffer(commandBuffer);
-
-	return commandBuffer;
 }
 
 void GPUProcessRenderPass::acquireLongtermResources()
@@ -168,7 +323,23 @@ void GPUProcessRenderPass::acquireLongtermResources()
 
 	// acquire long-term subpass resources
 	for(uint32_t i=0; i<mSubpasses.size(); i++)
-		mSubpasses[i].acquireLongtermResources(mRenderPass, i, mEngine);
+		mSubpasses[i].acquireLongtermResources(mRenderPass, i, mEngine, mCullProcess != nullptr);
+
+	if (mUseSecondaryCommandBuffers && !mCacheCommandBuffers)
+		createSecondaryCommandPools();
+
+	// cached command buffers are re-recorded individually, so their pool must allow resetting them
+	if (mCacheCommandBuffers && mCachedCommandPool == VK_NULL_HANDLE)
+	{
+		VkCommandPoolCreateInfo createInfo = {};
+		createInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+		createInfo.pNext = nullptr;
+		createInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+		createInfo.queueFamilyIndex = mEngine->getGraphicsQueueFamily();
+		vkCreateCommandPool(mEngine->getDevice(), &createInfo, nullptr, &mCachedCommandPool);
+
+		mCachedCommandBuffers.resize(mEngine->getFramesInFlight());
+	}
 }
 
 void GPUProcessRenderPass::acquireFrameResources()
@@ -203,7 +374,15 @@ void GPUProcessRenderPass::acquireFrameResources()
 	}
 
 	// set up resources that are passed out
+	VkExtent2D extent = mPRImageView->getExtent();
 	mPRImageViewOut->setPossibleValues(mPRImageView->getPossibleValues());
+	mPRImageViewOut->setExtent(extent);
+	mPRImageViewOut->setFormat(mPRImageView->getFormat());
+
+	VkExtent2D zBufferExtent = mPRZBufferView->getExtent();
+	mPRZBufferViewOut->setPossibleValues(mPRZBufferView->getPossibleValues());
+	mPRZBufferViewOut->setExtent(zBufferExtent);
+	mPRZBufferViewOut->setFormat(mPRZBufferView->getFormat());
 }
 
 void GPUProcessRenderPass::cleanupFrameResources()
@@ -217,6 +396,14 @@ void GPUProcessRenderPass::cleanupFrameResources()
 
 	mFramebuffers.clear();
 
+	// cached command buffers refer to the framebuffers
+	for (auto& frameCommandBuffers : mCachedCommandBuffers)
+	{
+		for (auto& cached : frameCommandBuffers)
+			vkFreeCommandBuffers(device, mCachedCommandPool, 1, &cached.second.commandBuffer);
+		frameCommandBuffers.clear();
+	}
+
 	for(auto& subpass : mSubpasses)
 		subpass.cleanupFrameResources();
 }
@@ -260,6 +447,23 @@ std::vector<VkSubpassDependency> GPUProcessRenderPass::generateSubpassDependenci
 
 	// generate dependencies
 	std::vector<VkSubpassDependency> dependencies;
+
+	// attachments may still be written by the previous frame in flight, or by an earlier user of
+	// memory they alias, and the swapchain image's layout transition must wait for the semaphore
+	// which guards it
+	{
+		VkSubpassDependency dependency{};
+		dependency.srcSubpass = VK_SUBPASS_EXTERNAL;
+		dependency.dstSubpass = 0;
+		dependency.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+		dependency.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT;
+		dependency.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+		dependency.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+		if (mLoadAttachments)
+			dependency.dstAccessMask |= VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT;
+		dependencies.push_back(dependency);
+	}
+
 	for(size_t laterIndex=1; laterIndex<mSubpasses.size(); laterIndex++)
 	{
 		for(size_t earlierIndex = 0; earlierIndex < laterIndex; earlierIndex++)
@@ -305,16 +509,24 @@ bool GPUProcessRenderPass::createRenderPass()
 {
 	// create render pass
 	std::vector<Attachment> attachments(2);
+	VkAttachmentLoadOp loadOp = mLoadAttachments ? VK_ATTACHMENT_LOAD_OP_LOAD : VK_ATTACHMENT_LOAD_OP_CLEAR;
+
 	Attachment& colorAttachment = attachments[0];
 	colorAttachment.setPRImageViewIn(mPRImageView);
-	colorAttachment.setLoadOp(VK_ATTACHMENT_LOAD_OP_CLEAR);
+	colorAttachment.setLoadOp(loadOp);
 	colorAttachment.setStoreOp(VK_ATTACHMENT_STORE_OP_STORE);
-	colorAttachment.setFinalLayout(VK_IMAGE_LAYOUT_PRESENT_SRC_KHR);
+	colorAttachment.setFinalLayout(mPRImageViewOut->getLayout());
 
 	Attachment& depthAttachcment = attachments[1];
 	depthAttachcment.setPRImageViewIn(mPRZBufferView);
-	depthAttachcment.setLoadOp(VK_ATTACHMENT_LOAD_OP_CLEAR);
-	depthAttachcment.setFinalLayout(VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL);
+	depthAttachcment.setLoadOp(loadOp);
+	if (mKeepAttachments)
+	{
+		depthAttachcment.setStoreOp(VK_ATTACHMENT_STORE_OP_STORE);
+		depthAttachcment.setFinalLayout(VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL);
+	}
+	else
+		depthAttachcment.setFinalLayout(VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL);
 
 	std::vector<VkAttachmentDescription> attachmentDescriptions(attachments.size());
 	for(size_t i=0; i<attachments.size(); i++)
@@ -345,6 +557,133 @@ bool GPUProcessRenderPass::createRenderPass()
 	return true;
 }
 
+/**
+ * @brief Creates a set of command pools for each frame in flight, used to record secondary command buffers.
+ * 
+ * Each thread of the engine's worker pool gets its own command pool, so that no pool is used by two threads at once.
+ */
+void GPUProcessRenderPass::createSecondaryCommandPools()
+{
+	cleanupSecondaryCommandPools();
+
+	// the thread calling performOperation() records too
+	uint32_t threadCount = mEngine->getWorkerPool()->getThreadCount();
+
+	VkCommandPoolCreateInfo createInfo = {};
+	createInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+	createInfo.pNext = nullptr;
+	createInfo.flags = 0;
+	createInfo.queueFamilyIndex = mEngine->getGraphicsQueueFamily();
+
+	mSecondaryCommandPools.resize(mEngine->getFramesInFlight());
+	for (auto& framePools : mSecondaryCommandPools)
+	{
+		framePools.resize(threadCount);
+		for (auto& pool : framePools)
+			vkCreateCommandPool(mEngine->getDevice(), &createInfo, nullptr, &pool.pool);
+	}
+}
+
+/**
+ * @brief Destroys the command pools used to record secondary command buffers.
+ */
+void GPUProcessRenderPass::cleanupSecondaryCommandPools()
+{
+	for (auto& framePools : mSecondaryCommandPools)
+		for (auto& pool : framePools)
+			vkDestroyCommandPool(mEngine->getDevice(), pool.pool, nullptr);
+	mSecondaryCommandPools.clear();
+}
+
+/**
+ * @brief Hands out the next secondary command buffer from pool, allocating one if every command buffer is in use.
+ */
+VkCommandBuffer GPUProcessRenderPass::getSecondaryCommandBuffer(SecondaryCommandPool& pool)
+{
+	if (pool.nextCommandBuffer == pool.commandBuffers.size())
+	{
+		VkCommandBufferAllocateInfo allocateInfo = {};
+		allocateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+		allocateInfo.pNext = nullptr;
+		allocateInfo.commandPool = pool.pool;
+		allocateInfo.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+		allocateInfo.commandBufferCount = 1;
+
+		VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
+		vkAllocateCommandBuffers(mEngine->getDevice(), &allocateInfo, &commandBuffer);
+		pool.commandBuffers.push_back(commandBuffer);
+	}
+
+	return pool.commandBuffers[pool.nextCommandBuffer++];
+}
+
+/**
+ * @brief Records a subpass's draws into secondary command buffers, one for each chunk of instance batches.
+ * 
+ * Chunks are split across recording jobs by index, and each job records into its own command pool.
+ * The resulting secondary command buffers are left in mSecondaryCommandBuffers, in chunk order.
+ * 
+ * @param subpass Index of the subpass to record.
+ * @param framebuffer The framebuffer the render pass is being performed on.
+ * @param viewProjection The view-projection matrix to push to the shaders.
+ * @param batches The instance batches to draw.
+ */
+void GPUProcessRenderPass::recordSecondaryCommandBuffers(uint32_t subpass, VkFramebuffer framebuffer, glm::mat4* viewProjection,
+	const std::vector<GPUMeshWrangler::InstanceBatch>& batches)
+{
+	auto& framePools = mSecondaryCommandPools[mEngine->getFrameIndex()];
+
+	// the GPU has finished with this frame's previous secondary command buffers, so they can be reused
+	if (subpass == 0)
+	{
+		for (auto& pool : framePools)
+		{
+			vkResetCommandPool(mEngine->getDevice(), pool.pool, 0);
+			pool.nextCommandBuffer = 0;
+		}
+	}
+
+	size_t chunkCount = (batches.size() + mDrawsPerChunk - 1) / mDrawsPerChunk;
+	uint32_t jobCount = (chunkCount < framePools.size()) ? chunkCount : framePools.size();
+	mSecondaryCommandBuffers.resize(chunkCount);
+
+	VkCommandBufferInheritanceInfo inheritanceInfo = {};
+	inheritanceInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+	inheritanceInfo.pNext = nullptr;
+	inheritanceInfo.renderPass = mRenderPass;
+	inheritanceInfo.subpass = subpass;
+	inheritanceInfo.framebuffer = framebuffer;
+	inheritanceInfo.occlusionQueryEnable = VK_FALSE;
+	inheritanceInfo.queryFlags = 0;
+	inheritanceInfo.pipelineStatistics = 0;
+
+	VkCommandBufferBeginInfo beginInfo = {};
+	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	beginInfo.pNext = nullptr;
+	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT | VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT;
+	beginInfo.pInheritanceInfo = &inheritanceInfo;
+
+	auto job = [&](uint32_t jobIndex) {
+		for (size_t chunk = jobIndex; chunk < chunkCount; chunk += jobCount)
+		{
+			VkCommandBuffer commandBuffer = getSecondaryCommandBuffer(framePools[jobIndex]);
+			size_t first = chunk * mDrawsPerChunk;
+			size_t count = std::min(mDrawsPerChunk, batches.size() - first);
+
+			vkBeginCommandBuffer(commandBuffer, &beginInfo);
+			mSubpasses[subpass].draw(commandBuffer, mEngine, viewProjection, batches, first, count, mCullProcess);
+			vkEndCommandBuffer(commandBuffer);
+
+			mSecondaryCommandBuffers[chunk] = commandBuffer;
+		}
+	};
+
+	if (jobCount > 1)
+		mEngine->getWorkerPool()->run(jobCount, job);
+	else if (jobCount > 0)
+		job(0);
+}
+
 // !!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!
 //
 // GPUProcessRenderPass::Subpass implementation
@@ -388,15 +727,16 @@ void GPUProcessRenderPass::Subpass::setAttributeTypes(std::vector<GPUMesh::Attri
  * This includes shader loading and compilation, and creation of the pipeline.
  * 
  * @param renderPass 
+ * @param indirect Whether to use the vertex shader variant for indirect draws of culled instances.
  */
-void GPUProcessRenderPass::Subpass::acquireLongtermResources(VkRenderPass renderPass, uint32_t subpass, GPUEngine* engine)
+void GPUProcessRenderPass::Subpass::acquireLongtermResources(VkRenderPass renderPass, uint32_t subpass, GPUEngine* engine, bool indirect)
 {
 	std::vector<std::string> shaderFileNames;
 	std::vector<VkShaderStageFlagBits> shaderStages;
 
 	if(mShaderStageFlags & VK_SHADER_STAGE_VERTEX_BIT)
 	{
-		shaderFileNames.push_back(mShaderName + "_vert");
+		shaderFileNames.push_back(mShaderName + (indirect ? "_indirect_vert" : "_vert"));
 		shaderStages.push_back(VK_SHADER_STAGE_VERTEX_BIT);
 	}
 	if(mShaderStageFlags & VK_SHADER_STAGE_FRAGMENT_BIT)
@@ -434,17 +774,62 @@ VkSubpassDescription GPUProcessRenderPass::Subpass::getDescription()
 	};
 }
 
-void GPUProcessRenderPass::Subpass::draw(VkCommandBuffer commandBuffer, GPUEngine* engine, glm::mat4* viewProjection)
+/**
+ * @brief Records one instanced draw for each of a range of instance batches into commandBuffer.
+ * 
+ * Binds the pipeline and transform buffer and pushes the view-projection matrix first, so that the same
+ * function can be used for inline draws and for each secondary command buffer. With a GPUProcessCull,
+ * its descriptor set is bound instead, and each batch is drawn with its indirect draw. Geometry pool
+ * buffers are bound once for each run of batches whose meshes share a block, which with a
+ * GPUProcessCull is also drawn with a single multi-draw indirect call where supported.
+ * 
+ * @param commandBuffer Command buffer to record into, inside this subpass.
+ * @param engine The GPUEngine whose GPUMeshWrangler holds the instances' transform data.
+ * @param viewProjection The view-projection matrix to push to the shaders.
+ * @param batches The GPUMeshWrangler's instance batches.
+ * @param firstBatch Index of the first instance batch to draw.
+ * @param batchCount Number of instance batches to draw.
+ * @param cullProcess The GPUProcessCull which writes the indirect draws, or nullptr to draw directly.
+ */
+void GPUProcessRenderPass::Subpass::draw(VkCommandBuffer commandBuffer, GPUEngine* engine, glm::mat4* viewProjection,
+	const std::vector<GPUMeshWrangler::InstanceBatch>& batches, size_t firstBatch, size_t batchCount,
+	GPUProcessCull* cullProcess)
 {
 	VkPipelineLayout pipelineLayout = mPipeline->getLayout();
-	GPUMeshWrangler* meshWrangler = engine->getMeshWrangler();
 
 	mPipeline->bind(commandBuffer);
 	vkCmdPushConstants(commandBuffer, pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(glm::mat4), viewProjection);
-	for (auto instance : meshWrangler->getMeshInstances())
+
+	// geometry buffers are only bound again when a mesh is in a different geometry pool block
+	size_t endBatch = firstBatch + batchCount;
+	if (cullProcess)
+	{
+		cullProcess->bindModelDescriptor(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout);
+		for (size_t i = firstBatch; i < endBatch;)
+		{
+			GPUMesh* mesh = batches[i].mesh;
+			size_t runEnd = i + 1;
+			while (runEnd < endBatch && batches[runEnd].mesh->getGeometryBlock() == mesh->getGeometryBlock())
+				runEnd++;
+
+			mesh->bindBuffers(commandBuffer, mAttributeTypes);
+			cullProcess->drawIndirect(commandBuffer, pipelineLayout, i, runEnd - i);
+			i = runEnd;
+		}
+		return;
+	}
+
+	engine->getMeshWrangler()->bindModelDescriptor(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout);
+	uint32_t boundBlock = GPUGeometryPool::invalidBlock;
+	for (size_t i = firstBatch; i < endBatch; i++)
 	{
-		meshWrangler->bindModelDescriptor(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, instance);
-		instance->mMesh->draw(commandBuffer, mAttributeTypes);
+		GPUMesh* mesh = batches[i].mesh;
+		if (mesh->getGeometryBlock() != boundBlock)
+		{
+			mesh->bindBuffers(commandBuffer, mAttributeTypes);
+			boundBlock = mesh->getGeometryBlock();
+		}
+		mesh->draw(commandBuffer, batches[i].instanceCount, batches[i].firstInstance);
 	}
 }
 
@@ -458,7 +843,7 @@ VkAttachmentDescription GPUProcessRenderPass::Attachment::getDescription()
 		mStoreOp,
 		mStencilLoadOp,
 		mStencilStoreOp,
-		VK_IMAGE_LAYOUT_UNDEFINED,
+		(mLoadOp == VK_ATTACHMENT_LOAD_OP_LOAD) ? mPRImageViewIn->getLayout() : VK_IMAGE_LAYOUT_UNDEFINED,
 		mFinalLayout
 	};
 }
@@ -9,12 +9,30 @@
 #include "GPUEngine.h"
 #include "GPUPipeline.h"
 #include "GPUMesh.h"
+#include "GPUProcessCull.h"
 
 /**
  * @brief A GPUProcess which performs a render pass.
  * 
- * Currently renders all staged mesh isntances from the GPUEngine's GPUMeshWrangler.
- * Functionality needs to be expanded a lot to make more complex rendering possible.
+ * Currently renders all staged mesh isntances from the GPUEngine's GPUMeshWrangler, with one
+ * instanced draw call per InstanceBatch. Functionality needs to be expanded a lot to make more
+ * complex rendering possible.
+ * 
+ * Draws are recorded inline by default. If secondary command buffers are enabled, each
+ * subpass's draws are split into chunks instead, and each chunk is recorded into its own
+ * secondary command buffer by a worker thread; the secondary command buffers are executed in
+ * chunk order, so the result does not depend on how recording is scheduled.
+ * 
+ * If a GPUProcessCull is set, each InstanceBatch is drawn with an indirect draw whose instance
+ * count is written by the GPUProcessCull, and each subpass uses the "_indirect" variant of its
+ * vertex shader, which looks up transforms through the visible instance list.
+ * 
+ * Since meshes share the buffers of the GPUEngine's GPUGeometryPool, vertex and index buffers
+ * are only bound when the geometry block changes, normally once per command buffer.
+ * 
+ * For two-phase occlusion culling, two render passes draw into the same attachments: the first
+ * keeps its attachments for the second, which loads them instead of clearing them. The depth
+ * buffer kept by the first can be read in between, I.E. by a GPUProcessDepthPyramid.
  */
 class GPUProcessRenderPass : public GPUProcess
 {
@@ -54,12 +72,14 @@ public:
 		void preserve(uint32_t attachment);
 		void setAttributeTypes(std::vector<GPUMesh::AttributeType>&& attributeTypes);
 
-		void acquireLongtermResources(VkRenderPass renderPass, uint32_t subpass, GPUEngine* engine);
+		void acquireLongtermResources(VkRenderPass renderPass, uint32_t subpass, GPUEngine* engine, bool indirect);
 		void acquireFrameResources();
 		void cleanupFrameResources();
 		VkSubpassDescription getDescription();
 
-		void draw(VkCommandBuffer commandBuffer, GPUEngine* engine, glm::mat4* viewProjection);
+		void draw(VkCommandBuffer commandBuffer, GPUEngine* engine, glm::mat4* viewProjection,
+			const std::vector<GPUMeshWrangler::InstanceBatch>& batches, size_t firstBatch, size_t batchCount,
+			GPUProcessCull* cullProcess);
 
 	private:
 		std::vector<VkAttachmentReference> mInputAttachments;
@@ -73,6 +93,8 @@ public:
 		std::unique_ptr<GPUPipeline> mPipeline;
 	};
 
+	static constexpr size_t defaultDrawsPerChunk = 64;
+
 	// constructors and destructor
 	GPUProcessRenderPass(size_t numSubpasses);
 	GPUProcessRenderPass(GPUProcessRenderPass& other) = delete;
@@ -82,12 +104,18 @@ public:
 
 	// functions for setting up subpasses
 	Subpass* getSubpass(size_t index);
+	void setSecondaryCommandBuffers(bool enabled, size_t drawsPerChunk = defaultDrawsPerChunk);
+	void setCommandBufferCaching(bool enabled);
+	void setLoadAttachments(bool load);
+	void setKeepAttachments(bool keep);
 
 	// functions for setting up passable resource relationships
 	void setImageViewPR(const PassableImageView* prImageView);
 	void setUniformBufferPR(const PassableResource<VkBuffer>* prUniformBuffer);
 	void setZBufferViewPR(const PassableImageView* prZBufferView);
-	const PassableResource<VkImageView>* getImageViewOutPR();
+	void setCullProcess(GPUProcessCull* cullProcess);
+	const PassableImageView* getImageViewOutPR();
+	const PassableImageView* getZBufferViewOutPR();
 
 	// virtual functions inherited from GPUProcess
 	virtual std::vector<PRDependency> getPRDependencies();
@@ -98,19 +126,56 @@ public:
 	virtual void cleanupFrameResources();
 
 private:
+	// a command pool for secondary command buffers, which are handed out again every frame
+	struct SecondaryCommandPool
+	{
+		VkCommandPool pool = VK_NULL_HANDLE;
+		std::vector<VkCommandBuffer> commandBuffers;
+		size_t nextCommandBuffer = 0;
+	};
+
+	// a command buffer which is submitted again until the instances it draws change
+	struct CachedCommandBuffer
+	{
+		VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
+		uint64_t generation = 0;	// GPUMeshWrangler generation the command buffer was recorded for
+	};
+
 	// private helper functions
 	std::vector<VkSubpassDependency> generateSubpassDependencies();
 	bool createRenderPass();
+	void recordCommandBuffer(VkCommandBuffer commandBuffer, VkCommandBufferUsageFlags usage, bool useSecondaryCommandBuffers);
+	void createSecondaryCommandPools();
+	void cleanupSecondaryCommandPools();
+	VkCommandBuffer getSecondaryCommandBuffer(SecondaryCommandPool& pool);
+	void recordSecondaryCommandBuffers(uint32_t subpass, VkFramebuffer framebuffer, glm::mat4* viewProjection,
+		const std::vector<GPUMeshWrangler::InstanceBatch>& batches);
 
 	// private member variables
 	const PassableImageView* mPRImageView = nullptr;
 	const PassableImageView* mPRZBufferView = nullptr;
 	const PassableResource<VkBuffer>* mPRUniformBuffer = nullptr;
-	std::unique_ptr<PassableResource<VkImageView>> mPRImageViewOut;
+	GPUProcessCull* mCullProcess = nullptr;
+	std::unique_ptr<PassableImageView> mPRImageViewOut;
+	std::unique_ptr<PassableImageView> mPRZBufferViewOut;
 	VkImageView mCurrentImageView = VK_NULL_HANDLE;
+	VkImageView mCurrentZBufferView = VK_NULL_HANDLE;
+	bool mLoadAttachments = false;
+	bool mKeepAttachments = false;
 	VkRenderPass mRenderPass;
 	std::vector<Subpass> mSubpasses;
 	std::map<VkImageView, VkFramebuffer> mFramebuffers;
+
+	// secondary command buffer recording
+	bool mUseSecondaryCommandBuffers = false;
+	size_t mDrawsPerChunk = defaultDrawsPerChunk;
+	std::vector<std::vector<SecondaryCommandPool>> mSecondaryCommandPools;	// indexed by frame in flight, then by job
+	std::vector<VkCommandBuffer> mSecondaryCommandBuffers;					// secondary command buffers of the current subpass
+
+	// command buffer caching
+	bool mCacheCommandBuffers = false;
+	VkCommandPool mCachedCommandPool = VK_NULL_HANDLE;
+	std::vector<std::map<VkImageView, CachedCommandBuffer>> mCachedCommandBuffers;	// indexed by frame in flight
 };
 
 #endif
\ No newline at end of file
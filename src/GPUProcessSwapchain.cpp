@@ -9,6 +9,7 @@
 GPUProcessSwapchain::GPUProcessSwapchain()
 {
 	mPRCurrentImageView = std::make_unique<PassableImageView>(this, &currentImageView);
+	mPRCurrentImageView->setState(VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, 0, VK_IMAGE_LAYOUT_UNDEFINED);
 	mPresentProcess = new GPUProcessPresent(this);
 }
 
@@ -292,5 +293,5 @@ bool GPUProcessPresent::performOperation(std::vector<VkSemaphore> waitSemaphores
 
 std::vector<GPUProcess::PRDependency> GPUProcessPresent::getPRDependencies()
 {
-	return { {mPRImageViewIn} };
+	return { {mPRImageViewIn, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, VK_IMAGE_LAYOUT_PRESENT_SRC_KHR} };
 }
@@ -0,0 +1,358 @@
+#include "GPUStagingRing.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "GPUEngine.h"
+
+/**
+ * @brief Construct a new GPUStagingRing, allocating its staging buffer and per-slot objects.
+ *
+ * @param engine Pointer to the GPUEngine that this GPUStagingRing will use.
+ * @param ringSize Total size, in bytes, of the staging buffer.
+ * @param slotCount Number of slots the staging buffer is divided into.
+ */
+GPUStagingRing::GPUStagingRing(GPUEngine* engine, VkDeviceSize ringSize, uint32_t slotCount)
+{
+	mEngine = engine;
+	mTransferQueue = engine->getTransferQueue();
+	mGraphicsQueue = engine->getGraphicsQueue();
+	mTransferQueueFamily = engine->getTransferQueueFamily();
+	mGraphicsQueueFamily = engine->getGraphicsQueueFamily();
+	mOwnershipTransfer = (mTransferQueueFamily != mGraphicsQueueFamily);
+	mCopyAlignment = std::max<VkDeviceSize>(engine->getPhysicalDeviceLimits()->optimalBufferCopyOffsetAlignment, 16);
+	mSlotSize = ((ringSize / slotCount) / mCopyAlignment) * mCopyAlignment;
+
+	VkDevice device = engine->getDevice();
+
+	// create persistently mapped staging buffer
+	engine->createBuffer(mSlotSize * slotCount, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, mBuffer, mMemory);
+
+	// create command pools from which each slot's command buffers are allocated
+	VkCommandPoolCreateInfo poolCreateInfo = {};
+	poolCreateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+	poolCreateInfo.pNext = nullptr;
+	poolCreateInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT | VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+	poolCreateInfo.queueFamilyIndex = mTransferQueueFamily;
+	vkCreateCommandPool(device, &poolCreateInfo, nullptr, &mCommandPool);
+
+	if (mOwnershipTransfer)
+	{
+		poolCreateInfo.queueFamilyIndex = mGraphicsQueueFamily;
+		vkCreateCommandPool(device, &poolCreateInfo, nullptr, &mAcquireCommandPool);
+	}
+
+	// create slots
+	mSlots.resize(slotCount);
+	for (uint32_t i = 0; i < slotCount; i++)
+	{
+		mSlots[i].commandBuffer = engine->allocateCommandBuffer(mCommandPool);
+		mSlots[i].fence = engine->createFence(0);
+		mSlots[i].begin = mSlotSize * i;
+
+		if (mOwnershipTransfer)
+		{
+			mSlots[i].acquireCommandBuffer = engine->allocateCommandBuffer(mAcquireCommandPool);
+			mSlots[i].transferSemaphore = engine->createSemaphore();
+			mSlots[i].ownershipBarriers.reserve(maxOwnershipBarriers);
+		}
+	}
+}
+
+GPUStagingRing::~GPUStagingRing()
+{
+	waitIdle();
+
+	VkDevice device = mEngine->getDevice();
+
+	for (auto& slot : mSlots)
+	{
+		vkDestroyFence(device, slot.fence, nullptr);
+		vkDestroySemaphore(device, slot.transferSemaphore, nullptr);
+	}
+	vkDestroyCommandPool(device, mCommandPool, nullptr);
+	vkDestroyCommandPool(device, mAcquireCommandPool, nullptr);
+	mEngine->destroyBuffer(mBuffer, mMemory);
+}
+
+/**
+ * @brief Copies data into the ring and records a copy of it into a destination buffer.
+ *
+ * The data is copied into staging memory before upload() returns, so the caller is free
+ * to reuse or release it immediately. The transfer to the destination buffer is not submitted
+ * until the slot holding it is flushed, either explicitly or because the ring needs the space.
+ *
+ * @param destination The VkBuffer to which data will be transferred.
+ * @param data Pointer to the data to transfer.
+ * @param size Size, in bytes, of the data to transfer.
+ * @param offset Offset, in bytes, at which to place the data in the destination buffer.
+ */
+void GPUStagingRing::upload(VkBuffer destination, const void* data, VkDeviceSize size, VkDeviceSize offset)
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+
+	const char* source = (const char*)data;
+	char* mappedData = (char*)mMemory.mappedData;
+
+	while (size > 0)
+	{
+		Slot& slot = mSlots[mCurrentSlot];
+		if (!slot.recording)
+			beginSlot(slot);
+
+		// move on to the next slot once this one is full
+		VkDeviceSize start = ((slot.used + mCopyAlignment - 1) / mCopyAlignment) * mCopyAlignment;
+		if (start >= mSlotSize || (mOwnershipTransfer && slot.ownershipBarriers.size() >= maxOwnershipBarriers))
+		{
+			submitSlot(slot);
+			continue;
+		}
+
+		VkDeviceSize chunkSize = std::min(size, mSlotSize - start);
+		memcpy(mappedData + slot.begin + start, source, (size_t)chunkSize);
+
+		VkBufferCopy copyRegion = {};
+		copyRegion.srcOffset = slot.begin + start;
+		copyRegion.dstOffset = offset;
+		copyRegion.size = chunkSize;
+		vkCmdCopyBuffer(slot.commandBuffer, mBuffer, destination, 1, &copyRegion);
+		if (mOwnershipTransfer)
+			addOwnershipBarrier(slot, destination, offset, chunkSize);
+
+		slot.used = start + chunkSize;
+		source += chunkSize;
+		offset += chunkSize;
+		size -= chunkSize;
+	}
+}
+
+/**
+ * @brief Submits all uploads recorded since the last flush.
+ *
+ * @return uint64_t Serial number which can be passed to isComplete() or wait() to check
+ * for completion of every upload up to this point.
+ */
+uint64_t GPUStagingRing::flush()
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+
+	Slot& slot = mSlots[mCurrentSlot];
+	if (slot.recording)
+		return submitSlot(slot);
+
+	return mNextSerial - 1;
+}
+
+/**
+ * @brief Returns the serial that covers every upload recorded so far, without submitting anything.
+ *
+ * If uploads have been recorded since the last flush, this is the serial the current slot
+ * will be assigned when it is submitted. Passing it to wait() submits the slot first.
+ */
+uint64_t GPUStagingRing::getPendingSerial()
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+
+	return mSlots[mCurrentSlot].recording ? mNextSerial : mNextSerial - 1;
+}
+
+/**
+ * @brief Returns true if all uploads up to and including the given serial have completed on the GPU.
+ *
+ * @param serial A serial returned by flush() or getPendingSerial().
+ */
+bool GPUStagingRing::isComplete(uint64_t serial)
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+
+	for (auto& slot : mSlots)
+		if (slot.pending && vkGetFenceStatus(mEngine->getDevice(), slot.fence) == VK_SUCCESS)
+		{
+			slot.pending = false;
+			mCompletedSerial = std::max(mCompletedSerial, slot.serial);
+		}
+
+	return (serial <= mCompletedSerial);
+}
+
+/**
+ * @brief Blocks until all uploads up to and including the given serial have completed on the GPU.
+ *
+ * If the serial belongs to the slot that is still being recorded, that slot is submitted first.
+ *
+ * @param serial A serial returned by flush() or getPendingSerial().
+ */
+void GPUStagingRing::wait(uint64_t serial)
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+
+	Slot& current = mSlots[mCurrentSlot];
+	if (current.recording && serial >= mNextSerial)
+		submitSlot(current);
+
+	for (auto& slot : mSlots)
+		if (slot.pending && slot.serial <= serial)
+			waitForSlot(slot);
+}
+
+/**
+ * @brief Submits any recorded uploads, then blocks until all of them have completed on the GPU.
+ */
+void GPUStagingRing::waitIdle()
+{
+	wait(flush());
+}
+
+/**
+ * @brief Prepares a slot for recording, waiting for the GPU to finish with it first if necessary.
+ */
+void GPUStagingRing::beginSlot(Slot& slot)
+{
+	waitForSlot(slot);
+
+	VkCommandBufferBeginInfo beginInfo = {};
+	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	beginInfo.pNext = nullptr;
+	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+	beginInfo.pInheritanceInfo = nullptr;
+	vkBeginCommandBuffer(slot.commandBuffer, &beginInfo);
+
+	slot.used = 0;
+	slot.recording = true;
+}
+
+/**
+ * @brief Ends recording of a slot, submits it, and advances the ring to the next slot.
+ *
+ * @return uint64_t The serial assigned to the submitted slot.
+ */
+uint64_t GPUStagingRing::submitSlot(Slot& slot)
+{
+	// stages and accesses through which uploaded data may be consumed
+	VkPipelineStageFlags dstStages = VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_INPUT_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT
+		| VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT;
+	VkAccessFlags dstAccess = VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_INDEX_READ_BIT | VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT
+		| VK_ACCESS_UNIFORM_READ_BIT | VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_TRANSFER_READ_BIT;
+
+	VkDevice device = mEngine->getDevice();
+	vkResetFences(device, 1, &slot.fence);
+
+	if (!mOwnershipTransfer)
+	{
+		// make the uploaded data visible to everything submitted after this slot
+		VkMemoryBarrier barrier = {};
+		barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+		barrier.pNext = nullptr;
+		barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		barrier.dstAccessMask = dstAccess;
+		vkCmdPipelineBarrier(slot.commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, dstStages,
+			0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+		vkEndCommandBuffer(slot.commandBuffer);
+
+		VkSubmitInfo submitInfo = {};
+		submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+		submitInfo.pNext = nullptr;
+		submitInfo.commandBufferCount = 1;
+		submitInfo.pCommandBuffers = &slot.commandBuffer;
+
+		vkQueueSubmit(mGraphicsQueue, 1, &submitInfo, slot.fence);
+	}
+	else
+	{
+		// release the written ranges from the transfer queue family...
+		for (auto& barrier : slot.ownershipBarriers)
+		{
+			barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+			barrier.dstAccessMask = 0;
+		}
+		vkCmdPipelineBarrier(slot.commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+			0, 0, nullptr, slot.ownershipBarriers.size(), slot.ownershipBarriers.data(), 0, nullptr);
+		vkEndCommandBuffer(slot.commandBuffer);
+
+		VkSubmitInfo transferSubmitInfo = {};
+		transferSubmitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+		transferSubmitInfo.pNext = nullptr;
+		transferSubmitInfo.commandBufferCount = 1;
+		transferSubmitInfo.pCommandBuffers = &slot.commandBuffer;
+		transferSubmitInfo.signalSemaphoreCount = 1;
+		transferSubmitInfo.pSignalSemaphores = &slot.transferSemaphore;
+
+		vkQueueSubmit(mTransferQueue, 1, &transferSubmitInfo, VK_NULL_HANDLE);
+
+		// ...and acquire them on the graphics queue family, once the transfer is done
+		VkCommandBufferBeginInfo beginInfo = {};
+		beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+		beginInfo.pNext = nullptr;
+		beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+		beginInfo.pInheritanceInfo = nullptr;
+		vkBeginCommandBuffer(slot.acquireCommandBuffer, &beginInfo);
+
+		for (auto& barrier : slot.ownershipBarriers)
+		{
+			barrier.srcAccessMask = 0;
+			barrier.dstAccessMask = dstAccess;
+		}
+		vkCmdPipelineBarrier(slot.acquireCommandBuffer, dstStages, dstStages,
+			0, 0, nullptr, slot.ownershipBarriers.size(), slot.ownershipBarriers.data(), 0, nullptr);
+		vkEndCommandBuffer(slot.acquireCommandBuffer);
+
+		VkSubmitInfo acquireSubmitInfo = {};
+		acquireSubmitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+		acquireSubmitInfo.pNext = nullptr;
+		acquireSubmitInfo.waitSemaphoreCount = 1;
+		acquireSubmitInfo.pWaitSemaphores = &slot.transferSemaphore;
+		acquireSubmitInfo.pWaitDstStageMask = &dstStages;
+		acquireSubmitInfo.commandBufferCount = 1;
+		acquireSubmitInfo.pCommandBuffers = &slot.acquireCommandBuffer;
+
+		vkQueueSubmit(mGraphicsQueue, 1, &acquireSubmitInfo, slot.fence);
+		slot.ownershipBarriers.clear();
+	}
+
+	slot.serial = mNextSerial++;
+	slot.recording = false;
+	slot.pending = true;
+
+	mCurrentSlot = (mCurrentSlot + 1) % mSlots.size();
+	return slot.serial;
+}
+
+void GPUStagingRing::waitForSlot(Slot& slot)
+{
+	if (!slot.pending)
+		return;
+
+	vkWaitForFences(mEngine->getDevice(), 1, &slot.fence, VK_TRUE, UINT64_MAX);
+	slot.pending = false;
+	mCompletedSerial = std::max(mCompletedSerial, slot.serial);
+}
+
+/**
+ * @brief Records that a buffer range written by a slot must change queue family ownership.
+ *
+ * Contiguous ranges of the same buffer are merged into a single barrier.
+ */
+void GPUStagingRing::addOwnershipBarrier(Slot& slot, VkBuffer buffer, VkDeviceSize offset, VkDeviceSize size)
+{
+	if (!slot.ownershipBarriers.empty())
+	{
+		auto& last = slot.ownershipBarriers.back();
+		if (last.buffer == buffer && last.offset + last.size == offset)
+		{
+			last.size += size;
+			return;
+		}
+	}
+
+	VkBufferMemoryBarrier barrier = {};
+	barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+	barrier.pNext = nullptr;
+	barrier.srcQueueFamilyIndex = mTransferQueueFamily;
+	barrier.dstQueueFamilyIndex = mGraphicsQueueFamily;
+	barrier.buffer = buffer;
+	barrier.offset = offset;
+	barrier.size = size;
+	slot.ownershipBarriers.push_back(barrier);
+}
@@ -0,0 +1,100 @@
+#ifndef GPUSTAGINGRING_H
+#define GPUSTAGINGRING_H
+
+#include <cstdint>
+#include <mutex>
+#include <vector>
+#include <vulkan/vulkan.h>
+
+#include "GPUMemoryAllocator.h"
+
+class GPUEngine;
+
+/**
+ * @brief A persistently mapped staging buffer used to upload data to device-local buffers.
+ *
+ * The staging buffer is split into a fixed number of slots, each of which has its own
+ * command buffer and fence. Uploads are copied into the current slot and recorded as
+ * buffer copies; when a slot is flushed, it is submitted and the ring moves on to the
+ * next slot, only waiting on that slot's fence if the GPU has not finished with it yet.
+ * Uploads that are larger than a slot are split into chunks across several slots.
+ *
+ * When the GPUEngine has a dedicated transfer queue, copies are submitted to it so that they
+ * can overlap rendering. Each slot then releases ownership of the written buffer ranges to the
+ * graphics queue family, and a small command buffer submitted to the graphics queue, which waits
+ * on the transfer through a semaphore, acquires them. Otherwise, copies are submitted to the
+ * graphics queue and each slot ends with a memory barrier. Either way, uploaded data is visible
+ * to any work that is submitted to the graphics queue after the slot. Since ownership of a
+ * buffer is not transferred back to the transfer queue family, a buffer uploaded through
+ * the ring should not also be written by the graphics queue.
+ *
+ * No memory, buffers or command buffers are allocated after construction.
+ *
+ * Intended to be created and owned by a GPUEngine instance.
+ */
+class GPUStagingRing
+{
+public:
+	static constexpr VkDeviceSize defaultRingSize = 16 * 1024 * 1024;
+	static constexpr uint32_t defaultSlotCount = 4;
+	static constexpr size_t maxOwnershipBarriers = 256;
+
+	// constructors and destructor
+	GPUStagingRing(GPUEngine* engine, VkDeviceSize ringSize = defaultRingSize, uint32_t slotCount = defaultSlotCount);
+	GPUStagingRing(GPUStagingRing& other) = delete;
+	GPUStagingRing(GPUStagingRing&& other) = delete;
+	GPUStagingRing& operator=(GPUStagingRing& other) = delete;
+	~GPUStagingRing();
+
+	// public functionality
+	void upload(VkBuffer destination, const void* data, VkDeviceSize size, VkDeviceSize offset);
+	uint64_t flush();
+	uint64_t getPendingSerial();
+	bool isComplete(uint64_t serial);
+	void wait(uint64_t serial);
+	void waitIdle();
+
+private:
+	struct Slot
+	{
+		VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
+		VkCommandBuffer acquireCommandBuffer = VK_NULL_HANDLE;	// only used with a dedicated transfer queue
+		VkSemaphore transferSemaphore = VK_NULL_HANDLE;			// only used with a dedicated transfer queue
+		VkFence fence = VK_NULL_HANDLE;
+		std::vector<VkBufferMemoryBarrier> ownershipBarriers;
+		VkDeviceSize begin = 0;
+		VkDeviceSize used = 0;
+		uint64_t serial = 0;
+		bool recording = false;
+		bool pending = false;
+	};
+
+	// private helper functions
+	void beginSlot(Slot& slot);
+	uint64_t submitSlot(Slot& slot);
+	void waitForSlot(Slot& slot);
+	void addOwnershipBarrier(Slot& slot, VkBuffer buffer, VkDeviceSize offset, VkDeviceSize size);
+
+	// private member variables
+	GPUEngine* mEngine;
+	VkQueue mTransferQueue = VK_NULL_HANDLE;
+	VkQueue mGraphicsQueue = VK_NULL_HANDLE;
+	uint32_t mTransferQueueFamily = 0;
+	uint32_t mGraphicsQueueFamily = 0;
+	bool mOwnershipTransfer = false;
+	VkDeviceSize mSlotSize = 0;
+	VkDeviceSize mCopyAlignment = 16;
+	std::vector<Slot> mSlots;
+	size_t mCurrentSlot = 0;
+	uint64_t mNextSerial = 1;
+	uint64_t mCompletedSerial = 0;
+	std::mutex mMutex;
+
+	// Vulkan handles owned by GPUStagingRing
+	VkBuffer mBuffer = VK_NULL_HANDLE;
+	GPUMemoryAllocator::Allocation mMemory;
+	VkCommandPool mCommandPool = VK_NULL_HANDLE;
+	VkCommandPool mAcquireCommandPool = VK_NULL_HANDLE;
+};
+
+#endif
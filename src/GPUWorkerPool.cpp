@@ -0,0 +1,109 @@
+#include "GPUWorkerPool.h"
+
+GPUWorkerPool::GPUWorkerPool(uint32_t workerCount)
+{
+	for (uint32_t i = 0; i < workerCount; i++)
+		mWorkers.emplace_back(&GPUWorkerPool::workerLoop, this);
+}
+
+GPUWorkerPool::~GPUWorkerPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		mStopping = true;
+	}
+	mJobsAvailable.notify_all();
+
+	for (auto& worker : mWorkers)
+		worker.join();
+}
+
+/**
+ * @brief Runs job once for every index in [0, jobCount), and waits until all of them are done.
+ *
+ * The calling thread runs jobs too, so a batch makes progress even if every worker is busy
+ * or the pool has no workers at all. If another batch is already running, every job of this
+ * one is run on the calling thread, so that jobs may start batches of their own.
+ *
+ * @param jobCount Number of jobs in the batch.
+ * @param job Function to call with the index of each job; called from several threads at once.
+ */
+void GPUWorkerPool::run(uint32_t jobCount, const std::function<void(uint32_t)>& job)
+{
+	if (jobCount == 0)
+		return;
+
+	std::unique_lock<std::mutex> lock(mMutex);
+	if (mJob != nullptr)
+	{
+		lock.unlock();
+		for (uint32_t i = 0; i < jobCount; i++)
+			job(i);
+		return;
+	}
+
+	mJob = &job;
+	mJobCount = jobCount;
+	mNextJob = 0;
+	mFinishedJobs = 0;
+	mJobsAvailable.notify_all();
+
+	// help with the batch instead of waiting idly
+	while (runNextJob(lock));
+
+	mJobsFinished.wait(lock, [this]() { return mFinishedJobs == mJobCount; });
+	mJob = nullptr;
+	mJobCount = 0;
+}
+
+/**
+ * @brief Chooses how many threads a pool should run batches on, including the calling thread.
+ *
+ * @return The number of hardware threads, clamped to [1, maxThreads].
+ */
+uint32_t GPUWorkerPool::getHardwareThreadCount()
+{
+	uint32_t hardwareThreads = std::thread::hardware_concurrency();
+	uint32_t threadCount = (hardwareThreads < maxThreads) ? hardwareThreads : maxThreads;
+	return (threadCount < 1) ? 1 : threadCount;
+}
+
+/**
+ * @brief Takes jobs from the current batch until the pool is destroyed.
+ */
+void GPUWorkerPool::workerLoop()
+{
+	std::unique_lock<std::mutex> lock(mMutex);
+	while (true)
+	{
+		mJobsAvailable.wait(lock, [this]() { return mStopping || mNextJob < mJobCount; });
+		if (mStopping)
+			return;
+
+		while (runNextJob(lock));
+	}
+}
+
+/**
+ * @brief Runs the next job of the current batch, if there is one, with the mutex unlocked.
+ *
+ * @param lock Lock on mMutex, which is held when this function is called and when it returns.
+ * @return true A job was run.
+ * @return false There are no jobs left to start in the current batch.
+ */
+bool GPUWorkerPool::runNextJob(std::unique_lock<std::mutex>& lock)
+{
+	if (mNextJob >= mJobCount)
+		return false;
+
+	uint32_t index = mNextJob++;
+	const std::function<void(uint32_t)>& job = *mJob;
+
+	lock.unlock();
+	job(index);
+	lock.lock();
+
+	if (++mFinishedJobs == mJobCount)
+		mJobsFinished.notify_all();
+	return true;
+}
@@ -0,0 +1,61 @@
+#ifndef GPUWORKERPOOL_H
+#define GPUWORKERPOOL_H
+
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * @brief A fixed set of worker threads which run batches of indexed jobs.
+ *
+ * run() hands out the job indices of a batch to the workers, and the calling thread takes
+ * jobs as well instead of sleeping until the batch is done. Only one batch runs at a time,
+ * and run() only returns once every job in the batch has finished. A batch started while
+ * another is running, such as from inside one of its jobs, runs entirely on the calling
+ * thread. The pool does not decide which job runs on which thread, so jobs which need
+ * exclusive resources should be split by job index rather than by thread.
+ *
+ * Intended to be created and owned by a GPUEngine instance, and shared by everything which
+ * records command buffers or rasterizes occluders in parallel.
+ */
+class GPUWorkerPool
+{
+public:
+	static constexpr uint32_t maxThreads = 4;
+
+	// constructors and destructor
+	GPUWorkerPool(uint32_t workerCount);
+	GPUWorkerPool(GPUWorkerPool& other) = delete;
+	GPUWorkerPool(GPUWorkerPool&& other) = delete;
+	GPUWorkerPool& operator=(GPUWorkerPool& other) = delete;
+	~GPUWorkerPool();
+
+	// public functionality
+	void run(uint32_t jobCount, const std::function<void(uint32_t)>& job);
+	static uint32_t getHardwareThreadCount();
+
+	// public getters
+	uint32_t getWorkerCount() { return mWorkers.size(); }
+	uint32_t getThreadCount() { return mWorkers.size() + 1; }
+
+private:
+	// private helper functions
+	void workerLoop();
+	bool runNextJob(std::unique_lock<std::mutex>& lock);
+
+	// private member variables
+	std::vector<std::thread> mWorkers;
+	std::mutex mMutex;
+	std::condition_variable mJobsAvailable;
+	std::condition_variable mJobsFinished;
+	const std::function<void(uint32_t)>* mJob = nullptr;
+	uint32_t mJobCount = 0;
+	uint32_t mNextJob = 0;
+	uint32_t mFinishedJobs = 0;
+	bool mStopping = false;
+};
+
+#endif
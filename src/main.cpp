@@ -6,6 +6,8 @@
 #include "GPUEngine.h"
 #include "GPUMeshWrangler.h"
 #include "GPUImage.h"
+#include "GPUProcessCull.h"
+#include "GPUProcessDepthPyramid.h"
 #include "GPUProcessRenderPass.h"
 #include "GPUProcessSwapchain.h"
 #include "GPUWindowSystemGLFW.h"
@@ -36,37 +38,75 @@ int main()
 		auto presentProcess = engine.getPresentProcess();
 
 		// create a process to manage the Z/depth buffer image
-		auto zBufferImage = new GPUImage(VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT, VK_IMAGE_TILING_OPTIMAL, 1);
-
-		// create a render pass which renders color to the swapchain's image,
-		// uses zBufferImage as its depth buffer, and reads from the mesh wrangler's uniform buffer
-		auto renderPassProcess = new GPUProcessRenderPass(1);
-		renderPassProcess->setImageViewPR(swapchainProcess->getPRImageView());
-		renderPassProcess->setZBufferViewPR(zBufferImage->getImageViewPR());
-		renderPassProcess->setUniformBufferPR(meshWrangler->getPRUniformBuffer());
+		// (the depth buffer is sampled to build the depth pyramid, so it cannot be lazily allocated)
+		auto zBufferImage = new GPUImage(VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT,
+			VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_IMAGE_TILING_OPTIMAL, 1);
+
+		// create a process which culls mesh instances on the GPU, reading the mesh wrangler's transform buffer;
+		// its early phase only draws the instances which were visible in the previous frame
+		auto earlyCullProcess = new GPUProcessCull(GPUProcessCull::CULL_PHASE_EARLY);
+		earlyCullProcess->setUniformBufferPR(meshWrangler->getPRUniformBuffer());
+
+		// create a render pass which renders color to the swapchain's image, uses zBufferImage
+		// as its depth buffer, draws the instances which passed early culling, and keeps its attachments
+		auto earlyRenderPassProcess = new GPUProcessRenderPass(1);
+		earlyRenderPassProcess->setImageViewPR(swapchainProcess->getPRImageView());
+		earlyRenderPassProcess->setZBufferViewPR(zBufferImage->getImageViewPR());
+		earlyRenderPassProcess->setUniformBufferPR(meshWrangler->getPRUniformBuffer());
+		earlyRenderPassProcess->setCullProcess(earlyCullProcess);
+		earlyRenderPassProcess->setKeepAttachments(true);
+
+		// create a process which builds a depth pyramid from the early render pass's depth buffer
+		auto depthPyramidProcess = new GPUProcessDepthPyramid;
+		depthPyramidProcess->setDepthViewPR(earlyRenderPassProcess->getZBufferViewOutPR());
+
+		// create the late phase of culling, which tests every instance against the depth pyramid
+		auto lateCullProcess = new GPUProcessCull(GPUProcessCull::CULL_PHASE_LATE);
+		lateCullProcess->setUniformBufferPR(meshWrangler->getPRUniformBuffer());
+		lateCullProcess->setPyramidViewPR(depthPyramidProcess->getPRPyramidView());
+		lateCullProcess->setEarlyPhase(earlyCullProcess);
+
+		// create a render pass which continues drawing into the early render pass's attachments,
+		// drawing the instances which passed late culling
+		auto lateRenderPassProcess = new GPUProcessRenderPass(1);
+		lateRenderPassProcess->setImageViewPR(earlyRenderPassProcess->getImageViewOutPR());
+		lateRenderPassProcess->setZBufferViewPR(earlyRenderPassProcess->getZBufferViewOutPR());
+		lateRenderPassProcess->setUniformBufferPR(meshWrangler->getPRUniformBuffer());
+		lateRenderPassProcess->setCullProcess(lateCullProcess);
+		lateRenderPassProcess->setLoadAttachments(true);
 
 		// set up the render subpasses
-		auto subpass = renderPassProcess->getSubpass(0);
-		subpass->setShader("phong", VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT);
-		subpass->setInputAttachments({});
-		subpass->setColorAttachments({{0, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL}});
-		subpass->setDepthAttachment({1, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL});
-		subpass->setAttributeTypes({GPUMesh::MESH_ATTRIBUTE_POSITION, GPUMesh::MESH_ATTRIBUTE_NORMAL});
-
-		// tell the present process to present after the render pass is done rendering
-		presentProcess->setImageViewInPR(renderPassProcess->getImageViewOutPR());
-
-		// add the Z-buffer image, and the render pass, to the engine's dependency graph
+		for (auto renderPassProcess : {earlyRenderPassProcess, lateRenderPassProcess})
+		{
+			auto subpass = renderPassProcess->getSubpass(0);
+			subpass->setShader("phong", VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT);
+			subpass->setInputAttachments({});
+			subpass->setColorAttachments({{0, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL}});
+			subpass->setDepthAttachment({1, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL});
+			subpass->setAttributeTypes({GPUMesh::MESH_ATTRIBUTE_POSITION, GPUMesh::MESH_ATTRIBUTE_NORMAL});
+		}
+
+		// tell the present process to present after the late render pass is done rendering
+		presentProcess->setImageViewInPR(lateRenderPassProcess->getImageViewOutPR());
+
+		// add the Z-buffer image, the cull processes, the render passes and the depth pyramid to the engine's dependency graph
 		engine.addProcess(zBufferImage);
-		engine.addProcess(renderPassProcess);
+		engine.addProcess(earlyCullProcess);
+		engine.addProcess(earlyRenderPassProcess);
+		engine.addProcess(depthPyramidProcess);
+		engine.addProcess(lateCullProcess);
+		engine.addProcess(lateRenderPassProcess);
 
 		// build the dependency graph
 		engine.validateProcesses();
 	}
 
 	// load the 3D mesh contained in assets/face.glb
+	// (meshes loaded inside one upload batch share a single submission)
 	GPUMesh faceMesh("monkey.fbx", &engine);
+	engine.beginUploadBatch();
 	faceMesh.load();
+	engine.endUploadBatch();
 
 	// create two mesh instances and associated transformation data
 	GPUMesh::Instance meshInstance1;
@@ -91,8 +131,14 @@ int main()
 		meshWrangler->reset();
 
 		// update the transformation data of the mesh instances
-		meshInstance1.mTransform = glm::translate(translation1) * glm::rotate(rot, axis1);
-		meshInstance2.mTransform = glm::translate(translation2) * glm::rotate(rot, axis2);
+		meshInstance1.setTransform(glm::translate(translation1) * glm::rotate(rot, axis1));
+		meshInstance2.setTransform(glm::translate(translation2) * glm::rotate(rot, axis2));
+
+		// set up the camera, which is used both for culling and for rendering
+		auto extent = engine.getSurfaceExtent();
+		glm::vec3 cameraTranslation = { 0.0f, 0.0f, -3.0f };
+		meshWrangler->setViewProjection(glm::perspective(45.0f, ((float)extent.width / (float)extent.height), 0.01f, 100.0f)
+			* glm::translate(glm::identity<glm::mat4>(), cameraTranslation));
 
 		// stage the mesh instances
 		meshWrangler->stageMeshInstance(&meshInstance1);
@@ -105,5 +151,8 @@ int main()
 		rot += 0.01;
 	}
 
+	// wait for the frames in flight to finish before their resources are destroyed
+	engine.waitIdle();
+
 	return 0;
 }
\ No newline at end of file
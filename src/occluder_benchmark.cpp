@@ -0,0 +1,88 @@
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <vector>
+
+#include "GPUOccluderRasterizer.h"
+#include "GPUWorkerPool.h"
+#include "glm_includes.h"
+
+static constexpr uint32_t occluderCount = 256;
+static constexpr uint32_t boxCount = 16384;
+static constexpr uint32_t iterations = 200;
+
+/**
+ * @brief Builds an axis-aligned box with corners at -1 and 1, as a Mesh of 12 triangles.
+ */
+static GPUOccluderRasterizer::Mesh createBoxMesh()
+{
+	GPUOccluderRasterizer::Mesh mesh;
+	for (uint32_t corner = 0; corner < 8; corner++)
+		mesh.positions.push_back(glm::vec3((corner & 1) ? 1.0f : -1.0f, (corner & 2) ? 1.0f : -1.0f, (corner & 4) ? 1.0f : -1.0f));
+
+	// two triangles for each face, indexed by the corners' bit patterns
+	uint32_t faces[6][4] = { { 0, 1, 3, 2 }, { 4, 6, 7, 5 }, { 0, 4, 5, 1 }, { 2, 3, 7, 6 }, { 0, 2, 6, 4 }, { 1, 5, 7, 3 } };
+	for (auto& face : faces)
+		mesh.indices.insert(mesh.indices.end(), { face[0], face[1], face[2], face[0], face[2], face[3] });
+	return mesh;
+}
+
+/**
+ * @brief Times GPUOccluderRasterizer on a fixed, randomly placed scene of box occluders.
+ *
+ * Reports the average time to rasterize the occluders and to test a set of bounding boxes
+ * against them, on the calling thread alone and with a GPUWorkerPool.
+ *
+ * @return int
+ */
+int main()
+{
+	GPUOccluderRasterizer::Mesh boxMesh = createBoxMesh();
+
+	// scatter occluders and boxes in front of the camera, with the same seed every run
+	std::mt19937 random(1);
+	std::uniform_real_distribution<float> spread(-20.0f, 20.0f);
+	std::uniform_real_distribution<float> distance(5.0f, 60.0f);
+	std::uniform_real_distribution<float> size(0.2f, 3.0f);
+
+	std::vector<GPUOccluderRasterizer::Occluder> occluders(occluderCount);
+	for (auto& occluder : occluders)
+	{
+		glm::vec3 position(spread(random), spread(random) * 0.5f, -distance(random));
+		occluder.mesh = &boxMesh;
+		occluder.transform = glm::translate(position) * glm::scale(glm::vec3(size(random)));
+	}
+
+	std::vector<glm::mat4> boxTransforms(boxCount);
+	for (auto& transform : boxTransforms)
+		transform = glm::translate(glm::vec3(spread(random), spread(random) * 0.5f, -distance(random)));
+
+	glm::mat4 projection = glm::perspective(glm::radians(60.0f), 2.0f, 0.1f, 100.0f);
+	glm::mat4 viewProjection = projection * glm::lookAt(glm::vec3(0.0f), glm::vec3(0.0f, 0.0f, -1.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+
+	GPUWorkerPool workerPool(GPUWorkerPool::getHardwareThreadCount() - 1);
+	GPUWorkerPool* pools[2] = { nullptr, &workerPool };
+	for (GPUWorkerPool* pool : pools)
+	{
+		GPUOccluderRasterizer rasterizer(256, 128, pool);
+		size_t visibleCount = 0;
+
+		auto start = std::chrono::steady_clock::now();
+		for (uint32_t i = 0; i < iterations; i++)
+			rasterizer.rasterize(viewProjection, occluders);
+		auto rasterized = std::chrono::steady_clock::now();
+		for (uint32_t i = 0; i < iterations; i++)
+			for (auto& transform : boxTransforms)
+				visibleCount += rasterizer.isBoxVisible(transform, glm::vec3(-0.5f), glm::vec3(0.5f));
+		auto tested = std::chrono::steady_clock::now();
+
+		std::chrono::duration<double, std::milli> rasterizeTime = rasterized - start;
+		std::chrono::duration<double, std::milli> testTime = tested - rasterized;
+		std::cout << (pool ? pool->getThreadCount() : 1) << " thread(s): "
+			<< rasterizer.getTriangleCount() << " triangles rasterized in " << rasterizeTime.count() / iterations << " ms, "
+			<< boxCount << " boxes tested in " << testTime.count() / iterations << " ms, "
+			<< visibleCount / iterations << " visible" << std::endl;
+	}
+
+	return 0;
+}
@@ -0,0 +1,138 @@
+// declarations and functions shared by the culling compute shaders
+
+layout(local_size_x = 64) in;
+
+// a run of instances of one mesh, and the bounding sphere of that mesh
+struct DrawInfo
+{
+    vec4 sphere;
+    uint firstInstance;
+    uint instanceCount;
+    uint pad0;
+    uint pad1;
+};
+
+struct DrawCommand
+{
+    uint indexCount;
+    uint instanceCount;
+    uint firstIndex;
+    int vertexOffset;
+    uint firstInstance;
+};
+
+layout( push_constant ) uniform PushConstantObject
+{
+    mat4 vpMatrix;
+    uint instanceCount;
+    uint drawCount;
+} pco;
+
+layout(std430, binding = 0) readonly buffer TransformBuffer
+{
+    mat4 model[];
+} transforms;
+
+layout(std430, binding = 1) readonly buffer DrawBuffer
+{
+    DrawInfo draws[];
+} draws;
+
+layout(std430, binding = 2) buffer CommandBuffer
+{
+    DrawCommand commands[];
+} commands;
+
+layout(std430, binding = 3) writeonly buffer VisibleBuffer
+{
+    uint index[];
+} visible;
+
+// instance counts of this frame, read back by the CPU
+layout(std430, binding = 4) buffer CounterBuffer
+{
+    uint visible;
+    uint frustumCulled;
+    uint occluded;
+} counters;
+
+shared uint visibleCount;
+shared uint frustumCulledCount;
+shared uint occludedCount;
+
+// counts are gathered per workgroup, so that each workgroup only adds to the counter buffer once
+void beginCounting()
+{
+    if (gl_LocalInvocationIndex == 0)
+    {
+        visibleCount = 0;
+        frustumCulledCount = 0;
+        occludedCount = 0;
+    }
+    barrier();
+}
+
+void endCounting()
+{
+    barrier();
+    if (gl_LocalInvocationIndex == 0)
+    {
+        atomicAdd(counters.visible, visibleCount);
+        atomicAdd(counters.frustumCulled, frustumCulledCount);
+        atomicAdd(counters.occluded, occludedCount);
+    }
+}
+
+// find the draw an instance belongs to; draws are sorted by first instance
+uint findDraw(uint instance)
+{
+    uint low = 0;
+    uint high = pco.drawCount - 1;
+    while (low < high)
+    {
+        uint middle = (low + high + 1) / 2;
+        if (draws.draws[middle].firstInstance <= instance)
+            low = middle;
+        else
+            high = middle - 1;
+    }
+    return low;
+}
+
+// transform the bounding sphere, scaling its radius by the largest scale of the transform
+void getWorldSphere(uint instance, DrawInfo draw, out vec3 center, out float radius)
+{
+    mat4 model = transforms.model[instance];
+    center = (model * vec4(draw.sphere.xyz, 1.0)).xyz;
+    float scaleSquared = max(max(dot(model[0].xyz, model[0].xyz), dot(model[1].xyz, model[1].xyz)), dot(model[2].xyz, model[2].xyz));
+    radius = draw.sphere.w * sqrt(scaleSquared);
+}
+
+// test a sphere against the frustum planes, taken from the rows of the view-projection matrix
+bool sphereInFrustum(vec3 center, float radius)
+{
+    mat4 rows = transpose(pco.vpMatrix);
+    vec4 planes[6] = vec4[6](
+        rows[3] + rows[0],
+        rows[3] - rows[0],
+        rows[3] + rows[1],
+        rows[3] - rows[1],
+        rows[2],
+        rows[3] - rows[2]);
+
+    for (int p = 0; p < 6; p++)
+    {
+        float planeLength = length(planes[p].xyz);
+        if (dot(planes[p].xyz, center) + planes[p].w < -radius * planeLength)
+            return false;
+    }
+    return true;
+}
+
+// append an instance to its draw's range of the visible list
+void appendInstance(uint drawIndex, DrawInfo draw, uint instance)
+{
+    uint slot = atomicAdd(commands.commands[drawIndex].instanceCount, 1);
+    visible.index[draw.firstInstance + slot] = instance;
+    atomicAdd(visibleCount, 1);
+}
\ No newline at end of file
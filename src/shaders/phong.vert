@@ -5,10 +5,11 @@ layout( push_constant ) uniform PushConstantObject
     mat4 vpMatrix;
 } pco;
 
-layout(binding = 0) uniform UniformBufferObject
+// tightly packed transforms of all mesh instances, indexed by instance index
+layout(std430, binding = 0) readonly buffer TransformBuffer
 {
-    mat4 model;
-} ubo;
+    mat4 model[];
+} transforms;
 
 layout(location = 0) in vec3 inPos;
 layout(location = 1) in vec3 inNorm;
@@ -16,8 +17,9 @@ layout(location = 1) in vec3 inNorm;
 layout(location = 0) out vec3 outNormal;
 
 void main() {
-    gl_Position = pco.vpMatrix * ubo.model * vec4(inPos, 1.0);
+    mat4 model = transforms.model[gl_InstanceIndex];
+    gl_Position = pco.vpMatrix * model * vec4(inPos, 1.0);
     
-    vec4 normal4 = ubo.model * vec4(inNorm, 0.0);
+    vec4 normal4 = model * vec4(inNorm, 0.0);
     outNormal = normalize(vec3(normal4.x, normal4.y, normal4.z));
 }
\ No newline at end of file
@@ -0,0 +1,32 @@
+#version 450
+
+layout( push_constant ) uniform PushConstantObject
+{
+    mat4 vpMatrix;
+    uint instanceOffset;    // first instance of the draw, if indirect draws cannot start past instance zero
+} pco;
+
+// tightly packed transforms of all mesh instances
+layout(std430, binding = 0) readonly buffer TransformBuffer
+{
+    mat4 model[];
+} transforms;
+
+// indices of the instances which passed GPU culling, indexed by instance index
+layout(std430, binding = 1) readonly buffer VisibleBuffer
+{
+    uint index[];
+} visible;
+
+layout(location = 0) in vec3 inPos;
+layout(location = 1) in vec3 inNorm;
+
+layout(location = 0) out vec3 outNormal;
+
+void main() {
+    mat4 model = transforms.model[visible.index[pco.instanceOffset + gl_InstanceIndex]];
+    gl_Position = pco.vpMatrix * model * vec4(inPos, 1.0);
+    
+    vec4 normal4 = model * vec4(inNorm, 0.0);
+    outNormal = normalize(vec3(normal4.x, normal4.y, normal4.z));
+}
\ No newline at end of file